@@ -0,0 +1,235 @@
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "alt.h"
+#include "heap.h"
+
+/**
+ * Full Dijkstra search from source, storing the travel time to every node
+ * in dist, or INFINITY for unreachable nodes.
+ */
+static void
+one_to_all(const struct graph * g, int source, double dist[], struct heap * heap)
+{
+    for (int i = 0; i < g->nr_nodes; i++) {
+        dist[i] = INFINITY;
+    }
+    heap_clear(heap);
+
+    dist[source] = 0.0;
+    heap_push(heap, source, 0.0);
+    while (heap->size > 0) {
+        int u = heap_pop(heap).id;
+        for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+            int v = g->target[e];
+            double d = dist[u] + g->cost[e];
+            if (d < dist[v]) {
+                dist[v] = d;
+                if (heap_contains(heap, v)) {
+                    heap_decrease_key(heap, v, d);
+                } else {
+                    heap_push(heap, v, d);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @return A node of the largest weakly connected component of the map, the
+ * one where landmarks pay off. queue and seen must have room for every node.
+ */
+static int
+largest_component_node(const struct graph * forward, const struct graph * reverse,
+                       int queue[], bool seen[])
+{
+    const struct graph *graphs[2] = { forward, reverse };
+    int V = forward->nr_nodes;
+    int best = 0, best_size = 0;
+
+    memset(seen, 0, V * sizeof(bool));
+    for (int root = 0; root < V; root++) {
+        if (seen[root]) {
+            continue;
+        }
+        // breadth-first over the edges in both directions
+        int head = 0, tail = 0;
+        queue[tail++] = root;
+        seen[root] = true;
+        while (head < tail) {
+            int u = queue[head++];
+            for (int k = 0; k < 2; k++) {
+                const struct graph *g = graphs[k];
+                for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+                    int v = g->target[e];
+                    if (!seen[v]) {
+                        seen[v] = true;
+                        queue[tail++] = v;
+                    }
+                }
+            }
+        }
+        if (tail > best_size) {
+            best = root;
+            best_size = tail;
+        }
+    }
+    return best;
+}
+
+/**
+ * @return The reachable node with the largest value in score, or -1 if
+ * there is none.
+ */
+static int
+farthest(int n, const double score[n])
+{
+    int best = -1;
+    for (int v = 0; v < n; v++) {
+        if (isfinite(score[v]) && (best == -1 || score[v] > score[best])) {
+            best = v;
+        }
+    }
+    return best;
+}
+
+bool
+landmarks_build(struct landmarks * lm, const struct graph * forward,
+                const struct graph * reverse, int count)
+{
+    int V = forward->nr_nodes;
+    struct heap heap;
+    bool ok = false;
+
+    memset(lm, 0, sizeof(struct landmarks));
+    if (count <= 0 || V == 0) {
+        return false;
+    }
+    if (count > V) {
+        count = V;
+    }
+
+    double *dist = malloc(V * sizeof(double));
+    double *closest = malloc(V * sizeof(double));   // distance to nearest landmark
+    int *queue = malloc(V * sizeof(int));
+    bool *seen = malloc(V * sizeof(bool));
+    bool heap_ok = heap_init(&heap, V);
+    lm->nodes = malloc(count * sizeof(int));
+    lm->from = malloc((size_t)V * count * sizeof(float));
+    lm->to = malloc((size_t)V * count * sizeof(float));
+    if (!dist || !closest || !queue || !seen || !heap_ok || !lm->nodes || !lm->from || !lm->to) {
+        goto done;
+    }
+    lm->count = count;
+    lm->nr_nodes = V;
+    lm->slack = 0.0;
+
+    // the node farthest from a start in the main component lies on the edge
+    // of the map; starting on an island would put every landmark there
+    int start = largest_component_node(forward, reverse, queue, seen);
+    one_to_all(forward, start, closest, &heap);
+    int next = farthest(V, closest);
+    for (int v = 0; v < V; v++) {
+        closest[v] = INFINITY;
+    }
+
+    int selected = 0;
+    while (selected < count && next != -1) {
+        int i = selected++;
+        lm->nodes[i] = next;
+
+        one_to_all(forward, next, dist, &heap);
+        for (int v = 0; v < V; v++) {
+            lm->from[(size_t)v * count + i] = dist[v];
+            if (dist[v] < closest[v]) {
+                closest[v] = dist[v];
+            }
+            if (isfinite(dist[v]) && dist[v] > lm->slack) {
+                lm->slack = dist[v];
+            }
+        }
+        one_to_all(reverse, next, dist, &heap);
+        for (int v = 0; v < V; v++) {
+            lm->to[(size_t)v * count + i] = dist[v];
+            if (isfinite(dist[v]) && dist[v] > lm->slack) {
+                lm->slack = dist[v];
+            }
+        }
+
+        // landmarks have no distance left to gain, so they are never chosen twice
+        next = farthest(V, closest);
+        if (next != -1 && closest[next] == 0.0) {
+            next = -1;
+        }
+    }
+
+    // a map with few reachable nodes may run out of candidates; fill the
+    // remaining columns with copies of the last landmark, which only repeat
+    // a bound that is already computed
+    for (int i = selected; i < count; i++) {
+        lm->nodes[i] = lm->nodes[selected - 1];
+        for (int v = 0; v < V; v++) {
+            lm->from[(size_t)v * count + i] = lm->from[(size_t)v * count + selected - 1];
+            lm->to[(size_t)v * count + i] = lm->to[(size_t)v * count + selected - 1];
+        }
+    }
+    // each float is off by at most half a unit in the last place, so a
+    // difference of two is off by at most FLT_EPSILON times the longest one
+    lm->slack *= FLT_EPSILON;
+    ok = true;
+
+done:
+    free(dist);
+    free(closest);
+    free(queue);
+    free(seen);
+    if (heap_ok) {
+        heap_free(&heap);
+    }
+    if (!ok) {
+        landmarks_free(lm);
+    }
+    return ok;
+}
+
+void
+landmarks_free(struct landmarks * lm)
+{
+    free(lm->nodes);
+    free(lm->from);
+    free(lm->to);
+    lm->nodes = NULL;
+    lm->from = NULL;
+    lm->to = NULL;
+    lm->count = 0;
+    lm->nr_nodes = 0;
+}
+
+double
+landmarks_lower_bound(const struct landmarks * lm, int v, int t)
+{
+    const float *from_v = lm->from + (size_t)v * lm->count;
+    const float *from_t = lm->from + (size_t)t * lm->count;
+    const float *to_v = lm->to + (size_t)v * lm->count;
+    const float *to_t = lm->to + (size_t)t * lm->count;
+    double best = 0.0;
+
+    for (int i = 0; i < lm->count; i++) {
+        // skip pairs involving unreachable nodes, their difference is meaningless
+        if (isfinite(from_t[i]) && isfinite(from_v[i])) {
+            double d = (double)from_t[i] - from_v[i] - lm->slack;
+            if (d > best) {
+                best = d;
+            }
+        }
+        if (isfinite(to_v[i]) && isfinite(to_t[i])) {
+            double d = (double)to_v[i] - to_t[i] - lm->slack;
+            if (d > best) {
+                best = d;
+            }
+        }
+    }
+    return best;
+}
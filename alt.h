@@ -0,0 +1,60 @@
+#ifndef _ALT_H_
+#define _ALT_H_
+
+#include <stdbool.h>
+#include "graph.h"
+
+/**
+ * Landmarks for ALT (A*, landmarks and triangle inequality) searches. For a
+ * handful of landmark nodes we store the travel time from the landmark to
+ * every node and from every node to the landmark. By the triangle inequality
+ * the travel time from v to t is at least d(L, t) - d(L, v) and at least
+ * d(v, L) - d(t, L) for every landmark L, which is usually a much tighter
+ * bound than the straight-line distance.
+ *
+ * The tables are stored node-major, so the distances of one node to all the
+ * landmarks share a cache line, and as floats to halve their size. Bounds
+ * are lowered by a constant slack covering the rounding of the floats, which
+ * keeps them admissible. Being constant, it cancels between neighbouring
+ * nodes, so the bounds stay consistent, as the A* search needs since it
+ * never reopens a node, up to the rounding of the tables themselves. That
+ * is about 1e-7 of the longest landmark distance, and is the most an ALT
+ * path can exceed the shortest one by.
+ */
+struct landmarks {
+    int count;          // number of landmarks
+    int nr_nodes;
+    int *nodes;         // node id of each landmark
+    float *from;        // from[v * count + i]: travel time from landmark i to v
+    float *to;          // to[v * count + i]: travel time from v to landmark i
+    double slack;       // subtracted from every bound for the float rounding
+};
+
+/**
+ * Select landmarks and compute their distance tables. The first landmark is
+ * the node farthest from a node of the largest connected component, so that
+ * an island around node 0 cannot capture them all, and each following one is
+ * the node farthest from all the landmarks selected so far, which spreads
+ * them out along the edges of the map where they give the best bounds.
+ *
+ * @param lm The landmarks to fill in.
+ * @param forward The road graph.
+ * @param reverse The road graph with every edge flipped.
+ * @param count The number of landmarks to select.
+ * @return true on success, false if memory allocation fails.
+ */
+bool landmarks_build(struct landmarks * lm, const struct graph * forward,
+                     const struct graph * reverse, int count);
+
+/**
+ * Release the memory held by a set of landmarks. It is safe to call this on
+ * a zero-initialized set that was never built.
+ */
+void landmarks_free(struct landmarks * lm);
+
+/**
+ * @return A lower bound on the travel time from v to t, in minutes.
+ */
+double landmarks_lower_bound(const struct landmarks * lm, int v, int t);
+
+#endif /* _ALT_H_ */
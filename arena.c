@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "arena.h"
+
+/**
+ * The chunk contents are aligned for every basic type.
+ */
+union aligned {
+    long double d;
+    long long i;
+    void *p;
+};
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    union aligned data[];
+};
+
+void
+arena_init(struct arena * a)
+{
+    memset(a, 0, sizeof(struct arena));
+    a->chunk_size = ARENA_FIRST_CHUNK;
+}
+
+void *
+arena_alloc(struct arena * a, size_t size, size_t align)
+{
+    size_t pad = -(uintptr_t)a->next & (align - 1);
+    if (a->chunks == NULL || size + pad > a->left) {
+        size_t capacity = a->chunk_size > size ? a->chunk_size : size;
+        struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk) + capacity);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->next = a->chunks;
+        a->chunks = chunk;
+        a->next = (char *)chunk->data;
+        a->left = capacity;
+        pad = 0;
+        if (a->chunk_size < ARENA_MAX_CHUNK) {
+            a->chunk_size *= 2;
+        }
+    }
+
+    void *p = a->next + pad;
+    a->next += pad + size;
+    a->left -= pad + size;
+    a->used += size;
+    return p;
+}
+
+void
+arena_free(struct arena * a)
+{
+    struct arena_chunk *chunk = a->chunks;
+    while (chunk != NULL) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(a);
+}
+
+static uint32_t
+hash_string(const char * s)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (const unsigned char *u = (const unsigned char *)s; *u; u++) {
+        h = (h ^ *u) * 16777619u;
+    }
+    return h;
+}
+
+void
+string_pool_init(struct string_pool * p, struct arena * arena)
+{
+    memset(p, 0, sizeof(struct string_pool));
+    p->arena = arena;
+}
+
+/**
+ * Double the size of the table, or give it its first 64 slots.
+ */
+static bool
+grow(struct string_pool * p)
+{
+    size_t capacity = p->capacity ? 2 * p->capacity : 64;
+    const char **slots = calloc(capacity, sizeof(char *));
+    uint32_t *hashes = malloc(capacity * sizeof(uint32_t));
+    if (!slots || !hashes) {
+        free(slots);
+        free(hashes);
+        return false;
+    }
+    for (size_t i = 0; i < p->capacity; i++) {
+        if (p->slots[i] != NULL) {
+            size_t j = p->hashes[i] & (capacity - 1);
+            while (slots[j] != NULL) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = p->slots[i];
+            hashes[j] = p->hashes[i];
+        }
+    }
+    free(p->slots);
+    free(p->hashes);
+    p->slots = slots;
+    p->hashes = hashes;
+    p->capacity = capacity;
+    return true;
+}
+
+const char *
+string_pool_intern(struct string_pool * p, const char * s)
+{
+    // keep the table at most half full so that probe sequences stay short
+    if (2 * (p->count + 1) > p->capacity && !grow(p)) {
+        return NULL;
+    }
+
+    uint32_t h = hash_string(s);
+    size_t i = h & (p->capacity - 1);
+    while (p->slots[i] != NULL) {
+        if (p->hashes[i] == h && strcmp(p->slots[i], s) == 0) {
+            return p->slots[i];
+        }
+        i = (i + 1) & (p->capacity - 1);
+    }
+
+    size_t length = strlen(s) + 1;
+    char *copy = arena_alloc(p->arena, length, 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, s, length);
+    p->slots[i] = copy;
+    p->hashes[i] = h;
+    p->count++;
+    p->bytes += length;
+    return copy;
+}
+
+void
+string_pool_free(struct string_pool * p)
+{
+    free(p->slots);
+    free(p->hashes);
+    p->slots = NULL;
+    p->hashes = NULL;
+    p->capacity = 0;
+    p->count = 0;
+    p->bytes = 0;
+}
@@ -0,0 +1,79 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * A bump allocator. Memory is handed out from large chunks in order and is
+ * never freed piece by piece; arena_free releases everything at once, in
+ * one call per chunk. Each chunk is twice the size of the one before, up to
+ * ARENA_MAX_CHUNK, so a map takes a handful of allocations to load.
+ */
+#define ARENA_FIRST_CHUNK (64 * 1024)
+#define ARENA_MAX_CHUNK (16 * 1024 * 1024)
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunks;     // the most recent chunk first
+    char *next;                     // free space in the most recent chunk
+    size_t left;
+    size_t chunk_size;              // size of the next chunk to allocate
+    size_t used;                    // bytes handed out so far
+};
+
+/**
+ * A set of strings stored once each in an arena, so that equal strings
+ * share one copy and can be compared by pointer.
+ */
+struct string_pool {
+    struct arena *arena;
+    const char **slots;     // open addressing table, NULL for empty slots
+    uint32_t *hashes;       // hash of the string in each slot
+    size_t capacity;        // a power of two
+    size_t count;
+    size_t bytes;           // total size of the distinct strings
+};
+
+/**
+ * Initialize an empty arena.
+ */
+void arena_init(struct arena * a);
+
+/**
+ * Allocate memory from an arena. It remains valid until arena_free.
+ *
+ * @param a The arena.
+ * @param size The number of bytes.
+ * @param align The alignment, a power of two no larger than that of
+ *              long double, e.g. sizeof(int) for an array of ints.
+ * @return The memory, or NULL if allocation fails.
+ */
+void * arena_alloc(struct arena * a, size_t size, size_t align);
+
+/**
+ * Release all the memory of an arena and leave it empty.
+ */
+void arena_free(struct arena * a);
+
+/**
+ * Initialize an empty pool that keeps its strings in an arena.
+ */
+void string_pool_init(struct string_pool * p, struct arena * arena);
+
+/**
+ * Look up a string, adding a copy of it to the pool if it is not there yet.
+ *
+ * @return The pooled copy, or NULL if memory allocation fails.
+ */
+const char * string_pool_intern(struct string_pool * p, const char * s);
+
+/**
+ * Release the lookup table of a pool. The strings themselves belong to the
+ * arena and remain valid until it is freed.
+ */
+void string_pool_free(struct string_pool * p);
+
+#endif /* _ARENA_H_ */
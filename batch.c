@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "streets.h"
+#include "parallel.h"
+#include "batch.h"
+
+/**
+ * Queries are run in chunks of this many, so that only one chunk of results
+ * is held in memory while waiting to be written out in order.
+ */
+#define BATCH_CHUNK 16384
+
+bool
+batch_load(struct batch * b, const char * filename)
+{
+    FILE * f = fopen(filename, "r");
+    char line[256];
+    int capacity = 0;
+
+    b->count = 0;
+    b->start_ids = NULL;
+    b->end_ids = NULL;
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open %s\n", filename);
+        return false;
+    }
+
+    for (int lineno = 1; fgets(line, sizeof(line), f) != NULL; lineno++) {
+        int start_id, end_id;
+        char extra;
+        char * p = line + strspn(line, " \t\r\n");
+
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        if (sscanf(p, "%d %d %c", &start_id, &end_id, &extra) != 2) {
+            fprintf(stderr, "error: %s:%d: expected a start and an end node id\n",
+                    filename, lineno);
+            goto fail;
+        }
+
+        if (b->count == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            int *starts = realloc(b->start_ids, capacity * sizeof(int));
+            if (starts) {
+                b->start_ids = starts;
+            }
+            int *ends = realloc(b->end_ids, capacity * sizeof(int));
+            if (ends) {
+                b->end_ids = ends;
+            }
+            if (!starts || !ends) {
+                fprintf(stderr, "error: out of memory reading %s\n", filename);
+                goto fail;
+            }
+        }
+        b->start_ids[b->count] = start_id;
+        b->end_ids[b->count] = end_id;
+        b->count++;
+    }
+
+    fclose(f);
+    return true;
+fail:
+    fclose(f);
+    batch_free(b);
+    return false;
+}
+
+void
+batch_free(struct batch * b)
+{
+    free(b->start_ids);
+    free(b->end_ids);
+    b->start_ids = NULL;
+    b->end_ids = NULL;
+    b->count = 0;
+}
+
+/**
+ * The work of the pool for the current chunk of queries, one query per
+ * iteration.
+ */
+struct chunk {
+    const struct ssmap *map;
+    const struct batch *batch;
+    enum ssmap_algorithm algorithm;
+    int first;          // index of the first query of the chunk
+    char **results;     // formatted output of each query
+};
+
+/**
+ * Format a result in the same way as ssmap_path_create prints it.
+ */
+static char *
+format_result(int start_id, int end_id, int cc, const int path[])
+{
+    if (cc <= 0) {
+        char *result = malloc(64);
+        if (result) {
+            snprintf(result, 64, "No path found from %d to %d.\n", start_id, end_id);
+        }
+        return result;
+    }
+
+    // an int takes at most 11 characters, plus the separating space
+    char *result = malloc((size_t)cc * 12 + 2);
+    if (result) {
+        char *p = result;
+        for (int i = 0; i < cc; i++) {
+            p += sprintf(p, "%d ", path[i]);
+        }
+        strcpy(p, "\n");
+    }
+    return result;
+}
+
+/**
+ * Run one query, with a path buffer of a node count of ints as scratch.
+ */
+static bool
+run_query(void * arg, void * scratch, int i)
+{
+    struct chunk *c = arg;
+    int *path = scratch;
+    int start_id = c->batch->start_ids[c->first + i];
+    int end_id = c->batch->end_ids[c->first + i];
+    int cc = ssmap_path_find(c->map, start_id, end_id, c->algorithm, path, NULL);
+    c->results[i] = cc < 0 ? NULL : format_result(start_id, end_id, cc, path);
+    return c->results[i] != NULL;
+}
+
+double
+batch_run(const struct ssmap * m, const struct batch * b,
+          enum ssmap_algorithm algorithm, int nr_threads, FILE * out)
+{
+    struct timespec begin, end;
+    struct chunk c = {
+        .map = m,
+        .batch = b,
+        .algorithm = algorithm,
+        .results = calloc(BATCH_CHUNK, sizeof(char *)),
+    };
+    size_t path_size = ssmap_nr_nodes(m) * sizeof(int);
+    struct parallel *pool = c.results != NULL ? parallel_start(nr_threads, run_query, &c, path_size) : NULL;
+    bool ok = pool != NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int first = 0; ok && first < b->count; first += BATCH_CHUNK) {
+        int count = b->count - first < BATCH_CHUNK ? b->count - first : BATCH_CHUNK;
+        c.first = first;
+        ok = parallel_for(pool, count);
+
+        for (int i = 0; i < count; i++) {
+            if (ok && out != NULL) {
+                fputs(c.results[i], out);
+            }
+            free(c.results[i]);
+            c.results[i] = NULL;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    parallel_stop(pool);
+    free(c.results);
+    if (!ok) {
+        return -1.0;
+    }
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
@@ -0,0 +1,50 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "streets.h"
+
+/**
+ * A list of path queries read from a file.
+ */
+struct batch {
+    int count;
+    int *start_ids;
+    int *end_ids;
+};
+
+/**
+ * Read a batch file. Each line holds a start node id and an end node id
+ * separated by whitespace; blank lines and lines starting with '#' are
+ * skipped.
+ *
+ * @param b The batch to fill in.
+ * @param filename The file to read.
+ * @return true on success, false if the file cannot be read or a line is
+ * malformed, after printing an error message.
+ */
+bool batch_load(struct batch * b, const char * filename);
+
+/**
+ * Release the memory held by a batch.
+ */
+void batch_free(struct batch * b);
+
+/**
+ * Run every query of a batch on a pool of threads sharing the same map.
+ * Each result is written to out in the format of path create, in the order
+ * the queries appear in the batch, regardless of which thread finishes first.
+ *
+ * @param m The map, which is only read.
+ * @param b The queries to run.
+ * @param algorithm The search algorithm to use. It must be available.
+ * @param nr_threads The number of worker threads.
+ * @param out Where to write the results, or NULL to discard them.
+ * @return The wall time taken in seconds, or a negative value if memory
+ * allocation fails.
+ */
+double batch_run(const struct ssmap * m, const struct batch * b,
+                 enum ssmap_algorithm algorithm, int nr_threads, FILE * out);
+
+#endif /* _BATCH_H_ */
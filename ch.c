@@ -0,0 +1,446 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "ch.h"
+#include "heap.h"
+
+/**
+ * Witness searches give up after settling this many nodes. A search that
+ * gives up adds a shortcut that might not be needed, which costs a little
+ * query time but never breaks correctness.
+ */
+#define WITNESS_SETTLE_LIMIT 500
+
+/**
+ * An edge of the graph being contracted, either a road segment or a
+ * shortcut that skips over the node middle.
+ */
+struct ch_edge {
+    int from;
+    int to;
+    int middle;
+    double cost;
+};
+
+/**
+ * A growable list of edge indices.
+ */
+struct edge_list {
+    int size;
+    int capacity;
+    int *edges;
+};
+
+/**
+ * Everything needed while contracting, freed once the hierarchy is built.
+ */
+struct builder {
+    int nr_nodes;
+    int nr_edges;
+    int edge_capacity;
+    struct ch_edge *edges;
+    struct edge_list *out;      // edges leaving each node
+    struct edge_list *in;       // edges entering each node
+    bool *contracted;
+    int *deleted_neighbors;     // number of neighbours already contracted
+
+    // state of the witness search, reset through the touched list
+    struct heap heap;
+    double *dist;
+    int *touched;
+    int nr_touched;
+};
+
+static bool
+list_append(struct edge_list * l, int edge)
+{
+    if (l->size == l->capacity) {
+        int capacity = l->capacity ? 2 * l->capacity : 4;
+        int *edges = realloc(l->edges, capacity * sizeof(int));
+        if (!edges) {
+            return false;
+        }
+        l->edges = edges;
+        l->capacity = capacity;
+    }
+    l->edges[l->size++] = edge;
+    return true;
+}
+
+/**
+ * Add the edge from -> to, or lower the cost of the existing one. There is
+ * never more than one edge between the same ordered pair of nodes, which
+ * lets ch_unpack identify an edge by its endpoints.
+ *
+ * @return 1 if an edge was added, 0 if one was updated or left alone and -1
+ * if memory allocation fails.
+ */
+static int
+add_edge(struct builder * b, int from, int to, double cost, int middle)
+{
+    struct edge_list *out = &b->out[from];
+    for (int i = 0; i < out->size; i++) {
+        struct ch_edge *e = &b->edges[out->edges[i]];
+        if (e->to == to) {
+            if (cost < e->cost) {
+                e->cost = cost;
+                e->middle = middle;
+            }
+            return 0;
+        }
+    }
+
+    if (b->nr_edges == b->edge_capacity) {
+        int capacity = 2 * b->edge_capacity;
+        struct ch_edge *edges = realloc(b->edges, capacity * sizeof(struct ch_edge));
+        if (!edges) {
+            return -1;
+        }
+        b->edges = edges;
+        b->edge_capacity = capacity;
+    }
+
+    int id = b->nr_edges;
+    if (!list_append(&b->out[from], id) || !list_append(&b->in[to], id)) {
+        return -1;
+    }
+    b->edges[id] = (struct ch_edge){from, to, middle, cost};
+    b->nr_edges++;
+    return 1;
+}
+
+static void
+builder_free(struct builder * b)
+{
+    if (b->out) {
+        for (int i = 0; i < b->nr_nodes; i++) {
+            free(b->out[i].edges);
+        }
+    }
+    if (b->in) {
+        for (int i = 0; i < b->nr_nodes; i++) {
+            free(b->in[i].edges);
+        }
+    }
+    free(b->out);
+    free(b->in);
+    free(b->edges);
+    free(b->contracted);
+    free(b->deleted_neighbors);
+    free(b->dist);
+    free(b->touched);
+    heap_free(&b->heap);
+}
+
+static bool
+builder_init(struct builder * b, const struct graph * g)
+{
+    int V = g->nr_nodes;
+    memset(b, 0, sizeof(struct builder));
+    b->nr_nodes = V;
+    b->edge_capacity = g->nr_edges + 16;
+    b->edges = malloc(b->edge_capacity * sizeof(struct ch_edge));
+    b->out = calloc(V, sizeof(struct edge_list));
+    b->in = calloc(V, sizeof(struct edge_list));
+    b->contracted = calloc(V, sizeof(bool));
+    b->deleted_neighbors = calloc(V, sizeof(int));
+    b->dist = malloc(V * sizeof(double));
+    b->touched = malloc(V * sizeof(int));
+    bool heap_ok = heap_init(&b->heap, V);
+
+    if (!b->edges || !b->out || !b->in || !b->contracted || !b->deleted_neighbors ||
+        !b->dist || !b->touched || !heap_ok) {
+        builder_free(b);
+        return false;
+    }
+
+    for (int i = 0; i < V; i++) {
+        b->dist[i] = -1.0;
+    }
+    for (int u = 0; u < V; u++) {
+        for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+            if (g->target[e] != u && add_edge(b, u, g->target[e], g->cost[e], -1) < 0) {
+                builder_free(b);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Dijkstra search from source over the nodes that are not contracted yet,
+ * never passing through the node being contracted. It stops once every
+ * remaining node is further than max_cost or the settle limit is reached.
+ * Afterwards b->dist holds an upper bound on the distance of every reached
+ * node and -1 for the others.
+ */
+static void
+witness_search(struct builder * b, int source, int excluded, double max_cost)
+{
+    for (int i = 0; i < b->nr_touched; i++) {
+        b->dist[b->touched[i]] = -1.0;
+    }
+    b->nr_touched = 0;
+    heap_clear(&b->heap);
+
+    b->dist[source] = 0.0;
+    b->touched[b->nr_touched++] = source;
+    heap_push(&b->heap, source, 0.0);
+
+    for (int settled = 0; b->heap.size > 0 && settled < WITNESS_SETTLE_LIMIT; settled++) {
+        struct heap_item item = heap_pop(&b->heap);
+        if (item.key > max_cost) {
+            break;
+        }
+        const struct edge_list *out = &b->out[item.id];
+        for (int i = 0; i < out->size; i++) {
+            const struct ch_edge *e = &b->edges[out->edges[i]];
+            int v = e->to;
+            if (v == excluded || b->contracted[v]) {
+                continue;
+            }
+            double d = item.key + e->cost;
+            if (b->dist[v] < 0) {
+                b->dist[v] = d;
+                b->touched[b->nr_touched++] = v;
+                heap_push(&b->heap, v, d);
+            } else if (d < b->dist[v] && heap_contains(&b->heap, v)) {
+                b->dist[v] = d;
+                heap_decrease_key(&b->heap, v, d);
+            }
+        }
+    }
+}
+
+/**
+ * Work out which shortcuts contracting v requires, adding them to the graph
+ * if apply is set.
+ *
+ * @return The number of shortcuts required, or -1 if memory allocation fails.
+ */
+static int
+contract(struct builder * b, int v, bool apply)
+{
+    int shortcuts = 0;
+    const struct edge_list *in = &b->in[v];
+    const struct edge_list *out = &b->out[v];
+
+    for (int i = 0; i < in->size; i++) {
+        const struct ch_edge *e1 = &b->edges[in->edges[i]];
+        int u = e1->from;
+        if (b->contracted[u]) {
+            continue;
+        }
+
+        double max_cost = -1.0;
+        for (int j = 0; j < out->size; j++) {
+            const struct ch_edge *e2 = &b->edges[out->edges[j]];
+            if (!b->contracted[e2->to] && e2->to != u && e1->cost + e2->cost > max_cost) {
+                max_cost = e1->cost + e2->cost;
+            }
+        }
+        if (max_cost < 0) {
+            continue;
+        }
+
+        witness_search(b, u, v, max_cost);
+
+        for (int j = 0; j < out->size; j++) {
+            // add_edge may move the edge array, so look the edges up again
+            const struct ch_edge e2 = b->edges[out->edges[j]];
+            double via = b->edges[in->edges[i]].cost + e2.cost;
+            int w = e2.to;
+            if (b->contracted[w] || w == u) {
+                continue;
+            }
+            if (b->dist[w] >= 0 && b->dist[w] <= via) {
+                continue;   // a path avoiding v is at least as fast
+            }
+            shortcuts++;
+            if (apply && add_edge(b, u, w, via, v) < 0) {
+                return -1;
+            }
+        }
+    }
+    return shortcuts;
+}
+
+/**
+ * The order in which nodes are contracted: those whose removal adds the
+ * fewest shortcuts relative to the edges it removes go first, and nodes whose
+ * neighbours have already been contracted are held back so the contraction
+ * spreads evenly over the map.
+ *
+ * @return The priority of v, lower is contracted earlier.
+ */
+static int
+priority(struct builder * b, int v)
+{
+    // simulating a contraction never allocates, so this cannot fail
+    int shortcuts = contract(b, v, false);
+    int removed = 0;
+    for (int i = 0; i < b->in[v].size; i++) {
+        removed += !b->contracted[b->edges[b->in[v].edges[i]].from];
+    }
+    for (int i = 0; i < b->out[v].size; i++) {
+        removed += !b->contracted[b->edges[b->out[v].edges[i]].to];
+    }
+    return (shortcuts - removed) + b->deleted_neighbors[v];
+}
+
+/**
+ * Split the contracted edges into the upward and downward graphs.
+ */
+static bool
+build_search_graphs(struct contraction_hierarchy * ch, const struct builder * b)
+{
+    int E = b->nr_edges;
+    int *from = malloc((E + 1) * sizeof(int));
+    int *to = malloc((E + 1) * sizeof(int));
+    int *middle = malloc((E + 1) * sizeof(int));
+    double *cost = malloc((E + 1) * sizeof(double));
+    bool ok = false;
+
+    if (!from || !to || !middle || !cost) {
+        goto done;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        int n = 0;
+        for (int i = 0; i < E; i++) {
+            const struct ch_edge *e = &b->edges[i];
+            bool up = ch->rank[e->from] < ch->rank[e->to];
+            if (pass == 0 && up) {
+                from[n] = e->from; to[n] = e->to;
+            } else if (pass == 1 && !up) {
+                from[n] = e->to; to[n] = e->from;
+            } else {
+                continue;
+            }
+            middle[n] = e->middle;
+            cost[n] = e->cost;
+            n++;
+        }
+        struct graph *g = pass == 0 ? &ch->upward : &ch->downward;
+        if (!graph_build(g, b->nr_nodes, n, from, to, middle, cost)) {
+            goto done;
+        }
+    }
+    ok = true;
+done:
+    free(from);
+    free(to);
+    free(middle);
+    free(cost);
+    return ok;
+}
+
+bool
+ch_build(struct contraction_hierarchy * ch, const struct graph * g)
+{
+    struct builder b;
+    int V = g->nr_nodes;
+
+    memset(ch, 0, sizeof(struct contraction_hierarchy));
+    ch->nr_nodes = V;
+    ch->rank = malloc((V + 1) * sizeof(int));
+    if (!ch->rank || !builder_init(&b, g)) {
+        free(ch->rank);
+        ch->rank = NULL;
+        return false;
+    }
+
+    struct heap queue;
+    if (!heap_init(&queue, V)) {
+        goto fail;
+    }
+    for (int v = 0; v < V; v++) {
+        heap_push(&queue, v, priority(&b, v));
+    }
+
+    int next_rank = 0;
+    while (queue.size > 0) {
+        int v = heap_pop(&queue).id;
+
+        // priorities go stale as neighbours are contracted; recompute lazily
+        // and put the node back if it is no longer the best candidate
+        int p = priority(&b, v);
+        if (queue.size > 0 && p > heap_min_key(&queue)) {
+            heap_push(&queue, v, p);
+            continue;
+        }
+
+        int before = b.nr_edges;
+        if (contract(&b, v, true) < 0) {
+            goto fail_queue;
+        }
+        ch->nr_shortcuts += b.nr_edges - before;
+        b.contracted[v] = true;
+        ch->rank[v] = next_rank++;
+
+        for (int i = 0; i < b.in[v].size; i++) {
+            b.deleted_neighbors[b.edges[b.in[v].edges[i]].from]++;
+        }
+        for (int i = 0; i < b.out[v].size; i++) {
+            b.deleted_neighbors[b.edges[b.out[v].edges[i]].to]++;
+        }
+    }
+
+    if (!build_search_graphs(ch, &b)) {
+        goto fail_queue;
+    }
+    heap_free(&queue);
+    builder_free(&b);
+    return true;
+
+fail_queue:
+    heap_free(&queue);
+fail:
+    builder_free(&b);
+    ch_free(ch);
+    return false;
+}
+
+void
+ch_free(struct contraction_hierarchy * ch)
+{
+    free(ch->rank);
+    ch->rank = NULL;
+    graph_free(&ch->upward);
+    graph_free(&ch->downward);
+    ch->nr_nodes = 0;
+    ch->nr_shortcuts = 0;
+}
+
+bool
+ch_unpack(const struct contraction_hierarchy * ch, int from, int to,
+          int path[], int * cc, int capacity)
+{
+    // find the unique edge from -> to in whichever graph holds it
+    const struct graph *g;
+    int tail, head;
+    if (ch->rank[from] < ch->rank[to]) {
+        g = &ch->upward; tail = from; head = to;
+    } else {
+        g = &ch->downward; tail = to; head = from;
+    }
+
+    int middle = -1;
+    for (int e = g->first[tail]; e < g->first[tail + 1]; e++) {
+        if (g->target[e] == head) {
+            middle = g->way[e];
+            break;
+        }
+    }
+
+    if (middle == -1) {
+        if (*cc >= capacity) {
+            return false;
+        }
+        path[(*cc)++] = to;
+        return true;
+    }
+    return ch_unpack(ch, from, middle, path, cc, capacity) &&
+           ch_unpack(ch, middle, to, path, cc, capacity);
+}
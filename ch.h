@@ -0,0 +1,57 @@
+#ifndef _CH_H_
+#define _CH_H_
+
+#include <stdbool.h>
+#include "graph.h"
+
+/**
+ * A contraction hierarchy over a road graph. Every node is given a rank by
+ * contracting the nodes one at a time, least important first, and adding a
+ * shortcut edge wherever removing a node would lengthen a shortest path.
+ * A query then only needs to follow edges that lead to higher ranked nodes,
+ * from the start node in the upward graph and from the destination node in
+ * the downward graph, which explores a tiny part of the map.
+ *
+ * In both graphs the way field of an edge holds the node that a shortcut
+ * skips over, or -1 if the edge is an original road segment.
+ */
+struct contraction_hierarchy {
+    int nr_nodes;
+    int nr_shortcuts;
+    int *rank;              // contraction order of each node
+    struct graph upward;    // edges u -> v with rank[u] < rank[v]
+    struct graph downward;  // edges u -> v with rank[u] > rank[v], stored at v
+};
+
+/**
+ * Contract a graph into a hierarchy.
+ *
+ * @param ch The hierarchy to fill in.
+ * @param g The graph to contract. It is not modified.
+ * @return true on success, false if memory allocation fails.
+ */
+bool ch_build(struct contraction_hierarchy * ch, const struct graph * g);
+
+/**
+ * Release the memory held by a hierarchy. It is safe to call this on a
+ * zero-initialized hierarchy that was never built.
+ */
+void ch_free(struct contraction_hierarchy * ch);
+
+/**
+ * Expand the hierarchy edge from -> to into the road segments it stands for
+ * and append the nodes after from, up to and including to, to path.
+ *
+ * @param ch The hierarchy.
+ * @param from The tail of the edge.
+ * @param to The head of the edge. There must be an edge from -> to in the
+ *           upward graph if from ranks lower, in the downward graph otherwise.
+ * @param path The path to append to.
+ * @param cc The number of nodes in path, updated as nodes are appended.
+ * @param capacity The size of the path array.
+ * @return false if the path does not fit in capacity, true otherwise.
+ */
+bool ch_unpack(const struct contraction_hierarchy * ch, int from, int to,
+               int path[], int * cc, int capacity);
+
+#endif /* _CH_H_ */
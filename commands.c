@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "commands.h"
+#include "streets.h"
+#include "matrix.h"
+
+static void
+remove_newline(char * string)
+{
+    char * newline = strchr(string, '\n');
+    if (newline) {
+        *newline = '\0';
+    }
+}
+
+static bool
+get_integer_argument(char * line, int * iptr, FILE * out)
+{
+    remove_newline(line);
+
+    if (sscanf(line, "%d", iptr) == 1) {
+        return true;
+    }
+
+    fprintf(out, "error: '%s' is not an integer.\n", line);
+    return false;
+}
+
+static void
+handle_find(char * line, struct ssmap * map, FILE * out)
+{
+    char * command = strtok_r(line, " \t\r\n\v\f", &line);
+    char * first = strtok_r(line, " \t\r\n\v\f", &line);
+    char * second = strtok_r(line, " \t\r\n\v\f", &line);
+    char * third = strtok_r(line, " \t\r\n\v\f", &line);
+
+    if (command == NULL) {
+        /* fall through */
+    }
+    else if (strcmp(command, "node") == 0) {
+        if (first == NULL || third != NULL) {
+            fprintf(out, "error: invalid number of arguments.\n");
+        }
+        else {
+            ssmap_find_node_by_names(map, first, second, out);
+            return;
+        }
+    }
+    else if (strcmp(command, "way") == 0) {
+        if (first == NULL || second != NULL) {
+            fprintf(out, "error: invalid number of arguments.\n");
+        }
+        else {
+            ssmap_find_way_by_name(map, first, out);
+            return;
+        }    
+    }
+    else {
+        fprintf(out, "error: first argument must be either node or way.\n");
+    }
+
+    fprintf(out, "usage: find way keyword | find node keyword [keyword]\n");
+}
+
+static bool
+handle_path_travel_time(char * line, struct ssmap * map, FILE * out)
+{
+    int capacity = 1;
+    int n = 0;
+
+    // use number of space characters to determine approximate array size
+    for (int i = 0; line[i] != '\0'; i++) {
+        if (isspace((int)line[i])) {
+            capacity++;
+        }
+    }
+
+    // on the heap, since the line may be as long as COMMAND_MAX_LINE
+    int * node_ids = malloc(capacity * sizeof(int));
+    if (node_ids == NULL) {
+        fprintf(out, "error: out of memory.\n");
+        return false;
+    }
+    bool ok = false;
+    while(true) {
+        char * token = strtok_r(line, " \t\r\n\v\f", &line);
+        char * endptr;
+
+        if (token == NULL)
+            break;
+
+        node_ids[n++] = strtol(token, &endptr, 10);
+        if (endptr && *endptr != '\0') {
+            fprintf(out, "error: %s is not an integer.\n", token);
+            goto done;
+        }
+    }
+
+    if (n < 2) {
+        fprintf(out, "error: must specify at least two nodes.\n");
+        goto done;
+    }
+
+    double result = ssmap_path_travel_time(map, n, node_ids, out);
+    if (result >= 0.) {
+        fprintf(out, "%.4f minutes\n", result);
+    }
+    ok = true;
+done:
+    free(node_ids);
+    return ok;
+}
+
+/**
+ * Parse a latitude and longitude separated by a comma, e.g. 43.66,-79.39.
+ */
+static bool
+parse_location(const char * arg, double * lat, double * lon)
+{
+    char * endptr;
+
+    *lat = strtod(arg, &endptr);
+    if (endptr == arg || *endptr != ',') {
+        return false;
+    }
+    arg = endptr + 1;
+    *lon = strtod(arg, &endptr);
+    if (endptr == arg || *endptr != '\0') {
+        return false;
+    }
+    return *lat >= -90 && *lat <= 90 && *lon >= -180 && *lon <= 180;
+}
+
+/**
+ * Parse a node given either by its id or by a location of the form lat,lon,
+ * which stands for the node closest to it.
+ */
+static bool
+parse_node(const char * arg, struct ssmap * map, int * id, FILE * out)
+{
+    char * endptr;
+
+    if (strchr(arg, ',') != NULL) {
+        double lat, lon, km;
+        if (!parse_location(arg, &lat, &lon)) {
+            fprintf(out, "error: %s is not a valid location.\n", arg);
+            return false;
+        }
+        return ssmap_nearest_nodes(map, lat, lon, 1, id, &km) == 1;
+    }
+
+    *id = strtol(arg, &endptr, 10);
+    if (endptr && *endptr != '\0') {
+        fprintf(out, "error: %s is not an integer.\n", arg);
+        return false;
+    }
+    return true;
+}
+
+static bool
+parse_node_pair(char ** line, struct ssmap * map, int * start_id, int * end_id, FILE * out)
+{
+    char * start = strtok_r(*line, " \t\r\n\v\f", line);
+    char * finish = strtok_r(*line, " \t\r\n\v\f", line);
+
+    if (start == NULL || finish == NULL) {
+        fprintf(out, "error: must specify start node and finish node.\n");
+        return false;
+    }
+
+    return parse_node(start, map, start_id, out) && parse_node(finish, map, end_id, out);
+}
+
+static bool
+handle_path_create(char * line, struct ssmap * map, FILE * out)
+{
+    int start_id, end_id;
+    enum ssmap_algorithm algorithm = SSMAP_DIJKSTRA;
+
+    if (!parse_node_pair(&line, map, &start_id, &end_id, out)) {
+        return false;
+    }
+
+    char * method = strtok_r(line, " \t\r\n\v\f", &line);
+    if (method != NULL && !ssmap_algorithm_by_name(method, &algorithm)) {
+        fprintf(out, "error: unknown search method %s.\n", method);
+        return false;
+    }
+
+    ssmap_path_create_with(map, start_id, end_id, algorithm, out);
+    return true;
+}
+
+static bool
+handle_path_compare(char * line, struct ssmap * map, FILE * out)
+{
+    int start_id, end_id;
+
+    if (!parse_node_pair(&line, map, &start_id, &end_id, out)) {
+        return false;
+    }
+
+    ssmap_path_compare(map, start_id, end_id, out);
+    return true;
+}
+
+static void
+handle_path(char * line, struct ssmap * map, FILE * out)
+{
+    char * command = strtok_r(line, " \t\r\n\v\f", &line);
+
+    if (command == NULL) {
+        /* fall through */
+    }
+    else if (strcmp(command, "time") == 0) {
+        if (handle_path_travel_time(line, map, out))
+            return;
+    }
+    else if (strcmp(command, "create") == 0) {
+        if (handle_path_create(line, map, out))
+            return;
+    }
+    else if (strcmp(command, "compare") == 0) {
+        if (handle_path_compare(line, map, out))
+            return;
+    }
+    else {
+        fprintf(out, "error: first argument must be either time, create or compare.\n");
+    }
+
+    fprintf(out, "usage: path create start finish [dijkstra|bidir|astar|ch|alt] | path time node1 node2 [nodes...]\n"
+            "       path compare start finish\n"
+            "       start and finish may be node ids or locations given as lat,lon\n");
+}
+
+static void
+handle_isochrone(char * line, struct ssmap * map, FILE * out)
+{
+    char * node = strtok_r(line, " \t\r\n\v\f", &line);
+    char * budget = strtok_r(line, " \t\r\n\v\f", &line);
+    char * option = strtok_r(line, " \t\r\n\v\f", &line);
+    char * endptr;
+
+    if (node == NULL || budget == NULL || strtok_r(line, " \t\r\n\v\f", &line) != NULL) {
+        fprintf(out, "error: invalid number of arguments.\n");
+        goto usage;
+    }
+
+    int id = strtol(node, &endptr, 10);
+    if (*endptr != '\0') {
+        fprintf(out, "error: %s is not an integer.\n", node);
+        goto usage;
+    }
+    double minutes = strtod(budget, &endptr);
+    if (*endptr != '\0' || !(minutes >= 0)) {
+        fprintf(out, "error: %s is not a valid number of minutes.\n", budget);
+        goto usage;
+    }
+    if (option != NULL && strcmp(option, "edges") != 0) {
+        fprintf(out, "error: unknown option %s.\n", option);
+        goto usage;
+    }
+
+    ssmap_print_isochrone(map, id, minutes, option != NULL, out);
+    return;
+usage:
+    fprintf(out, "usage: isochrone node minutes [edges]\n");
+}
+
+static void
+handle_nearest(char * line, struct ssmap * map, FILE * out)
+{
+    char * lat_arg = strtok_r(line, " \t\r\n\v\f", &line);
+    char * lon_arg = strtok_r(line, " \t\r\n\v\f", &line);
+    char * k_arg = strtok_r(line, " \t\r\n\v\f", &line);
+    char location[128];
+    double lat, lon;
+    int k = 1;
+    char * endptr;
+
+    if (lat_arg == NULL || lon_arg == NULL || strtok_r(line, " \t\r\n\v\f", &line) != NULL) {
+        fprintf(out, "error: invalid number of arguments.\n");
+        goto usage;
+    }
+    snprintf(location, sizeof(location), "%s,%s", lat_arg, lon_arg);
+    if (!parse_location(location, &lat, &lon)) {
+        fprintf(out, "error: %s %s is not a valid location.\n", lat_arg, lon_arg);
+        goto usage;
+    }
+    if (k_arg != NULL) {
+        k = strtol(k_arg, &endptr, 10);
+        if (*endptr != '\0' || k <= 0) {
+            fprintf(out, "error: %s is not a positive integer.\n", k_arg);
+            goto usage;
+        }
+    }
+
+    ssmap_print_nearest(map, lat, lon, k, out);
+    return;
+usage:
+    fprintf(out, "usage: nearest lat lon [k]\n");
+}
+
+/**
+ * Parse a comma separated list of node ids, checking that each one exists.
+ *
+ * @return A heap-allocated array of *count ids, or NULL after printing an
+ * error.
+ */
+static int *
+parse_node_list(const char * list, const struct ssmap * map, int * count, FILE * out)
+{
+    int capacity = 1;
+    for (const char * p = list; *p != '\0'; p++) {
+        if (*p == ',') {
+            capacity++;
+        }
+    }
+
+    int * ids = malloc(capacity * sizeof(int));
+    if (ids == NULL) {
+        fprintf(out, "error: out of memory.\n");
+        return NULL;
+    }
+
+    *count = 0;
+    const char * p = list;
+    while (true) {
+        char * endptr;
+        long id = strtol(p, &endptr, 10);
+        if (endptr == p || (*endptr != ',' && *endptr != '\0')) {
+            fprintf(out, "error: %s is not a comma separated list of node ids.\n", list);
+            free(ids);
+            return NULL;
+        }
+        if (id < 0 || id >= ssmap_nr_nodes(map)) {
+            fprintf(out, "error: node %ld does not exist.\n", id);
+            free(ids);
+            return NULL;
+        }
+        ids[(*count)++] = id;
+        if (*endptr == '\0') {
+            break;
+        }
+        p = endptr + 1;
+    }
+    return ids;
+}
+
+static void
+handle_matrix(char * line, struct ssmap * map, bool remote, FILE * out)
+{
+    char * sources = strtok_r(line, " \t\r\n\v\f", &line);
+    char * targets = strtok_r(line, " \t\r\n\v\f", &line);
+    char * output = strtok_r(line, " \t\r\n\v\f", &line);
+    int nr_sources, nr_targets;
+    int * source_ids = NULL;
+    int * target_ids = NULL;
+
+    if (sources == NULL || targets == NULL || strtok_r(line, " \t\r\n\v\f", &line) != NULL) {
+        fprintf(out, "error: invalid number of arguments.\n");
+        goto usage;
+    }
+    if ((source_ids = parse_node_list(sources, map, &nr_sources, out)) == NULL ||
+        (target_ids = parse_node_list(targets, map, &nr_targets, out)) == NULL) {
+        goto usage;
+    }
+    if (remote && output != NULL) {
+        fprintf(out, "error: the server does not write files.\n");
+        goto usage;
+    }
+    if (remote && (long long)nr_sources * nr_targets > REMOTE_MATRIX_LIMIT) {
+        fprintf(out, "error: the server computes at most %d travel times per matrix.\n",
+                REMOTE_MATRIX_LIMIT);
+        goto done;
+    }
+
+    FILE * table = out;
+    if (output != NULL && (table = fopen(output, "w")) == NULL) {
+        fprintf(out, "error: could not open %s\n", output);
+        goto done;
+    }
+    // a server connection already has a worker thread of its own
+    if (!matrix_write(map, nr_sources, source_ids, nr_targets, target_ids,
+                      remote ? 1 : sysconf(_SC_NPROCESSORS_ONLN), table)) {
+        fprintf(out, "error: out of memory.\n");
+    }
+    if (table != out) {
+        fclose(table);
+        fprintf(out, "%d x %d travel times written to %s\n", nr_sources, nr_targets, output);
+    }
+    goto done;
+usage:
+    fprintf(out, "usage: matrix source1,source2,... target1,target2,... [output.csv]\n");
+done:
+    free(source_ids);
+    free(target_ids);
+}
+
+static void
+print_cache_stats(const struct ssmap * map, FILE * out)
+{
+    struct ssmap_cache_stats stats;
+    ssmap_cache_stats(map, &stats);
+    if (stats.capacity == 0) {
+        fprintf(out, "The shortest-path tree cache is off, start with --cache N to enable it.\n");
+        return;
+    }
+    fprintf(out, "%d of %d trees cached, %lu hits, %lu resumed, %lu misses\n", stats.trees,
+            stats.capacity, stats.hits, stats.resumed, stats.misses);
+}
+
+bool
+command_run(struct ssmap * map, char * line, bool remote, FILE * out)
+{
+    char * command = strtok_r(line, " \t\r\n\v\f", &line);
+
+    if (command == NULL) {
+        /* fall through */
+    }
+    else if (strcmp(command, "quit") == 0) {
+        return false;
+    }
+    else if (strcmp(command, "node") == 0) {
+        int id;
+        if (get_integer_argument(line, &id, out)) {
+            ssmap_print_node(map, id, out);
+        }
+    }
+    else if (strcmp(command, "way") == 0) {
+        int id;
+        if (get_integer_argument(line, &id, out)) {
+            ssmap_print_way(map, id, out);
+        }
+    }
+    else if (strcmp(command, "find") == 0) {
+        handle_find(line, map, out);
+    }
+    else if (strcmp(command, "path") == 0) {
+        handle_path(line, map, out);
+    }
+    else if (strcmp(command, "matrix") == 0) {
+        handle_matrix(line, map, remote, out);
+    }
+    else if (strcmp(command, "isochrone") == 0) {
+        handle_isochrone(line, map, out);
+    }
+    else if (strcmp(command, "nearest") == 0) {
+        handle_nearest(line, map, out);
+    }
+    else if (strcmp(command, "cache") == 0) {
+        print_cache_stats(map, out);
+    }
+    else if (strcmp(command, "stats") == 0) {
+        ssmap_print_stats(map, out);
+    }
+    else {
+        fprintf(out, "error: unknown command %s. Available commands are:\n"
+                "\tnode, way, find, path, matrix, isochrone, nearest, cache, stats, quit\n",
+                command);
+    }
+    return true;
+}
+
@@ -0,0 +1,38 @@
+#ifndef _COMMANDS_H_
+#define _COMMANDS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "streets.h"
+
+/**
+ * The longest command line that is accepted, long enough for a path time
+ * of 100000 nodes.
+ */
+#define COMMAND_MAX_LINE (1 << 20)
+
+/**
+ * The most travel times a matrix command from a client of the server may
+ * ask for, sources times targets, which keeps its table well under the
+ * response limit of the server.
+ */
+#define REMOTE_MATRIX_LIMIT 1000000
+
+/**
+ * Run one line of the command language of the REPL, e.g. "path create 1 2"
+ * or "find way Yonge", and print the response to out. A blank line prints
+ * nothing. Commands only read the map, so several threads may run them on
+ * the same map at the same time, each with its own out.
+ *
+ * @param map The map to query.
+ * @param line The command, which is split up in place.
+ * @param remote Whether the command came from a client of the server, which
+ *               may not make the server write files and whose matrix
+ *               commands run on the calling thread only, up to
+ *               REMOTE_MATRIX_LIMIT travel times.
+ * @param out Where to print the response.
+ * @return false if the command was quit, true otherwise.
+ */
+bool command_run(struct ssmap * map, char * line, bool remote, FILE * out);
+
+#endif /* _COMMANDS_H_ */
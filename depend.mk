@@ -1,2 +1,20 @@
-main.o: main.c streets.h
-streets.o: streets.c streets.h
+alt.o: alt.c alt.h graph.h heap.h
+arena.o: arena.c arena.h
+batch.o: batch.c streets.h parallel.h batch.h
+ch.o: ch.c ch.h graph.h heap.h
+commands.o: commands.c commands.h streets.h matrix.h
+geo.o: geo.c geo.h
+graph.o: graph.c graph.h
+heap.o: heap.c heap.h
+loader.o: loader.c streets.h snapshot.h loader.h
+main.o: main.c streets.h loader.h batch.h commands.h server.h
+matrix.o: matrix.c streets.h parallel.h matrix.h
+nameindex.o: nameindex.c nameindex.h
+order.o: order.c order.h graph.h
+parallel.o: parallel.c parallel.h
+server.o: server.c server.h streets.h commands.h
+snapshot.o: snapshot.c snapshot.h
+spatial.o: spatial.c spatial.h geo.h
+stats.o: stats.c stats.h
+streets.o: streets.c streets.h graph.h heap.h ch.h alt.h snapshot.h \
+ nameindex.h spatial.h geo.h order.h arena.h stats.h
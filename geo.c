@@ -0,0 +1,232 @@
+#include <math.h>
+#include <stdbool.h>
+#include "geo.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEO_X86 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Half angles up to SMALL_ANGLE radians (about 570 km) have their sine
+ * computed by the polynomial below, and haversine square roots up to
+ * SMALL_HAVERSINE (about 640 km) their arcsine. Within these ranges the
+ * first omitted term of either series is below 1e-16 of the result.
+ */
+#define SMALL_ANGLE 0.1
+#define SMALL_HAVERSINE 0.05
+
+// Taylor coefficients of sin(x) and asin(x), from x^3 up
+#define SIN3 (-1. / 6.)
+#define SIN5 (1. / 120.)
+#define SIN7 (-1. / 5040.)
+#define SIN9 (1. / 362880.)
+#define SIN11 (-1. / 39916800.)
+#define ASIN3 (1. / 6.)
+#define ASIN5 (3. / 40.)
+#define ASIN7 (5. / 112.)
+#define ASIN9 (35. / 1152.)
+#define ASIN11 (63. / 2816.)
+
+/**
+ * The polynomials are written as macros so that the same expression works
+ * on doubles and, through GCC's vector extensions, on SSE and AVX vectors.
+ */
+#define POLY_SIN(x, x2) \
+    ((x) + (x) * (x2) * (SIN3 + (x2) * (SIN5 + (x2) * (SIN7 + (x2) * (SIN9 + (x2) * SIN11)))))
+#define POLY_ASIN(x, x2) \
+    ((x) + (x) * (x2) * (ASIN3 + (x2) * (ASIN5 + (x2) * (ASIN7 + (x2) * (ASIN9 + (x2) * ASIN11)))))
+
+#define d2r(deg) ((deg) * M_PI / 180.)
+
+double
+geo_distance(double lat1, double lon1, double lat2, double lon2)
+{
+    double dlat = d2r(lat2 - lat1);
+    double dlon = d2r(lon2 - lon1);
+    double a = pow(sin(dlat / 2), 2) + cos(d2r(lat1)) * cos(d2r(lat2)) * pow(sin(dlon / 2), 2);
+    double c = 2 * atan2(sqrt(a), sqrt(1 - a));
+    return EARTH_RADIUS_KM * c;
+}
+
+static inline double
+exact_length(const struct geo_points * p, int a, int b)
+{
+    return geo_distance(p->lat[a], p->lon[a], p->lat[b], p->lon[b]);
+}
+
+static double
+segment_length(const struct geo_points * p, int a, int b)
+{
+    double half_dlat = d2r(p->lat[b] - p->lat[a]) * 0.5;
+    double half_dlon = d2r(p->lon[b] - p->lon[a]) * 0.5;
+    if (fabs(half_dlat) > SMALL_ANGLE || fabs(half_dlon) > SMALL_ANGLE) {
+        return exact_length(p, a, b);
+    }
+
+    double x2 = half_dlat * half_dlat;
+    double s1 = POLY_SIN(half_dlat, x2);
+    x2 = half_dlon * half_dlon;
+    double s2 = POLY_SIN(half_dlon, x2);
+    double h = sqrt(s1 * s1 + p->cos_lat[a] * p->cos_lat[b] * (s2 * s2));
+    if (h > SMALL_HAVERSINE) {
+        return exact_length(p, a, b);
+    }
+    x2 = h * h;
+    return EARTH_RADIUS_KM * (2 * POLY_ASIN(h, x2));
+}
+
+static void
+lengths_scalar(const struct geo_points * p, int n, const int from[], const int to[],
+               double km[])
+{
+    for (int i = 0; i < n; i++) {
+        km[i] = segment_length(p, from[i], to[i]);
+    }
+}
+
+#ifdef GEO_X86
+
+__attribute__((target("sse2")))
+static void
+lengths_sse2(const struct geo_points * p, int n, const int from[], const int to[],
+             double km[])
+{
+    const __m128d sign = _mm_set1_pd(-0.0);
+    int i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        int a0 = from[i], a1 = from[i + 1], b0 = to[i], b1 = to[i + 1];
+        __m128d lat_a = _mm_set_pd(p->lat[a1], p->lat[a0]);
+        __m128d lat_b = _mm_set_pd(p->lat[b1], p->lat[b0]);
+        __m128d lon_a = _mm_set_pd(p->lon[a1], p->lon[a0]);
+        __m128d lon_b = _mm_set_pd(p->lon[b1], p->lon[b0]);
+        __m128d cos_a = _mm_set_pd(p->cos_lat[a1], p->cos_lat[a0]);
+        __m128d cos_b = _mm_set_pd(p->cos_lat[b1], p->cos_lat[b0]);
+
+        __m128d half_dlat = d2r(lat_b - lat_a) * 0.5;
+        __m128d half_dlon = d2r(lon_b - lon_a) * 0.5;
+        __m128d x2 = half_dlat * half_dlat;
+        __m128d s1 = POLY_SIN(half_dlat, x2);
+        x2 = half_dlon * half_dlon;
+        __m128d s2 = POLY_SIN(half_dlon, x2);
+        __m128d h = _mm_sqrt_pd(s1 * s1 + cos_a * cos_b * (s2 * s2));
+        x2 = h * h;
+        _mm_storeu_pd(km + i, EARTH_RADIUS_KM * (2 * POLY_ASIN(h, x2)));
+
+        __m128d limit = _mm_set1_pd(SMALL_ANGLE);
+        __m128d large = _mm_or_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign, half_dlat), limit),
+                                  _mm_cmpgt_pd(_mm_andnot_pd(sign, half_dlon), limit));
+        large = _mm_or_pd(large, _mm_cmpgt_pd(h, _mm_set1_pd(SMALL_HAVERSINE)));
+        int mask = _mm_movemask_pd(large);
+        for (int j = 0; mask != 0; j++, mask >>= 1) {
+            if (mask & 1) {
+                km[i + j] = exact_length(p, from[i + j], to[i + j]);
+            }
+        }
+    }
+    lengths_scalar(p, n - i, from + i, to + i, km + i);
+}
+
+__attribute__((target("avx2")))
+static void
+lengths_avx2(const struct geo_points * p, int n, const int from[], const int to[],
+             double km[])
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(from + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(to + i));
+        __m256d lat_a = _mm256_i32gather_pd(p->lat, a, 8);
+        __m256d lat_b = _mm256_i32gather_pd(p->lat, b, 8);
+        __m256d lon_a = _mm256_i32gather_pd(p->lon, a, 8);
+        __m256d lon_b = _mm256_i32gather_pd(p->lon, b, 8);
+        __m256d cos_a = _mm256_i32gather_pd(p->cos_lat, a, 8);
+        __m256d cos_b = _mm256_i32gather_pd(p->cos_lat, b, 8);
+
+        __m256d half_dlat = d2r(lat_b - lat_a) * 0.5;
+        __m256d half_dlon = d2r(lon_b - lon_a) * 0.5;
+        __m256d x2 = half_dlat * half_dlat;
+        __m256d s1 = POLY_SIN(half_dlat, x2);
+        x2 = half_dlon * half_dlon;
+        __m256d s2 = POLY_SIN(half_dlon, x2);
+        __m256d h = _mm256_sqrt_pd(s1 * s1 + cos_a * cos_b * (s2 * s2));
+        x2 = h * h;
+        _mm256_storeu_pd(km + i, EARTH_RADIUS_KM * (2 * POLY_ASIN(h, x2)));
+
+        __m256d limit = _mm256_set1_pd(SMALL_ANGLE);
+        __m256d large = _mm256_or_pd(
+            _mm256_cmp_pd(_mm256_andnot_pd(sign, half_dlat), limit, _CMP_GT_OQ),
+            _mm256_cmp_pd(_mm256_andnot_pd(sign, half_dlon), limit, _CMP_GT_OQ));
+        large = _mm256_or_pd(large, _mm256_cmp_pd(h, _mm256_set1_pd(SMALL_HAVERSINE), _CMP_GT_OQ));
+        int mask = _mm256_movemask_pd(large);
+        for (int j = 0; mask != 0; j++, mask >>= 1) {
+            if (mask & 1) {
+                km[i + j] = exact_length(p, from[i + j], to[i + j]);
+            }
+        }
+    }
+    lengths_scalar(p, n - i, from + i, to + i, km + i);
+}
+
+#endif /* GEO_X86 */
+
+enum geo_kernel
+geo_best_kernel(void)
+{
+#ifdef GEO_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return GEO_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return GEO_SSE2;
+    }
+#endif
+    return GEO_SCALAR;
+}
+
+const char *
+geo_kernel_name(enum geo_kernel kernel)
+{
+    switch (kernel) {
+    case GEO_AVX2:
+        return "avx2";
+    case GEO_SSE2:
+        return "sse2";
+    case GEO_SCALAR:
+    default:
+        return "scalar";
+    }
+}
+
+void
+geo_segment_lengths(enum geo_kernel kernel, const struct geo_points * p, int n,
+                    const int from[], const int to[], double km[])
+{
+    enum geo_kernel best = geo_best_kernel();
+    if (kernel > best) {
+        kernel = best;
+    }
+
+    switch (kernel) {
+#ifdef GEO_X86
+    case GEO_AVX2:
+        lengths_avx2(p, n, from, to, km);
+        break;
+    case GEO_SSE2:
+        lengths_sse2(p, n, from, to, km);
+        break;
+#endif
+    case GEO_SCALAR:
+    default:
+        lengths_scalar(p, n, from, to, km);
+        break;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef _GEO_H_
+#define _GEO_H_
+
+#define EARTH_RADIUS_KM 6371.
+
+/**
+ * Node coordinates laid out as separate arrays, so that the coordinates of
+ * several nodes can be loaded into vector registers together.
+ */
+struct geo_points {
+    const double *lat;      // degrees
+    const double *lon;      // degrees
+    const double *cos_lat;  // cosine of the latitude, computed once per node
+};
+
+/**
+ * The implementations of geo_segment_lengths. GEO_AVX2 and GEO_SSE2 are
+ * only available on x86 processors that support them; asking for a kernel
+ * that is not available falls back to the next one down.
+ */
+enum geo_kernel {
+    GEO_SCALAR,
+    GEO_SSE2,
+    GEO_AVX2,
+};
+
+/**
+ * @return The fastest kernel the processor supports.
+ */
+enum geo_kernel geo_best_kernel(void);
+
+/**
+ * @return The name of a kernel, e.g. "avx2".
+ */
+const char * geo_kernel_name(enum geo_kernel kernel);
+
+/**
+ * The great-circle distance between two points by the haversine formula.
+ *
+ * @return The distance in kilometres.
+ */
+double geo_distance(double lat1, double lon1, double lat2, double lon2);
+
+/**
+ * Compute the great-circle length of many segments at once. Road segments
+ * are short, so the sines and the arcsine of the haversine formula are
+ * evaluated with polynomials that need no library calls and vectorize; the
+ * rare segment that is too long for them is computed with geo_distance.
+ * The results agree with geo_distance to within a few units in the last
+ * place.
+ *
+ * @param kernel The implementation to use.
+ * @param p The coordinates of the nodes.
+ * @param n The number of segments.
+ * @param from The node at one end of each segment.
+ * @param to The node at the other end of each segment.
+ * @param km Receives the length of each segment in kilometres.
+ */
+void geo_segment_lengths(enum geo_kernel kernel, const struct geo_points * p, int n,
+                         const int from[], const int to[], double km[]);
+
+#endif /* _GEO_H_ */
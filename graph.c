@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "graph.h"
+
+static bool
+graph_alloc(struct graph * g, int nr_nodes, int nr_edges)
+{
+    g->nr_nodes = nr_nodes;
+    g->nr_edges = nr_edges;
+    g->first = calloc(nr_nodes + 1, sizeof(int));
+    // allocate at least one element so that empty graphs are not mistaken
+    // for allocation failures
+    g->target = malloc((nr_edges + 1) * sizeof(int));
+    g->way = malloc((nr_edges + 1) * sizeof(int));
+    g->cost = malloc((nr_edges + 1) * sizeof(double));
+
+    if (!g->first || !g->target || !g->way || !g->cost) {
+        graph_free(g);
+        return false;
+    }
+    return true;
+}
+
+bool
+graph_build(struct graph * g, int nr_nodes, int nr_edges, const int from[nr_edges],
+            const int to[nr_edges], const int way[nr_edges], const double cost[nr_edges])
+{
+    if (!graph_alloc(g, nr_nodes, nr_edges)) {
+        return false;
+    }
+
+    // counting sort of the edges by their tail node
+    for (int e = 0; e < nr_edges; e++) {
+        g->first[from[e] + 1]++;
+    }
+    for (int u = 0; u < nr_nodes; u++) {
+        g->first[u + 1] += g->first[u];
+    }
+
+    int *next = malloc((nr_nodes + 1) * sizeof(int));
+    if (!next) {
+        graph_free(g);
+        return false;
+    }
+    memcpy(next, g->first, nr_nodes * sizeof(int));
+
+    for (int e = 0; e < nr_edges; e++) {
+        int slot = next[from[e]]++;
+        g->target[slot] = to[e];
+        g->way[slot] = way[e];
+        g->cost[slot] = cost[e];
+    }
+
+    free(next);
+    return true;
+}
+
+bool
+graph_reverse(const struct graph * g, struct graph * rev)
+{
+    int *from = malloc((g->nr_edges + 1) * sizeof(int));
+    if (!from) {
+        return false;
+    }
+    for (int u = 0; u < g->nr_nodes; u++) {
+        for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+            from[e] = u;
+        }
+    }
+
+    bool ok = graph_build(rev, g->nr_nodes, g->nr_edges, g->target, from, g->way, g->cost);
+    free(from);
+    return ok;
+}
+
+bool
+graph_permute(const struct graph * g, const int new_id[], struct graph * out)
+{
+    int *from = malloc((g->nr_edges + 1) * sizeof(int));
+    int *to = malloc((g->nr_edges + 1) * sizeof(int));
+    if (!from || !to) {
+        free(from);
+        free(to);
+        return false;
+    }
+    for (int u = 0; u < g->nr_nodes; u++) {
+        for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+            from[e] = new_id[u];
+            to[e] = new_id[g->target[e]];
+        }
+    }
+
+    bool ok = graph_build(out, g->nr_nodes, g->nr_edges, from, to, g->way, g->cost);
+    free(from);
+    free(to);
+    return ok;
+}
+
+void
+graph_free(struct graph * g)
+{
+    free(g->first);
+    free(g->target);
+    free(g->way);
+    free(g->cost);
+    g->first = NULL;
+    g->target = NULL;
+    g->way = NULL;
+    g->cost = NULL;
+    g->nr_nodes = 0;
+    g->nr_edges = 0;
+}
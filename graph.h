@@ -0,0 +1,63 @@
+#ifndef _GRAPH_H_
+#define _GRAPH_H_
+
+#include <stdbool.h>
+
+/**
+ * A directed graph in compressed sparse row (CSR) form. The outgoing edges
+ * of node u are stored at indices first[u] .. first[u + 1] - 1 of the edge
+ * arrays, so visiting the neighbours of a node touches one contiguous block
+ * of memory and needs no allocation.
+ */
+struct graph {
+    int nr_nodes;
+    int nr_edges;
+    int *first;     // nr_nodes + 1 offsets into the edge arrays
+    int *target;    // node at the head of each edge
+    int *way;       // way the edge was derived from
+    double *cost;   // travel time along the edge, in minutes
+};
+
+/**
+ * Build a CSR graph from an unordered list of edges. Edges leaving the same
+ * node keep their relative order from the input list.
+ *
+ * @param g The graph to fill in. Any previous contents are not freed.
+ * @param nr_nodes The number of nodes in the graph.
+ * @param nr_edges The number of edges in the list.
+ * @param from The tail node of each edge.
+ * @param to The head node of each edge.
+ * @param way The way id of each edge.
+ * @param cost The travel time of each edge, in minutes.
+ * @return true on success, false if memory allocation fails.
+ */
+bool graph_build(struct graph * g, int nr_nodes, int nr_edges, const int from[nr_edges],
+                 const int to[nr_edges], const int way[nr_edges], const double cost[nr_edges]);
+
+/**
+ * Build the reverse of a graph, i.e., the graph with every edge flipped.
+ *
+ * @param g The graph to reverse.
+ * @param rev The graph to fill in with the reversed edges.
+ * @return true on success, false if memory allocation fails.
+ */
+bool graph_reverse(const struct graph * g, struct graph * rev);
+
+/**
+ * Build a copy of a graph with its nodes renumbered. The edges of each node
+ * keep their order.
+ *
+ * @param g The graph to copy.
+ * @param new_id The new number of each node of g.
+ * @param out The graph to fill in. Any previous contents are not freed.
+ * @return true on success, false if memory allocation fails.
+ */
+bool graph_permute(const struct graph * g, const int new_id[], struct graph * out);
+
+/**
+ * Release the memory held by a graph. It is safe to call this on a graph
+ * that was zero-initialized but never built.
+ */
+void graph_free(struct graph * g);
+
+#endif /* _GRAPH_H_ */
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include "heap.h"
+
+bool
+heap_init(struct heap * h, int capacity)
+{
+    h->size = 0;
+    h->capacity = capacity;
+    h->items = malloc((capacity + 1) * sizeof(struct heap_item));
+    h->pos = malloc((capacity + 1) * sizeof(int));
+    if (!h->items || !h->pos) {
+        heap_free(h);
+        return false;
+    }
+    for (int i = 0; i < capacity; i++) {
+        h->pos[i] = -1;
+    }
+    return true;
+}
+
+void
+heap_free(struct heap * h)
+{
+    free(h->items);
+    free(h->pos);
+    h->items = NULL;
+    h->pos = NULL;
+    h->size = 0;
+    h->capacity = 0;
+}
+
+void
+heap_clear(struct heap * h)
+{
+    for (int i = 0; i < h->size; i++) {
+        h->pos[h->items[i].id] = -1;
+    }
+    h->size = 0;
+}
+
+/**
+ * Move the item at index i towards the root until its parent is smaller.
+ * The item is held aside and only written once, instead of swapping at
+ * every level.
+ */
+static void
+sift_up(struct heap * h, int i)
+{
+    struct heap_item item = h->items[i];
+    while (i > 0) {
+        int parent = (i - 1) / HEAP_ARITY;
+        if (h->items[parent].key <= item.key) {
+            break;
+        }
+        h->items[i] = h->items[parent];
+        h->pos[h->items[i].id] = i;
+        i = parent;
+    }
+    h->items[i] = item;
+    h->pos[item.id] = i;
+}
+
+/**
+ * Move the item at index i away from the root until all of its children
+ * are larger.
+ */
+static void
+sift_down(struct heap * h, int i)
+{
+    struct heap_item item = h->items[i];
+    while (true) {
+        int child = i * HEAP_ARITY + 1;
+        if (child >= h->size) {
+            break;
+        }
+        int last = child + HEAP_ARITY < h->size ? child + HEAP_ARITY : h->size;
+        int smallest = child;
+        for (int c = child + 1; c < last; c++) {
+            if (h->items[c].key < h->items[smallest].key) {
+                smallest = c;
+            }
+        }
+        if (item.key <= h->items[smallest].key) {
+            break;
+        }
+        h->items[i] = h->items[smallest];
+        h->pos[h->items[i].id] = i;
+        i = smallest;
+    }
+    h->items[i] = item;
+    h->pos[item.id] = i;
+}
+
+void
+heap_push(struct heap * h, int id, double key)
+{
+    int i = h->size++;
+    h->items[i].id = id;
+    h->items[i].key = key;
+    sift_up(h, i);
+}
+
+void
+heap_decrease_key(struct heap * h, int id, double key)
+{
+    int i = h->pos[id];
+    h->items[i].key = key;
+    sift_up(h, i);
+}
+
+struct heap_item
+heap_pop(struct heap * h)
+{
+    struct heap_item root = h->items[0];
+    h->pos[root.id] = -1;
+    if (--h->size > 0) {
+        h->items[0] = h->items[h->size];
+        sift_down(h, 0);
+    }
+    return root;
+}
@@ -0,0 +1,91 @@
+#ifndef _HEAP_H_
+#define _HEAP_H_
+
+#include <stdbool.h>
+
+/**
+ * Number of children per heap node. A 4-ary heap is shallower than a binary
+ * one and keeps the children of a node in the same cache line, which makes
+ * it faster for the decrease-key heavy workload of Dijkstra's algorithm.
+ * Override with -DHEAP_ARITY=n to experiment with other values.
+ */
+#ifndef HEAP_ARITY
+#define HEAP_ARITY 4
+#endif
+
+/**
+ * An element of the heap: a node id and its priority.
+ */
+struct heap_item {
+    double key;
+    int id;
+};
+
+/**
+ * An indexed d-ary min-heap over the ids 0 .. capacity - 1. The position
+ * map allows decrease-key in O(log n) without searching for the element.
+ * Ids are only inserted when they are first reached, so a search that
+ * touches a handful of nodes only pays for those nodes.
+ */
+struct heap {
+    int size;                   // number of items currently in the heap
+    int capacity;               // number of distinct ids
+    struct heap_item *items;    // the heap itself
+    int *pos;                   // index of each id in items, or -1
+};
+
+/**
+ * Allocate an empty heap able to hold the ids 0 .. capacity - 1.
+ *
+ * @return true on success, false if memory allocation fails.
+ */
+bool heap_init(struct heap * h, int capacity);
+
+/**
+ * Release the memory held by a heap.
+ */
+void heap_free(struct heap * h);
+
+/**
+ * Remove all items from the heap. This only costs as much as the number of
+ * items still in the heap, not its capacity.
+ */
+void heap_clear(struct heap * h);
+
+/**
+ * @return true if the id is currently in the heap.
+ */
+static inline bool
+heap_contains(const struct heap * h, int id)
+{
+    return h->pos[id] >= 0;
+}
+
+/**
+ * Insert an id that is not in the heap yet.
+ */
+void heap_push(struct heap * h, int id, double key);
+
+/**
+ * Lower the key of an id that is already in the heap.
+ */
+void heap_decrease_key(struct heap * h, int id, double key);
+
+/**
+ * Remove the item with the smallest key.
+ *
+ * @param h The heap, which must not be empty.
+ * @return The removed item.
+ */
+struct heap_item heap_pop(struct heap * h);
+
+/**
+ * @return The smallest key in the heap, which must not be empty.
+ */
+static inline double
+heap_min_key(const struct heap * h)
+{
+    return h->items[0].key;
+}
+
+#endif /* _HEAP_H_ */
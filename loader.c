@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "streets.h"
+#include "snapshot.h"
+#include "loader.h"
+
+/**
+ * The text format is parsed straight out of a buffer holding the whole file,
+ * with hand-written number scanning instead of fscanf. The scanner accepts
+ * the same input as the fscanf patterns it replaces: numbers may be separated
+ * by any amount of whitespace, and way names run to the end of their line.
+ */
+struct scanner {
+    char *pos;      // the buffer is NUL-terminated, which stops every scan
+};
+
+static inline bool
+is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool
+is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline void
+skip_space(struct scanner * s)
+{
+    while (is_space(*s->pos)) {
+        s->pos++;
+    }
+}
+
+/**
+ * Match a literal word, like the "way" in fscanf(f, "way %d", ...).
+ */
+static bool
+scan_literal(struct scanner * s, const char * word)
+{
+    skip_space(s);
+    size_t length = strlen(word);
+    if (strncmp(s->pos, word, length) != 0) {
+        return false;
+    }
+    s->pos += length;
+    return true;
+}
+
+static bool
+scan_int(struct scanner * s, int * value)
+{
+    skip_space(s);
+    const char *p = s->pos;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+    if (!is_digit(*p)) {
+        return false;
+    }
+
+    long long v = 0;
+    while (is_digit(*p)) {
+        v = v * 10 + (*p++ - '0');
+        if (v > (long long)INT_MAX + 1) {
+            return false;
+        }
+    }
+    if (negative) {
+        v = -v;
+    }
+    if (v > INT_MAX) {
+        return false;
+    }
+    *value = v;
+    s->pos = (char *)p;
+    return true;
+}
+
+/**
+ * Skip an integer without converting it, like %*d. OSM ids do not fit in an
+ * int, so no range check is done.
+ */
+static bool
+skip_int(struct scanner * s)
+{
+    skip_space(s);
+    const char *p = s->pos;
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+    if (!is_digit(*p)) {
+        return false;
+    }
+    while (is_digit(*p)) {
+        p++;
+    }
+    s->pos = (char *)p;
+    return true;
+}
+
+/**
+ * Powers of ten that are exactly representable as doubles.
+ */
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/**
+ * Scan a double. Coordinates like 43.6675273 have few enough digits that the
+ * digits form an integer below 2^53 and the scale is an exact power of ten,
+ * and a single correctly rounded division then gives exactly the value
+ * strtod would. Anything else, e.g. exponents or very long mantissas, is
+ * handed to strtod.
+ */
+static bool
+scan_double(struct scanner * s, double * value)
+{
+    skip_space(s);
+    const char *p = s->pos;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+
+    for (; is_digit(*p); p++, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+    }
+    if (*p == '.') {
+        for (p++; is_digit(*p); p++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+
+    if (!any || *p == 'e' || *p == 'E' || digits > 15 || exponent < -22 || exponent > 22) {
+        char *end;
+        double v = strtod(s->pos, &end);
+        if (end == s->pos) {
+            return false;
+        }
+        *value = v;
+        s->pos = end;
+        return true;
+    }
+
+    double v = (double)mantissa;
+    v = exponent < 0 ? v / exact_powers_of_ten[-exponent] : v * exact_powers_of_ten[exponent];
+    *value = negative ? -v : v;
+    s->pos = (char *)p;
+    return true;
+}
+
+/**
+ * Scan a float. Speed limits appear once per way, so this is not worth a
+ * fast path.
+ */
+static bool
+scan_float(struct scanner * s, float * value)
+{
+    char *end;
+    skip_space(s);
+    *value = strtof(s->pos, &end);
+    if (end == s->pos) {
+        return false;
+    }
+    s->pos = end;
+    return true;
+}
+
+/**
+ * Scan a whitespace-delimited word and terminate it in place.
+ */
+static char *
+scan_word(struct scanner * s)
+{
+    skip_space(s);
+    char *word = s->pos;
+    while (*s->pos != '\0' && !is_space(*s->pos)) {
+        s->pos++;
+    }
+    if (s->pos == word) {
+        return NULL;
+    }
+    if (*s->pos != '\0') {
+        *s->pos++ = '\0';
+    }
+    return word;
+}
+
+/**
+ * Scan the rest of the current line, like fgets, and terminate it in place
+ * without its newline.
+ */
+static char *
+scan_line(struct scanner * s)
+{
+    skip_space(s);
+    char *line = s->pos;
+    char *newline = strchr(line, '\n');
+    if (newline == NULL) {
+        return NULL;
+    }
+    *newline = '\0';
+    s->pos = newline + 1;
+    return line;
+}
+
+/**
+ * A growable buffer for the id list of one way or node.
+ */
+struct id_buffer {
+    int size;
+    int *ids;
+};
+
+static bool
+scan_int_array(struct scanner * s, struct id_buffer * b, int count)
+{
+    if (count > b->size) {
+        int *ids = realloc(b->ids, count * sizeof(int));
+        if (ids == NULL) {
+            return false;
+        }
+        b->ids = ids;
+        b->size = count;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!scan_int(s, &b->ids[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Read a whole file into a NUL-terminated buffer with one read.
+ */
+static char *
+read_file(const char * filename)
+{
+    struct stat st;
+    FILE * f = fopen(filename, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    char *contents = NULL;
+    if (fstat(fileno(f), &st) == 0 && (contents = malloc(st.st_size + 1)) != NULL) {
+        if (fread(contents, 1, st.st_size, f) == (size_t)st.st_size) {
+            contents[st.st_size] = '\0';
+        } else {
+            free(contents);
+            contents = NULL;
+        }
+    }
+    fclose(f);
+    return contents;
+}
+
+/**
+ * Print the line announcing a loaded map, and how compactly it is stored.
+ */
+static void
+print_loaded(const char * filename, const struct ssmap * map)
+{
+    size_t node_bytes, way_bytes;
+    int nr_nodes = ssmap_nr_nodes(map), nr_ways = ssmap_nr_ways(map);
+
+    printf("%s successfully loaded. %d nodes, %d ways.\n", filename, nr_nodes, nr_ways);
+    ssmap_memory_usage(map, &node_bytes, &way_bytes);
+    printf("Map storage: %.1f bytes per node, %.1f bytes per way.\n",
+           (double)node_bytes / nr_nodes, (double)way_bytes / nr_ways);
+}
+
+static struct ssmap *
+load_snapshot(const char * filename)
+{
+    struct ssmap * map = ssmap_load_snapshot(filename);
+
+    if (map == NULL) {
+        fprintf(stderr, "error: %s has invalid file format\n", filename);
+        return NULL;
+    }
+
+    print_loaded(filename, map);
+    return map;
+}
+
+static bool
+parse_ways(struct scanner * s, struct ssmap * map, int nr_ways, struct id_buffer * ids)
+{
+    for (int i = 0; i < nr_ways; i++) {
+        int id, num_nodes;
+        float maxspeed;
+
+        /* note: we are intentionally not loading the OSM id */
+        if (!scan_literal(s, "way") || !scan_int(s, &id) || !skip_int(s)) {
+            return false;
+        }
+        char *name = scan_line(s);
+        char *which_way;
+        if (name == NULL || !scan_float(s, &maxspeed) || (which_way = scan_word(s)) == NULL ||
+            !scan_int(s, &num_nodes)) {
+            return false;
+        }
+        if (id < 0 || id >= nr_ways || num_nodes <= 0 || !scan_int_array(s, ids, num_nodes)) {
+            return false;
+        }
+
+        bool oneway = strcmp(which_way, "oneway") == 0;
+        if (ssmap_add_way(map, id, name, maxspeed, oneway, num_nodes, ids->ids) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+parse_nodes(struct scanner * s, struct ssmap * map, int nr_nodes, struct id_buffer * ids)
+{
+    for (int i = 0; i < nr_nodes; i++) {
+        int id, num_ways;
+        double lat, lon;
+
+        /* note: we are intentionally not loading the OSM id */
+        if (!scan_literal(s, "node") || !scan_int(s, &id) || !skip_int(s) ||
+            !scan_double(s, &lat) || !scan_double(s, &lon) || !scan_int(s, &num_ways)) {
+            return false;
+        }
+        if (id < 0 || id >= nr_nodes || num_ways <= 0 || !scan_int_array(s, ids, num_ways)) {
+            return false;
+        }
+        for (int j = 0; j < num_ways; j++) {
+            if (ids->ids[j] < 0 || ids->ids[j] >= ssmap_nr_ways(map)) {
+                return false;
+            }
+        }
+
+        if (!ssmap_add_node(map, id, lat, lon, num_ways, ids->ids)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct ssmap *
+load_map(const char * filename)
+{
+    if (snapshot_detect(filename)) {
+        return load_snapshot(filename);
+    }
+
+    char *contents = read_file(filename);
+    struct ssmap * map = NULL;
+    struct id_buffer ids = { 0, NULL };
+    struct scanner s = { contents };
+    int nr_nodes, nr_ways;
+
+    if (contents == NULL) {
+        fprintf(stderr, "error: could not open %s\n", filename);
+        return NULL;
+    }
+
+    const char header[] = "Simple Street Map\n";
+    if (strncmp(contents, header, strlen(header)) != 0) {
+        goto invalid;
+    }
+    s.pos += strlen(header);
+    if (!scan_int(&s, &nr_ways) || !scan_literal(&s, "ways") ||
+        !scan_int(&s, &nr_nodes) || !scan_literal(&s, "nodes")) {
+        goto invalid;
+    }
+
+    map = ssmap_create(nr_nodes, nr_ways);
+    if (map == NULL) {
+        fprintf(stderr, "error: could not create ssmap\n");
+        goto done;
+    }
+
+    if (!parse_ways(&s, map, nr_ways, &ids) || !parse_nodes(&s, map, nr_nodes, &ids)) {
+        goto cleanup;
+    }
+
+    // custom initialization after all nodes and ways have been added
+    if (!ssmap_initialize(map)) {
+        goto cleanup;
+    }
+
+    print_loaded(filename, map);
+    goto done;
+cleanup:
+    ssmap_destroy(map);
+    map = NULL;
+invalid:
+    fprintf(stderr, "error: %s has invalid file format\n", filename);
+done:
+    free(ids.ids);
+    free(contents);
+    return map;
+}
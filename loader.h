@@ -0,0 +1,21 @@
+#ifndef _LOADER_H_
+#define _LOADER_H_
+
+struct ssmap;
+
+/**
+ * Load a map from a file, which may be either a "Simple Street Map" text
+ * file or a binary snapshot written by ssmap_write_snapshot. Text maps are
+ * initialized with ssmap_initialize before being returned.
+ *
+ * On success prints "<filename> successfully loaded. <n> nodes, <w> ways."
+ * followed by the memory used per node and per way.
+ * On failure prints the reason to stderr, e.g. "error: <filename> has
+ * invalid file format".
+ *
+ * @param filename The file to load.
+ * @return A heap-allocated ssmap structure, or NULL on failure.
+ */
+struct ssmap * load_map(const char * filename);
+
+#endif /* _LOADER_H_ */
@@ -1,317 +1,279 @@
 #include <stdio.h>
-#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <getopt.h>
+#include <unistd.h>
 #include "streets.h"
+#include "loader.h"
+#include "batch.h"
+#include "commands.h"
+#include "server.h"
 
-// use for reading from file and stdin
-#define BUFSIZE 32768
-char buffer[BUFSIZE];
-
-#define RET_OK(expr, expected, label) do { \
-    if ((expr) != (expected)) goto label; \
-} while(0)
-
-static bool
-load_int_array(int size, int arr[size], FILE * f)
-{
-    for (int i = 0; i < size; i++) {
-        if (fscanf(f, "%d", arr+i) != 1) {
-            return false;
-        }
-    }
-    fscanf(f, "\n");
-    return true;
-}
+// use for reading from stdin
+char buffer[COMMAND_MAX_LINE];
 
 static void
-remove_newline(char * string)
+usage(const char * prog)
 {
-    char * newline = strchr(string, '\n');
-    if (newline) {
-        *newline = '\0';
-    }
+    fprintf(stderr, "usage: %s [options] FILE\n"
+            "  --ch           build a contraction hierarchy for 'path create a b ch'\n"
+            "  --alt K        select K landmarks for 'path create a b alt'\n"
+            "  --order NAME   renumber the nodes internally for faster searches,\n"
+            "                 along a hilbert curve or in bfs order\n"
+            "  --cache N      keep the shortest-path trees of the last N sources of\n"
+            "                 dijkstra and matrix queries, see the cache command\n"
+            "  --stats        record the work and latency of every query, see the\n"
+            "                 stats command; printed at the end of --batch\n"
+            "  --trace OUT    also write each query to OUT as a line of JSON\n"
+            "  --convert OUT  write FILE to OUT as a binary snapshot and exit\n"
+            "  --batch QUERIES\n"
+            "                 run the 'start end' pairs in QUERIES and exit\n"
+            "  --threads N[,N...]\n"
+            "                 worker threads for --batch; a list runs the batch\n"
+            "                 once per count to compare throughput\n"
+            "  --method NAME  search algorithm for --batch (default dijkstra)\n"
+            "  --output OUT   write --batch results to OUT instead of stdout\n"
+            "  --serve ADDRESS\n"
+            "                 answer commands from many clients over a socket: a\n"
+            "                 Unix socket path containing a '/', a TCP port on\n"
+            "                 localhost or host:port; --threads sets the workers\n"
+            "FILE may be a text map or a binary snapshot.\n", prog);
 }
 
-static struct ssmap * 
-load_map(const char * filename)
+/**
+ * Run a batch of path queries once for each thread count in a comma
+ * separated list, reporting the throughput of each run on stderr. The
+ * results are written out by the first run only.
+ */
+static bool
+run_batch(struct ssmap * map, const char * queries, const char * threads,
+          const char * method, const char * output)
 {
-    FILE * f = fopen(filename, "rt");
-    struct ssmap * map = NULL;
-    int nr_nodes, nr_ways;
-
-    if (f == NULL) {
-        fprintf(stderr, "error: could not open %s\n", filename);
-        return NULL;
-    }
+    enum ssmap_algorithm algorithm = SSMAP_DIJKSTRA;
+    struct batch b;
+    FILE * out = stdout;
+    bool ok = true;
 
-    if (fgets(buffer, BUFSIZE, f) == NULL) {
-        goto done;
+    if (method != NULL && !ssmap_algorithm_by_name(method, &algorithm)) {
+        fprintf(stderr, "error: unknown search method %s.\n", method);
+        return false;
     }
-
-    RET_OK(strcmp(buffer, "Simple Street Map\n"), 0, invalid);
-    RET_OK(fscanf(f, "%d ways\n", &nr_ways), 1, invalid);
-    RET_OK(fscanf(f, "%d nodes\n", &nr_nodes), 1, invalid);
-
-    map = ssmap_create(nr_nodes, nr_ways);
-    if (map == NULL) {
-        fprintf(stderr, "error: could not create ssmap\n");
-        goto done;
+    if (!ssmap_algorithm_available(map, algorithm)) {
+        fprintf(stderr, "error: the %s search needs preprocessing that has not been done.\n",
+                method);
+        return false;
     }
-
-    for (int i = 0; i < nr_ways; i++) {
-        int id, num_nodes;
-        float maxspeed;
-        char which_way[8];
-
-        /* note: we are intentionally not loading the OSM id */
-        RET_OK(fscanf(f, "way %d %*d ", &id), 1, cleanup);
-        RET_OK(fgets(buffer, BUFSIZE, f), buffer, cleanup);
-        RET_OK(fscanf(f, " %f %7s %d\n", &maxspeed, which_way, &num_nodes), 3, cleanup);
-
-        remove_newline(buffer);
-        bool oneway = strcmp(which_way, "oneway") == 0;
-        struct way * way = NULL;
-
-        if (num_nodes > 0) {
-            int node_ids[num_nodes];
-            RET_OK(load_int_array(num_nodes, node_ids, f), true, cleanup);
-            way = ssmap_add_way(map, id, buffer, maxspeed, oneway, num_nodes, node_ids);
-        }
-
-        if (way == NULL) {
-            goto cleanup;
-        }
+    if (!batch_load(&b, queries)) {
+        return false;
     }
-
-    for (int i = 0; i < nr_nodes; i++) {
-        int id, num_ways;
-        double lat, lon;
-
-        /* note: we are intentionally not loading the OSM id */
-        RET_OK(fscanf(f, "node %d %*d %lf %lf %d\n", &id, &lat, &lon, &num_ways), 4, cleanup);
-        struct node * node = NULL;
-        
-        if (num_ways > 0) {
-            int way_ids[num_ways];
-            RET_OK(load_int_array(num_ways, way_ids, f), true, cleanup);
-            node = ssmap_add_node(map, id, lat, lon, num_ways, way_ids);
-        }
-         
-        if (node == NULL) {
-            goto cleanup;
-        }
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        fprintf(stderr, "error: could not open %s\n", output);
+        batch_free(&b);
+        return false;
     }
 
-    // custom initialization after all nodes and ways have been added
-    if (!ssmap_initialize(map)) {
-        goto cleanup;
+    char default_threads[16];
+    if (threads == NULL) {
+        snprintf(default_threads, sizeof(default_threads), "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+        threads = default_threads;
     }
 
-    printf("%s successfully loaded. %d nodes, %d ways.\n", filename, nr_nodes, nr_ways);
-    goto done;
-cleanup:
-    ssmap_destroy(map);
-invalid:
-    fprintf(stderr, "error: %s has invalid file format\n", filename);
-done:
-    fclose(f);
-    return map;
-}
-
-static bool
-get_integer_argument(char * line, int * iptr)
-{
-    remove_newline(line);
-
-    if (sscanf(line, "%d", iptr) == 1) {
-        return true;
-    }
-
-    printf("error: '%s' is not an integer.\n", line);
-    return false;
-}
-
-static void
-handle_find(char * line, struct ssmap * map)
-{
-    char * command = strtok_r(line, " \t\r\n\v\f", &line);
-    char * first = strtok_r(line, " \t\r\n\v\f", &line);
-    char * second = strtok_r(line, " \t\r\n\v\f", &line);
-    char * third = strtok_r(line, " \t\r\n\v\f", &line);
-
-    if (command == NULL) {
-        /* fall through */
-    }
-    else if (strcmp(command, "node") == 0) {
-        if (first == NULL || third != NULL) {
-            printf("error: invalid number of arguments.\n");
-        }
-        else {
-            ssmap_find_node_by_names(map, first, second);
-            return;
+    bool first = true;
+    for (const char * p = threads; ok && *p != '\0'; p += strspn(p, ",")) {
+        char * endptr;
+        long nr_threads = strtol(p, &endptr, 10);
+        if (endptr == p || nr_threads <= 0 || nr_threads > 1024) {
+            fprintf(stderr, "error: invalid thread count in %s\n", threads);
+            ok = false;
+            break;
         }
-    }
-    else if (strcmp(command, "way") == 0) {
-        if (first == NULL || second != NULL) {
-            printf("error: invalid number of arguments.\n");
+        p = endptr;
+
+        double seconds = batch_run(map, &b, algorithm, nr_threads, first ? out : NULL);
+        if (seconds < 0) {
+            fprintf(stderr, "error: batch failed\n");
+            ok = false;
+            break;
         }
-        else {
-            ssmap_find_way_by_name(map, first);
-            return;
-        }    
-    }
-    else {
-        printf("error: first argument must be either node or way.\n");
+        fprintf(stderr, "%ld threads: %d queries in %.3f s, %.0f queries/sec\n",
+                nr_threads, b.count, seconds, seconds > 0 ? b.count / seconds : 0.0);
+        first = false;
     }
 
-    printf("usage: find way keyword | find node keyword [keyword]\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    batch_free(&b);
+    return ok;
 }
 
-static bool
-handle_path_travel_time(char * line, struct ssmap * map)
+int 
+main(int argc, char * argv[])
 {
-    int capacity = 1;
-    int n = 0;
-
-    // use number of space characters to determine approximate array size
-    for (int i = 0; line[i] != '\0'; i++) {
-        if (isspace((int)line[i])) {
-            capacity++;
-        }
-    }
-
-    int node_ids[capacity];
-    while(true) {
-        char * token = strtok_r(line, " \t\r\n\v\f", &line);
-        char * endptr;
-
-        if (token == NULL)
+    static const struct option long_options[] = {
+        { "ch", no_argument, NULL, 'c' },
+        { "alt", required_argument, NULL, 'a' },
+        { "order", required_argument, NULL, 'r' },
+        { "cache", required_argument, NULL, 'C' },
+        { "stats", no_argument, NULL, 's' },
+        { "trace", required_argument, NULL, 'T' },
+        { "convert", required_argument, NULL, 'o' },
+        { "batch", required_argument, NULL, 'b' },
+        { "threads", required_argument, NULL, 't' },
+        { "method", required_argument, NULL, 'm' },
+        { "output", required_argument, NULL, 'O' },
+        { "serve", required_argument, NULL, 'S' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char * convert_to = NULL;
+    const char * batch_file = NULL;
+    const char * threads = NULL;
+    const char * method = NULL;
+    const char * output = NULL;
+    const char * trace = NULL;
+    const char * serve = NULL;
+    bool stats = false;
+    bool build_ch = false;
+    bool reorder = false;
+    enum ssmap_node_order order;
+    int nr_landmarks = 0;
+    int cache_size = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            build_ch = true;
             break;
-
-        node_ids[n++] = strtol(token, &endptr, 10);
-        if (endptr && *endptr != '\0') {
-            printf("error: %s is not an integer.\n", token);
-            return false;
+        case 'a':
+            nr_landmarks = atoi(optarg);
+            if (nr_landmarks <= 0) {
+                fprintf(stderr, "error: --alt needs a positive number of landmarks.\n");
+                return 1;
+            }
+            break;
+        case 'r':
+            if (!ssmap_node_order_by_name(optarg, &order)) {
+                fprintf(stderr, "error: unknown node order %s.\n", optarg);
+                return 1;
+            }
+            reorder = true;
+            break;
+        case 'C':
+            cache_size = atoi(optarg);
+            if (cache_size <= 0) {
+                fprintf(stderr, "error: --cache needs a positive number of trees.\n");
+                return 1;
+            }
+            break;
+        case 's':
+            stats = true;
+            break;
+        case 'T':
+            trace = optarg;
+            stats = true;
+            break;
+        case 'o':
+            convert_to = optarg;
+            break;
+        case 'b':
+            batch_file = optarg;
+            break;
+        case 't':
+            threads = optarg;
+            break;
+        case 'm':
+            method = optarg;
+            break;
+        case 'O':
+            output = optarg;
+            break;
+        case 'S':
+            serve = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 0;
         }
     }
 
-    if (n < 2) {
-        printf("error: must specify at least two nodes.\n");
-        return false;
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 0;
     }
 
-    double result = ssmap_path_travel_time(map, n, node_ids);
-    if (result >= 0.) {
-        printf("%.4f minutes\n", result);
+    struct ssmap * map = load_map(argv[optind]);
+    if (map == NULL) {     
+        return 1;
     }
-    
-    return true;
-}
 
-static bool
-handle_path_create(char * line, struct ssmap * map)
-{
-    char * start = strtok_r(line, " \t\r\n\v\f", &line);
-    char * finish = strtok_r(line, " \t\r\n\v\f", &line);
-    char * endptr;
-
-    if (start == NULL || finish == NULL) {
-        printf("error: must specify start node and finish node.\n");
-        return false;
+    if (reorder && !ssmap_reorder_nodes(map, order)) {
+        ssmap_destroy(map);
+        return 1;
     }
 
-    int start_id = strtol(start, &endptr, 10);
-    if (endptr && *endptr != '\0') {
-        printf("error: %s is not an integer.\n", start);
-        return false;
+    if (convert_to != NULL) {
+        bool ok = ssmap_write_snapshot(map, convert_to, true);
+        if (ok) {
+            printf("%s written.\n", convert_to);
+        }
+        ssmap_destroy(map);
+        return ok ? 0 : 1;
     }
 
-    int end_id = strtol(finish, &endptr, 10);
-    if (endptr && *endptr != '\0') {
-        printf("error: %s is not an integer.\n", finish);
-        return false;
+    if ((build_ch && !ssmap_prepare_ch(map)) ||
+        (nr_landmarks > 0 && !ssmap_prepare_alt(map, nr_landmarks))) {
+        ssmap_destroy(map);
+        return 1;
     }
 
-    ssmap_path_create(map, start_id, end_id);
-    return true;
-}
-
-static void
-handle_path(char * line, struct ssmap * map)
-{
-    char * command = strtok_r(line, " \t\r\n\v\f", &line);
-
-    if (command == NULL) {
-        /* fall through */
-    }
-    else if (strcmp(command, "time") == 0) {
-        if (handle_path_travel_time(line, map))
-            return;
-    }
-    else if (strcmp(command, "create") == 0) {
-        if (handle_path_create(line, map))
-            return;
-    }
-    else {
-        printf("error: first argument must be either time or create.\n");
+    if (cache_size > 0 && !ssmap_enable_tree_cache(map, cache_size)) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        ssmap_destroy(map);
+        return 1;
     }
 
-    printf("usage: path create start finish | path time node1 node2 [nodes...]\n");
-}
+    if (stats && !ssmap_enable_stats(map, trace)) {
+        ssmap_destroy(map);
+        return 1;
+    }
 
-int 
-main(int argc, const char * argv[])
-{
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s FILE\n", argv[0]);
-        return 0;
+    if (batch_file != NULL) {
+        bool ok = run_batch(map, batch_file, threads, method, output);
+        if (ok && stats) {
+            ssmap_print_stats(map, stdout);
+        }
+        ssmap_destroy(map);
+        return ok ? 0 : 1;
     }
 
-    struct ssmap * map = load_map(argv[1]);
-    if (map == NULL) {     
-        return 1;
+    if (serve != NULL) {
+        long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        char * endptr;
+        if (threads != NULL &&
+            ((nr_threads = strtol(threads, &endptr, 10)) <= 0 || nr_threads > 1024 ||
+             *endptr != '\0')) {
+            fprintf(stderr, "error: --serve needs a single thread count.\n");
+            ssmap_destroy(map);
+            return 1;
+        }
+        bool ok = server_run(map, serve, nr_threads);
+        ssmap_destroy(map);
+        return ok ? 0 : 1;
     }
 
     while(true) {
         printf(">> ");
         fflush(stdout);
-        char * ptr = fgets(buffer, BUFSIZE, stdin);
+        char * ptr = fgets(buffer, COMMAND_MAX_LINE, stdin);
         if (ptr == NULL) {
             break;
         }
 
-        char * command = strtok_r(buffer, " \t\r\n\v\f", &ptr);
-
-        if (command == NULL) {
-            /* fall through */
-        }
-        else if (strcmp(command, "quit") == 0) {
+        if (!command_run(map, buffer, false, stdout)) {
             break;
         }
-        else if (strcmp(command, "node") == 0) {
-            int id;
-            if (get_integer_argument(ptr, &id)) {
-                ssmap_print_node(map, id);
-            }
-        }
-        else if (strcmp(command, "way") == 0) {
-            int id;
-            if (get_integer_argument(ptr, &id)) {
-                ssmap_print_way(map, id);
-            }
-        }
-        else if (strcmp(command, "find") == 0) {
-            handle_find(ptr, map);
-        }
-        else if (strcmp(command, "path") == 0) {
-            handle_path(ptr, map);
-        }
-        else {
-            printf("error: unknown command %s. Available commands are:\n"
-                   "\tnode, way, find, path, quit\n", command);
-        }
     }
     
     ssmap_destroy(map);
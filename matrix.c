@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "streets.h"
+#include "parallel.h"
+#include "matrix.h"
+
+/**
+ * Rows are computed in blocks of this many before being written out.
+ */
+#define MATRIX_BLOCK 64
+
+/**
+ * The work of the pool for the current block of rows, one source per
+ * iteration.
+ */
+struct block {
+    const struct ssmap *map;
+    const int *sources;
+    int nr_targets;
+    const int *targets;
+    int first;          // index of the first source of the block
+    double *minutes;    // a row of nr_targets travel times per source
+};
+
+static bool
+compute_row(void * arg, void * scratch, int i)
+{
+    struct block *b = arg;
+    double *row = b->minutes + (size_t)i * b->nr_targets;
+    return ssmap_travel_times(b->map, b->sources[b->first + i], b->nr_targets, b->targets, row);
+}
+
+bool
+matrix_write(const struct ssmap * m, int nr_sources, const int sources[],
+             int nr_targets, const int targets[], int nr_threads, FILE * out)
+{
+    struct block b = {
+        .map = m,
+        .sources = sources,
+        .nr_targets = nr_targets,
+        .targets = targets,
+        .minutes = malloc((size_t)MATRIX_BLOCK * nr_targets * sizeof(double)),
+    };
+    struct parallel *pool = b.minutes != NULL ? parallel_start(nr_threads, compute_row, &b, 0) : NULL;
+    bool ok = pool != NULL;
+
+    fprintf(out, "source");
+    for (int j = 0; j < nr_targets; j++) {
+        fprintf(out, ",%d", targets[j]);
+    }
+    fprintf(out, "\n");
+
+    for (int first = 0; ok && first < nr_sources; first += MATRIX_BLOCK) {
+        int count = nr_sources - first < MATRIX_BLOCK ? nr_sources - first : MATRIX_BLOCK;
+        b.first = first;
+        ok = parallel_for(pool, count);
+
+        for (int i = 0; ok && i < count; i++) {
+            const double *row = b.minutes + (size_t)i * nr_targets;
+            fprintf(out, "%d", sources[first + i]);
+            for (int j = 0; j < nr_targets; j++) {
+                if (row[j] >= 0) {
+                    fprintf(out, ",%.4f", row[j]);
+                } else {
+                    fprintf(out, ",");
+                }
+            }
+            fprintf(out, "\n");
+        }
+        fflush(out);
+    }
+
+    parallel_stop(pool);
+    free(b.minutes);
+    return ok;
+}
@@ -0,0 +1,29 @@
+#ifndef _MATRIX_H_
+#define _MATRIX_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "streets.h"
+
+/**
+ * Compute the travel time from every source to every target and write the
+ * table as CSV. The first line holds the target ids, and each following line
+ * a source id and its travel times in minutes, with an empty field where a
+ * target cannot be reached. Rows are computed by a pool of threads, one
+ * search per source, and written out in source order a block at a time, so
+ * large tables do not have to fit in memory.
+ *
+ * @param m The map, which is only read.
+ * @param nr_sources The number of sources.
+ * @param sources The source node ids, which must be valid.
+ * @param nr_targets The number of targets.
+ * @param targets The target node ids, which must be valid.
+ * @param nr_threads The number of worker threads.
+ * @param out Where to write the table.
+ * @return true on success, false if memory allocation fails, in which case
+ * the table may be incomplete.
+ */
+bool matrix_write(const struct ssmap * m, int nr_sources, const int sources[],
+                  int nr_targets, const int targets[], int nr_threads, FILE * out);
+
+#endif /* _MATRIX_H_ */
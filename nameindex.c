@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdbool.h>
+#include "nameindex.h"
+
+/**
+ * The (trigram, name) pairs are sorted with a two pass radix sort on the
+ * 24-bit trigram, 12 bits at a time.
+ */
+#define RADIX_BITS 12
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+static inline uint32_t
+trigram(const char * s)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    return (uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2];
+}
+
+bool
+name_index_build(struct name_index * idx, int count, const char * const names[])
+{
+    memset(idx, 0, sizeof(struct name_index));
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        size_t length = strlen(names[i]);
+        if (length >= NAME_INDEX_GRAM) {
+            total += length - (NAME_INDEX_GRAM - 1);
+        }
+    }
+    if (total >= INT_MAX) {
+        return false;
+    }
+
+    uint32_t *keys = malloc((total + 1) * sizeof(uint32_t));
+    uint32_t *tmp_keys = malloc((total + 1) * sizeof(uint32_t));
+    int *ids = malloc((total + 1) * sizeof(int));
+    int *tmp_ids = malloc((total + 1) * sizeof(int));
+    size_t *counts = malloc((RADIX_SIZE + 1) * sizeof(size_t));
+    bool ok = keys && tmp_keys && ids && tmp_ids && counts;
+    if (!ok) {
+        goto done;
+    }
+
+    // the pairs are generated in name order, and the radix sort is stable,
+    // so every posting list comes out sorted
+    size_t n = 0;
+    for (int i = 0; i < count; i++) {
+        for (const char *p = names[i]; p[0] && p[1] && p[2]; p++) {
+            keys[n] = trigram(p);
+            ids[n] = i;
+            n++;
+        }
+    }
+
+    for (int shift = 0; shift < 24; shift += RADIX_BITS) {
+        memset(counts, 0, (RADIX_SIZE + 1) * sizeof(size_t));
+        for (size_t j = 0; j < n; j++) {
+            counts[((keys[j] >> shift) & (RADIX_SIZE - 1)) + 1]++;
+        }
+        for (int b = 0; b < RADIX_SIZE; b++) {
+            counts[b + 1] += counts[b];
+        }
+        for (size_t j = 0; j < n; j++) {
+            size_t pos = counts[(keys[j] >> shift) & (RADIX_SIZE - 1)]++;
+            tmp_keys[pos] = keys[j];
+            tmp_ids[pos] = ids[j];
+        }
+        uint32_t *swap_keys = keys;
+        keys = tmp_keys;
+        tmp_keys = swap_keys;
+        int *swap_ids = ids;
+        ids = tmp_ids;
+        tmp_ids = swap_ids;
+    }
+
+    // squeeze out repeated trigrams of the same name, and collect the keys
+    int nr_keys = 0;
+    size_t m = 0;
+    for (size_t j = 0; j < n; j++) {
+        if (j > 0 && keys[j] == keys[j - 1]) {
+            if (ids[j] != ids[m - 1]) {
+                ids[m++] = ids[j];
+            }
+            continue;
+        }
+        tmp_keys[nr_keys] = keys[j];
+        tmp_ids[nr_keys] = m;   // reused as the offsets
+        nr_keys++;
+        ids[m++] = ids[j];
+    }
+
+    int *shrunk = realloc(ids, (m + 1) * sizeof(int));
+    if (shrunk) {
+        ids = shrunk;
+    }
+    idx->keys = malloc((nr_keys + 1) * sizeof(uint32_t));
+    idx->first = malloc((nr_keys + 1) * sizeof(int));
+    if (!idx->keys || !idx->first) {
+        name_index_free(idx);
+        ok = false;
+        goto done;
+    }
+    idx->nr_keys = nr_keys;
+    idx->ids = ids;
+    ids = NULL;     // now owned by the index
+    memcpy(idx->keys, tmp_keys, nr_keys * sizeof(uint32_t));
+    memcpy(idx->first, tmp_ids, nr_keys * sizeof(int));
+    idx->first[nr_keys] = m;
+
+done:
+    free(keys);
+    free(tmp_keys);
+    free(ids);
+    free(tmp_ids);
+    free(counts);
+    return ok;
+}
+
+void
+name_index_free(struct name_index * idx)
+{
+    free(idx->keys);
+    free(idx->first);
+    free(idx->ids);
+    memset(idx, 0, sizeof(struct name_index));
+}
+
+/**
+ * @return The index of a key, or -1 if no name contains the trigram.
+ */
+static int
+find_key(const struct name_index * idx, uint32_t key)
+{
+    int lo = 0, hi = idx->nr_keys;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (idx->keys[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < idx->nr_keys && idx->keys[lo] == key ? lo : -1;
+}
+
+int
+name_index_candidates(const struct name_index * idx, const char * pattern,
+                      int ** candidates)
+{
+    size_t length = strlen(pattern);
+    *candidates = NULL;
+    if (length < NAME_INDEX_GRAM || idx->keys == NULL) {
+        return -1;
+    }
+
+    int nr_grams = length - (NAME_INDEX_GRAM - 1);
+    int *lists = malloc(nr_grams * sizeof(int));
+    if (!lists) {
+        return -1;
+    }
+
+    // start from the shortest posting list, which bounds the result
+    int shortest = -1;
+    for (int g = 0; g < nr_grams; g++) {
+        lists[g] = find_key(idx, trigram(pattern + g));
+        if (lists[g] == -1) {
+            free(lists);
+            return 0;
+        }
+        int size = idx->first[lists[g] + 1] - idx->first[lists[g]];
+        if (shortest == -1 || size < idx->first[shortest + 1] - idx->first[shortest]) {
+            shortest = lists[g];
+        }
+    }
+
+    int count = idx->first[shortest + 1] - idx->first[shortest];
+    int *result = malloc((count + 1) * sizeof(int));
+    if (!result) {
+        free(lists);
+        return -1;
+    }
+    memcpy(result, idx->ids + idx->first[shortest], count * sizeof(int));
+
+    // keep the candidates that are on every other list too, by binary search
+    // since the candidates are usually far fewer than the list entries
+    for (int g = 0; g < nr_grams && count > 0; g++) {
+        if (lists[g] == shortest) {
+            continue;
+        }
+        const int *list = idx->ids + idx->first[lists[g]];
+        int lo = 0, size = idx->first[lists[g] + 1] - idx->first[lists[g]];
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            int hi = size;
+            while (lo < hi) {
+                int mid = lo + (hi - lo) / 2;
+                if (list[mid] < result[i]) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            if (lo < size && list[lo] == result[i]) {
+                result[kept++] = result[i];
+            }
+        }
+        count = kept;
+    }
+
+    free(lists);
+    *candidates = result;
+    return count;
+}
@@ -0,0 +1,61 @@
+#ifndef _NAMEINDEX_H_
+#define _NAMEINDEX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * NAME_INDEX_GRAM is the length of the substrings the index is keyed on.
+ * Patterns shorter than that cannot be looked up and need a full scan.
+ */
+#define NAME_INDEX_GRAM 3
+
+/**
+ * A trigram index over a set of names. For every three-byte substring that
+ * occurs in any name, it stores the sorted list of names containing it. A
+ * name can only contain a pattern if it contains every trigram of the
+ * pattern, so intersecting their lists gives a short list of candidates that
+ * are then checked with strstr.
+ *
+ * The keys are sorted, and key i owns the names ids[first[i]] up to
+ * ids[first[i + 1]].
+ */
+struct name_index {
+    int nr_keys;
+    uint32_t *keys;     // the trigrams, packed big-endian into 24 bits
+    int *first;         // nr_keys + 1 offsets into ids
+    int *ids;           // the posting lists, concatenated
+};
+
+/**
+ * Build the index.
+ *
+ * @param idx The index to fill in.
+ * @param count The number of names.
+ * @param names The names, which are identified by their index.
+ * @return true on success, false if memory allocation fails.
+ */
+bool name_index_build(struct name_index * idx, int count, const char * const names[]);
+
+/**
+ * Release the memory held by an index. It is safe to call this on a
+ * zero-initialized index that was never built.
+ */
+void name_index_free(struct name_index * idx);
+
+/**
+ * Find the names that may contain a pattern.
+ *
+ * @param idx The index.
+ * @param pattern The substring to look for.
+ * @param candidates Receives a heap-allocated array of name ids in increasing
+ *                   order, which the caller frees. Every name containing the
+ *                   pattern is among them, but not every candidate does.
+ * @return The number of candidates, or -1 if the pattern is shorter than
+ * NAME_INDEX_GRAM or memory allocation fails, in which case every name has
+ * to be checked.
+ */
+int name_index_candidates(const struct name_index * idx, const char * pattern,
+                          int ** candidates);
+
+#endif /* _NAMEINDEX_H_ */
@@ -0,0 +1,145 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "order.h"
+
+/**
+ * The coordinates are scaled to a grid of 2^16 by 2^16 cells, which is finer
+ * than a metre across a city and still gives a 32-bit curve position.
+ */
+#define HILBERT_BITS 16
+#define HILBERT_SIZE (1u << HILBERT_BITS)
+
+/**
+ * @return The distance along the Hilbert curve of the grid cell (x, y).
+ */
+static uint32_t
+hilbert_index(uint32_t x, uint32_t y)
+{
+    uint32_t d = 0;
+    for (uint32_t s = HILBERT_SIZE / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += s * s * ((3 * rx) ^ ry);
+        // rotate the quadrant so that the curve inside it has the base shape
+        if (ry == 0) {
+            if (rx == 1) {
+                x = HILBERT_SIZE - 1 - x;
+                y = HILBERT_SIZE - 1 - y;
+            }
+            uint32_t t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+static inline uint32_t
+grid_cell(double value, double min, double max)
+{
+    if (max <= min) {
+        return 0;
+    }
+    double cell = (value - min) / (max - min) * (HILBERT_SIZE - 1);
+    return (uint32_t)(cell + 0.5);
+}
+
+bool
+order_hilbert(int count, const double lat[], const double lon[], int order[])
+{
+    uint32_t *keys = malloc((count + 1) * sizeof(uint32_t));
+    uint32_t *tmp_keys = malloc((count + 1) * sizeof(uint32_t));
+    int *tmp_ids = malloc((count + 1) * sizeof(int));
+    size_t *counts = malloc((HILBERT_SIZE + 1) * sizeof(size_t));
+    bool ok = keys && tmp_keys && tmp_ids && counts;
+    if (!ok) {
+        goto done;
+    }
+
+    double min_lat = DBL_MAX, max_lat = -DBL_MAX, min_lon = DBL_MAX, max_lon = -DBL_MAX;
+    for (int i = 0; i < count; i++) {
+        min_lat = lat[i] < min_lat ? lat[i] : min_lat;
+        max_lat = lat[i] > max_lat ? lat[i] : max_lat;
+        min_lon = lon[i] < min_lon ? lon[i] : min_lon;
+        max_lon = lon[i] > max_lon ? lon[i] : max_lon;
+    }
+    for (int i = 0; i < count; i++) {
+        keys[i] = hilbert_index(grid_cell(lon[i], min_lon, max_lon),
+                                grid_cell(lat[i], min_lat, max_lat));
+        order[i] = i;
+    }
+
+    // two pass radix sort on the curve position, 16 bits at a time; the
+    // sort is stable, so nodes in the same cell keep their original order
+    uint32_t *in_keys = keys, *out_keys = tmp_keys;
+    int *in_ids = order, *out_ids = tmp_ids;
+    for (int shift = 0; shift < 32; shift += HILBERT_BITS) {
+        memset(counts, 0, (HILBERT_SIZE + 1) * sizeof(size_t));
+        for (int i = 0; i < count; i++) {
+            counts[((in_keys[i] >> shift) & (HILBERT_SIZE - 1)) + 1]++;
+        }
+        for (uint32_t b = 0; b < HILBERT_SIZE; b++) {
+            counts[b + 1] += counts[b];
+        }
+        for (int i = 0; i < count; i++) {
+            size_t pos = counts[(in_keys[i] >> shift) & (HILBERT_SIZE - 1)]++;
+            out_keys[pos] = in_keys[i];
+            out_ids[pos] = in_ids[i];
+        }
+        uint32_t *swap_keys = in_keys;
+        in_keys = out_keys;
+        out_keys = swap_keys;
+        int *swap_ids = in_ids;
+        in_ids = out_ids;
+        out_ids = swap_ids;
+    }
+    // an even number of passes leaves the result back in order
+
+done:
+    free(keys);
+    free(tmp_keys);
+    free(tmp_ids);
+    free(counts);
+    return ok;
+}
+
+bool
+order_bfs(const struct graph * forward, const struct graph * reverse, int order[])
+{
+    int V = forward->nr_nodes;
+    bool *seen = calloc(V + 1, sizeof(bool));
+    if (!seen) {
+        return false;
+    }
+
+    // order doubles as the queue: the nodes still to be expanded are the
+    // ones between head and tail
+    int head = 0, tail = 0;
+    for (int root = 0; root < V; root++) {
+        if (seen[root]) {
+            continue;
+        }
+        seen[root] = true;
+        order[tail++] = root;
+        while (head < tail) {
+            int u = order[head++];
+            const struct graph *graphs[2] = { forward, reverse };
+            for (int i = 0; i < 2; i++) {
+                const struct graph *g = graphs[i];
+                for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+                    int v = g->target[e];
+                    if (!seen[v]) {
+                        seen[v] = true;
+                        order[tail++] = v;
+                    }
+                }
+            }
+        }
+    }
+
+    free(seen);
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef _ORDER_H_
+#define _ORDER_H_
+
+#include <stdbool.h>
+#include "graph.h"
+
+/**
+ * Orders for renumbering the nodes of a map so that nodes that are searched
+ * together are stored together. Each function fills in order[k] with the
+ * node that should come k-th.
+ */
+
+/**
+ * Order the nodes along a Hilbert curve over their coordinates, which keeps
+ * nodes that are close on the map close in memory. Ties keep their original
+ * order.
+ *
+ * @param count The number of nodes.
+ * @param lat The latitude of each node, in degrees.
+ * @param lon The longitude of each node, in degrees.
+ * @param order Receives the new order.
+ * @return true on success, false if memory allocation fails.
+ */
+bool order_hilbert(int count, const double lat[], const double lon[], int order[]);
+
+/**
+ * Order the nodes breadth-first over the road graph, ignoring the direction
+ * of the edges, so that the neighbours of a node are numbered close to it.
+ * Each part of the map that is not connected to the earlier ones starts from
+ * its lowest numbered node.
+ *
+ * @param forward The road graph.
+ * @param reverse The road graph with every edge flipped.
+ * @param order Receives the new order.
+ * @return true on success, false if memory allocation fails.
+ */
+bool order_bfs(const struct graph * forward, const struct graph * reverse, int order[]);
+
+#endif /* _ORDER_H_ */
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "parallel.h"
+
+struct parallel {
+    pthread_mutex_t lock;
+    pthread_cond_t start;       // a loop started, or the pool is stopping
+    pthread_cond_t finish;      // the last thread finished its part of a loop
+    pthread_t *threads;
+    int nr_threads;             // started, or 0 to run loops on the caller
+    parallel_body body;
+    void *arg;
+    size_t scratch_size;
+    void *scratch;              // of the caller, when there are no threads
+    unsigned loop;              // the number of loops started
+    int count;
+    int next;                   // next iteration to claim
+    int running;                // threads still working on the current loop
+    bool failed;
+    bool stopping;
+};
+
+static void
+run_iterations(struct parallel * p, void * scratch)
+{
+    while (true) {
+        int i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED);
+        if (i >= p->count) {
+            break;
+        }
+        if (!p->body(p->arg, scratch, i)) {
+            __atomic_store_n(&p->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void *
+worker(void * arg)
+{
+    struct parallel *p = arg;
+    void *scratch = p->scratch_size > 0 ? malloc(p->scratch_size) : NULL;
+    bool ready = p->scratch_size == 0 || scratch != NULL;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        while (!p->stopping && p->loop == seen) {
+            pthread_cond_wait(&p->start, &p->lock);
+        }
+        if (p->stopping) {
+            break;
+        }
+        seen = p->loop;
+        pthread_mutex_unlock(&p->lock);
+
+        if (ready) {
+            run_iterations(p, scratch);
+        } else {
+            __atomic_store_n(&p->failed, true, __ATOMIC_RELAXED);
+        }
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->running == 0) {
+            pthread_cond_signal(&p->finish);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    free(scratch);
+    return NULL;
+}
+
+struct parallel *
+parallel_start(int nr_threads, parallel_body body, void * arg, size_t scratch_size)
+{
+    struct parallel *p = calloc(1, sizeof(struct parallel));
+    if (!p) {
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->finish, NULL);
+    p->body = body;
+    p->arg = arg;
+    p->scratch_size = scratch_size;
+
+    if (nr_threads > 1 && (p->threads = malloc(nr_threads * sizeof(pthread_t))) != NULL) {
+        while (p->nr_threads < nr_threads &&
+               pthread_create(&p->threads[p->nr_threads], NULL, worker, p) == 0) {
+            p->nr_threads++;
+        }
+    }
+    if (p->nr_threads == 0 && scratch_size > 0 && (p->scratch = malloc(scratch_size)) == NULL) {
+        parallel_stop(p);
+        return NULL;
+    }
+    return p;
+}
+
+bool
+parallel_for(struct parallel * p, int count)
+{
+    if (p->nr_threads == 0) {
+        p->count = count;
+        p->next = 0;
+        p->failed = false;
+        run_iterations(p, p->scratch);
+        return !p->failed;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->count = count;
+    p->next = 0;
+    p->failed = false;
+    p->running = p->nr_threads;
+    p->loop++;
+    pthread_cond_broadcast(&p->start);
+    while (p->running > 0) {
+        pthread_cond_wait(&p->finish, &p->lock);
+    }
+    bool ok = !p->failed;
+    pthread_mutex_unlock(&p->lock);
+    return ok;
+}
+
+void
+parallel_stop(struct parallel * p)
+{
+    if (p == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->stopping = true;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->nr_threads; i++) {
+        pthread_join(p->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&p->finish);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->lock);
+    free(p->threads);
+    free(p->scratch);
+    free(p);
+}
@@ -0,0 +1,57 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * A pool of threads that runs the iterations of parallel for loops. The
+ * threads are started once and kept for all the loops run on the pool, so
+ * what they allocate per thread, such as the search workspace of a map,
+ * is allocated once per pool rather than once per loop. The threads claim
+ * iterations one at a time, so a slow iteration does not hold up the ones
+ * behind it.
+ */
+struct parallel;
+
+/**
+ * The body of a loop, run once for each iteration.
+ *
+ * @param arg The argument given to parallel_start.
+ * @param scratch Memory of the scratch size given to parallel_start that
+ *                belongs to the calling thread, or NULL if the size is 0.
+ * @param i The iteration, from 0 up to the count given to parallel_for.
+ * @return false if the iteration failed.
+ */
+typedef bool (*parallel_body)(void * arg, void * scratch, int i);
+
+/**
+ * Start a pool of threads. If some threads cannot be created the others
+ * take up their share, and with one thread or none the loops run on the
+ * thread that calls parallel_for.
+ *
+ * @param nr_threads The number of threads.
+ * @param body The body of the loops.
+ * @param arg Passed to body. It may be changed between loops, e.g. to
+ *            point the iterations at the next block of the input.
+ * @param scratch_size The bytes of scratch memory each thread gets.
+ * @return The pool, or NULL if memory allocation fails.
+ */
+struct parallel * parallel_start(int nr_threads, parallel_body body, void * arg,
+                                 size_t scratch_size);
+
+/**
+ * Run iterations 0 to count - 1 of the body on the pool and wait for all of
+ * them to finish.
+ *
+ * @return false if any iteration failed, or a thread could not allocate its
+ * scratch memory.
+ */
+bool parallel_for(struct parallel * p, int count);
+
+/**
+ * Stop the threads of a pool and free it. p may be NULL.
+ */
+void parallel_stop(struct parallel * p);
+
+#endif /* _PARALLEL_H_ */
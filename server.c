@@ -0,0 +1,729 @@
+// for fopencookie
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "server.h"
+#include "commands.h"
+
+#define MAX_CONNECTIONS 1024
+#define READ_SIZE 65536
+// no more commands are run for a connection with this much unsent output
+#define OUTPUT_LIMIT (1 << 20)
+// a longer response is replaced by an error, so that one command cannot use
+// up the memory of the server
+#define RESPONSE_LIMIT (16 << 20)
+// commands queued for the workers, per worker
+#define QUEUE_PER_THREAD 4
+
+static const char prompt[] = ">> ";
+
+/**
+ * A growable byte buffer. The bytes from start to length are pending; those
+ * before start have been consumed and are dropped when the buffer is
+ * compacted.
+ */
+struct buffer {
+    char *data;
+    size_t start;
+    size_t length;
+    size_t capacity;
+};
+
+struct connection {
+    int fd;
+    struct buffer in;       // received bytes not yet taken as commands
+    struct buffer out;      // response bytes not yet sent
+    bool busy;              // a command of the connection is queued or running
+    bool eof;               // the client sent everything it will send
+    bool closing;           // close once the output is sent: quit or an error
+    bool dead;              // the socket failed; free once no longer busy
+};
+
+/**
+ * A command on its way to a worker and its response on the way back.
+ */
+struct job {
+    struct connection *conn;
+    char *line;
+    char *response;
+    size_t response_length;
+    bool failed;            // the response could not be buffered
+    bool quit;
+    struct job *next;
+};
+
+struct server {
+    struct ssmap *map;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;   // a job was queued, or the server is stopping
+    struct job *queue;      // waiting for a worker, oldest first
+    struct job *queue_tail;
+    int queued;
+    int max_queued;
+    struct job *done;       // finished, waiting for the event loop
+    bool stopping;
+    int wake[2];            // pipe the workers write to when a job is done
+
+    struct connection *conns[MAX_CONNECTIONS];
+    int nr_conns;
+    int next_dispatch;      // where the next round of dispatching starts
+};
+
+// the write end of the wake pipe, for the signal handler
+static int signal_wake_fd = -1;
+static volatile sig_atomic_t stop_requested;
+
+static void
+on_signal(int signal)
+{
+    int saved = errno;
+    stop_requested = 1;
+    if (write(signal_wake_fd, "", 1) < 0) {
+        // the pipe is full, so the event loop wakes up anyway
+    }
+    errno = saved;
+}
+
+static bool
+buffer_reserve(struct buffer * b, size_t extra)
+{
+    if (b->start > 0 && b->length + extra > b->capacity) {
+        memmove(b->data, b->data + b->start, b->length - b->start);
+        b->length -= b->start;
+        b->start = 0;
+    }
+    if (b->length + extra <= b->capacity) {
+        return true;
+    }
+    size_t capacity = b->capacity > 0 ? b->capacity : 4096;
+    while (capacity < b->length + extra) {
+        capacity *= 2;
+    }
+    char *data = realloc(b->data, capacity);
+    if (!data) {
+        return false;
+    }
+    b->data = data;
+    b->capacity = capacity;
+    return true;
+}
+
+static bool
+buffer_append(struct buffer * b, const char * data, size_t size)
+{
+    if (!buffer_reserve(b, size)) {
+        return false;
+    }
+    memcpy(b->data + b->length, data, size);
+    b->length += size;
+    return true;
+}
+
+static size_t
+buffer_pending(const struct buffer * b)
+{
+    return b->length - b->start;
+}
+
+static bool
+set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+/**
+ * The stream a worker prints a response to, which keeps the first
+ * RESPONSE_LIMIT bytes in memory and drops the rest.
+ */
+struct response {
+    struct buffer kept;
+    bool overflowed;
+    bool failed;            // memory allocation failed
+};
+
+static ssize_t
+response_write(void * cookie, const char * data, size_t size)
+{
+    struct response *r = cookie;
+    if (r->overflowed || r->failed) {
+        return size;
+    }
+    if (r->kept.length + size > RESPONSE_LIMIT) {
+        r->overflowed = true;
+    } else if (!buffer_append(&r->kept, data, size)) {
+        r->failed = true;
+    }
+    return size;
+}
+
+/**
+ * Run a command on the calling worker thread, keeping its response and the
+ * prompt that follows it in memory for the event loop to send.
+ */
+static void
+run_job(struct server * s, struct job * j)
+{
+    struct response r = { { NULL, 0, 0, 0 }, false, false };
+    FILE *out = fopencookie(&r, "w", (cookie_io_functions_t){ .write = response_write });
+    if (out == NULL) {
+        j->failed = true;
+        return;
+    }
+    j->quit = !command_run(s->map, j->line, true, out);
+    fflush(out);
+    if (r.overflowed) {
+        // the client gets none of it rather than a cut off response
+        r.kept.length = 0;
+        r.overflowed = false;
+        fprintf(out, "error: the response is longer than %d MiB.\n", RESPONSE_LIMIT >> 20);
+    }
+    if (!j->quit) {
+        fputs(prompt, out);
+    }
+    fclose(out);
+    j->response = r.kept.data;
+    j->response_length = r.kept.length;
+    j->failed = r.failed;
+}
+
+static void *
+worker(void * arg)
+{
+    struct server *s = arg;
+
+    pthread_mutex_lock(&s->lock);
+    while (true) {
+        while (s->queue == NULL && !s->stopping) {
+            pthread_cond_wait(&s->ready, &s->lock);
+        }
+        if (s->stopping) {
+            break;
+        }
+        struct job *j = s->queue;
+        s->queue = j->next;
+        if (s->queue == NULL) {
+            s->queue_tail = NULL;
+        }
+        s->queued--;
+        pthread_mutex_unlock(&s->lock);
+
+        run_job(s, j);
+
+        pthread_mutex_lock(&s->lock);
+        j->next = s->done;
+        s->done = j;
+        if (write(s->wake[1], "", 1) < 0) {
+            // the pipe is full, so the event loop wakes up anyway
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void
+free_job(struct job * j)
+{
+    free(j->line);
+    free(j->response);
+    free(j);
+}
+
+static void
+free_connection(struct connection * c)
+{
+    if (c->fd != -1) {
+        close(c->fd);
+    }
+    free(c->in.data);
+    free(c->out.data);
+    free(c);
+}
+
+/**
+ * Send as much of the output of a connection as the socket takes.
+ */
+static void
+flush_connection(struct connection * c)
+{
+    while (!c->dead && buffer_pending(&c->out) > 0) {
+        ssize_t n = send(c->fd, c->out.data + c->out.start, buffer_pending(&c->out),
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                c->dead = true;
+            }
+            break;
+        }
+        c->out.start += n;
+    }
+    if (buffer_pending(&c->out) == 0) {
+        c->out.start = c->out.length = 0;
+    }
+}
+
+/**
+ * Take the responses the workers have finished and queue them for sending.
+ */
+static void
+collect_responses(struct server * s)
+{
+    char drain[256];
+    while (read(s->wake[0], drain, sizeof(drain)) > 0) {
+    }
+
+    pthread_mutex_lock(&s->lock);
+    struct job *done = s->done;
+    s->done = NULL;
+    pthread_mutex_unlock(&s->lock);
+
+    while (done != NULL) {
+        struct job *j = done;
+        struct connection *c = j->conn;
+        done = j->next;
+        c->busy = false;
+        if (!c->dead) {
+            if (j->failed || (j->response_length > 0 &&
+                              !buffer_append(&c->out, j->response, j->response_length))) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                c->closing = true;
+            }
+            if (j->quit) {
+                c->closing = true;
+            }
+            flush_connection(c);
+        }
+        free_job(j);
+    }
+}
+
+/**
+ * Queue the next command of a connection for the workers, if it has a
+ * complete one and is not held back.
+ *
+ * @return false if memory allocation fails.
+ */
+static bool
+dispatch_connection(struct server * s, struct connection * c)
+{
+    if (c->busy || c->closing || c->dead || buffer_pending(&c->out) > OUTPUT_LIMIT) {
+        return true;
+    }
+
+    char *begin = c->in.data + c->in.start;
+    size_t pending = buffer_pending(&c->in);
+    char *newline = pending > 0 ? memchr(begin, '\n', pending) : NULL;
+    size_t length;
+    if (newline != NULL) {
+        length = newline - begin + 1;
+    } else if (c->eof && pending > 0) {
+        // a last command without a newline, which the REPL accepts too
+        length = pending;
+    } else {
+        if (pending >= COMMAND_MAX_LINE) {
+            static const char error[] = "error: command too long.\n";
+            buffer_append(&c->out, error, sizeof(error) - 1);
+            c->closing = true;
+            flush_connection(c);
+        }
+        return true;
+    }
+
+    struct job *j = calloc(1, sizeof(struct job));
+    if (!j || !(j->line = malloc(length + 1))) {
+        free(j);
+        return false;
+    }
+    memcpy(j->line, begin, length);
+    j->line[length] = '\0';
+    j->conn = c;
+    c->in.start += length;
+    if (buffer_pending(&c->in) == 0) {
+        c->in.start = c->in.length = 0;
+    }
+    c->busy = true;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->queue_tail != NULL) {
+        s->queue_tail->next = j;
+    } else {
+        s->queue = j;
+    }
+    s->queue_tail = j;
+    s->queued++;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+    return true;
+}
+
+/**
+ * Hand out commands to the workers until the queue is full, taking one
+ * command per connection per round, starting after where the last call
+ * stopped so that no connection is always served first.
+ */
+static void
+dispatch(struct server * s)
+{
+    pthread_mutex_lock(&s->lock);
+    int room = s->max_queued - s->queued;
+    pthread_mutex_unlock(&s->lock);
+
+    for (int k = 0; k < s->nr_conns && room > 0; k++) {
+        int i = (s->next_dispatch + k) % s->nr_conns;
+        struct connection *c = s->conns[i];
+        bool was_busy = c->busy;
+        if (!dispatch_connection(s, c)) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            c->closing = true;
+        }
+        if (!was_busy && c->busy) {
+            room--;
+            s->next_dispatch = i + 1;
+        }
+    }
+}
+
+static void
+accept_connections(struct server * s, int listener)
+{
+    while (s->nr_conns < MAX_CONNECTIONS) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("accept");
+            }
+            return;
+        }
+        struct connection *c = calloc(1, sizeof(struct connection));
+        if (!c || !set_nonblocking(fd) || !buffer_append(&c->out, prompt, sizeof(prompt) - 1)) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            free(c);
+            close(fd);
+            continue;
+        }
+        // responses are written whole, so there is nothing to wait for
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        c->fd = fd;
+        s->conns[s->nr_conns++] = c;
+        flush_connection(c);
+    }
+}
+
+static void
+read_connection(struct connection * c)
+{
+    while (!c->eof && buffer_pending(&c->in) < COMMAND_MAX_LINE) {
+        if (!buffer_reserve(&c->in, READ_SIZE)) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            c->closing = true;
+            return;
+        }
+        ssize_t n = recv(c->fd, c->in.data + c->in.length, READ_SIZE, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                c->dead = true;
+            }
+            return;
+        }
+        if (n == 0) {
+            c->eof = true;
+            return;
+        }
+        c->in.length += n;
+    }
+}
+
+/**
+ * @return true if a connection has nothing left to do: it failed, or it is
+ * closing or out of input, and all of its output has been sent.
+ */
+static bool
+connection_finished(const struct connection * c)
+{
+    if (c->dead) {
+        return true;
+    }
+    if (c->busy || buffer_pending(&c->out) > 0) {
+        return false;
+    }
+    return c->closing || (c->eof && buffer_pending(&c->in) == 0);
+}
+
+/**
+ * Close the finished connections. One whose command is still running keeps
+ * its memory, marked dead, until the response comes back.
+ */
+static void
+reap_connections(struct server * s)
+{
+    int kept = 0;
+    for (int i = 0; i < s->nr_conns; i++) {
+        struct connection *c = s->conns[i];
+        if (!connection_finished(c)) {
+            s->conns[kept++] = c;
+            continue;
+        }
+        c->dead = true;
+        if (c->fd != -1) {
+            close(c->fd);
+            c->fd = -1;
+        }
+        if (c->busy) {
+            s->conns[kept++] = c;
+        } else {
+            free_connection(c);
+        }
+    }
+    s->nr_conns = kept;
+    if (s->next_dispatch >= kept) {
+        s->next_dispatch = 0;
+    }
+}
+
+static void
+event_loop(struct server * s, int listener)
+{
+    struct pollfd fds[MAX_CONNECTIONS + 2];
+
+    while (!stop_requested) {
+        dispatch(s);
+        // after dispatch, which may close a connection whose line is too long
+        reap_connections(s);
+
+        fds[0] = (struct pollfd){ .fd = s->wake[0], .events = POLLIN };
+        fds[1] = (struct pollfd){
+            .fd = listener,
+            .events = s->nr_conns < MAX_CONNECTIONS ? POLLIN : 0,
+        };
+        for (int i = 0; i < s->nr_conns; i++) {
+            struct connection *c = s->conns[i];
+            short events = 0;
+            if (!c->dead && !c->eof && !c->closing && buffer_pending(&c->in) < COMMAND_MAX_LINE) {
+                events |= POLLIN;
+            }
+            if (!c->dead && buffer_pending(&c->out) > 0) {
+                events |= POLLOUT;
+            }
+            // a dead connection waits for its response without its socket
+            fds[i + 2] = (struct pollfd){ .fd = c->dead ? -1 : c->fd, .events = events };
+        }
+
+        int nr_fds = s->nr_conns + 2;
+        if (poll(fds, nr_fds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        // the connections are only added and removed after their events
+        // have been handled, so they still match fds
+        int nr_polled = s->nr_conns;
+        for (int i = 0; i < nr_polled; i++) {
+            struct connection *c = s->conns[i];
+            short revents = fds[i + 2].revents;
+            if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                // the client is gone both ways, so nothing can be answered
+                c->dead = true;
+                continue;
+            }
+            if (revents & POLLIN) {
+                read_connection(c);
+            }
+            if (revents & POLLOUT) {
+                flush_connection(c);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            collect_responses(s);
+        }
+        if (fds[1].revents & POLLIN) {
+            accept_connections(s, listener);
+        }
+    }
+}
+
+/**
+ * @return A listening socket for a Unix socket path or a TCP [host:]port, or
+ * -1 after printing an error message.
+ */
+static int
+open_listener(const char * address)
+{
+    if (strchr(address, '/') != NULL) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "error: socket path %s is too long.\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+        // a socket left behind by a server that did not shut down cleanly
+        struct stat st;
+        if (stat(address, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(address);
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(fd, SOMAXCONN) != 0 || !set_nonblocking(fd)) {
+            fprintf(stderr, "error: could not listen on %s: %s\n", address, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    char host[256];
+    const char *port = strrchr(address, ':');
+    if (port == NULL) {
+        strcpy(host, "localhost");
+        port = address;
+    } else if ((size_t)(port - address) < sizeof(host)) {
+        memcpy(host, address, port - address);
+        host[port - address] = '\0';
+        port++;
+    } else {
+        fprintf(stderr, "error: host name in %s is too long.\n", address);
+        return -1;
+    }
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = AI_PASSIVE,
+    };
+    struct addrinfo *info;
+    int rc = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &info);
+    if (rc != 0) {
+        fprintf(stderr, "error: could not resolve %s: %s\n", address, gai_strerror(rc));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = info; a != NULL && fd == -1; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0 ||
+            !set_nonblocking(fd)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    if (fd == -1) {
+        fprintf(stderr, "error: could not listen on %s: %s\n", address, strerror(errno));
+    }
+    return fd;
+}
+
+bool
+server_run(struct ssmap * map, const char * address, int nr_threads)
+{
+    struct server s = {
+        .map = map,
+        .max_queued = QUEUE_PER_THREAD * nr_threads,
+        .wake = { -1, -1 },
+    };
+    pthread_t threads[nr_threads];
+    int started = 0;
+    bool ok = false;
+
+    int listener = open_listener(address);
+    if (listener < 0) {
+        return false;
+    }
+    if (pipe(s.wake) != 0 || !set_nonblocking(s.wake[0]) || !set_nonblocking(s.wake[1])) {
+        perror("pipe");
+        goto done;
+    }
+    if (pthread_mutex_init(&s.lock, NULL) != 0) {
+        goto done;
+    }
+    if (pthread_cond_init(&s.ready, NULL) != 0) {
+        pthread_mutex_destroy(&s.lock);
+        goto done;
+    }
+    while (started < nr_threads && pthread_create(&threads[started], NULL, worker, &s) == 0) {
+        started++;
+    }
+
+    if (started == nr_threads) {
+        struct sigaction action = { .sa_handler = on_signal }, old_int, old_term;
+        sigemptyset(&action.sa_mask);
+        signal_wake_fd = s.wake[1];
+        stop_requested = 0;
+        sigaction(SIGINT, &action, &old_int);
+        sigaction(SIGTERM, &action, &old_term);
+
+        printf("Listening on %s with %d threads.\n", address, nr_threads);
+        fflush(stdout);
+        event_loop(&s, listener);
+        ok = stop_requested;
+
+        sigaction(SIGINT, &old_int, NULL);
+        sigaction(SIGTERM, &old_term, NULL);
+        signal_wake_fd = -1;
+    } else {
+        fprintf(stderr, "error: could not start the worker threads.\n");
+    }
+
+    pthread_mutex_lock(&s.lock);
+    s.stopping = true;
+    pthread_cond_broadcast(&s.ready);
+    pthread_mutex_unlock(&s.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&s.ready);
+    pthread_mutex_destroy(&s.lock);
+
+    // the commands that were queued or finished but not sent are dropped
+    for (struct job *j = s.queue, *next; j != NULL; j = next) {
+        next = j->next;
+        free_job(j);
+    }
+    for (struct job *j = s.done, *next; j != NULL; j = next) {
+        next = j->next;
+        free_job(j);
+    }
+    for (int i = 0; i < s.nr_conns; i++) {
+        free_connection(s.conns[i]);
+    }
+
+done:
+    if (s.wake[0] != -1) {
+        close(s.wake[0]);
+        close(s.wake[1]);
+    }
+    close(listener);
+    if (strchr(address, '/') != NULL) {
+        unlink(address);
+    }
+    return ok;
+}
@@ -0,0 +1,38 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdbool.h>
+#include "streets.h"
+
+/**
+ * Serve the command language of the REPL to many clients at once, over a
+ * Unix or TCP socket. A session looks the same as the REPL: the server sends
+ * the ">> " prompt when a client connects and after each response, each line
+ * the client sends is one command, and quit ends the session. Clients may
+ * send several commands without waiting for the responses, which come back
+ * in order.
+ *
+ * One thread does all the socket input and output without blocking, and a
+ * pool of worker threads runs the commands on the shared map. Each
+ * connection has one command running at a time; further commands wait in
+ * its input buffer, and once that is full the server stops reading from the
+ * connection. A connection whose client does not read its responses gets no
+ * more commands run until the unsent output drains, and when the queue of
+ * the workers is full no connection gets more commands run, so a slow or
+ * flooding client is held back by the socket instead of growing buffers.
+ * A single response is collected whole before it is sent, so one that
+ * grows beyond a fixed limit is replaced by an error, and matrix commands
+ * are limited to REMOTE_MATRIX_LIMIT travel times.
+ *
+ * Runs until the process receives SIGINT or SIGTERM.
+ *
+ * @param map The map, which is only read.
+ * @param address A Unix socket path, which contains a '/', e.g. ./ssmap.sock,
+ *                or a TCP port to listen on localhost, or host:port.
+ * @param nr_threads The number of worker threads.
+ * @return true when stopped by a signal, false if the socket cannot be set
+ * up or the threads cannot be started, after printing an error message.
+ */
+bool server_run(struct ssmap * map, const char * address, int nr_threads);
+
+#endif /* _SERVER_H_ */
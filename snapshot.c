@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+bool
+snapshot_detect(const char * filename)
+{
+    char magic[8];
+    FILE * f = fopen(filename, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    bool found = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                 memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return found;
+}
+
+static uint64_t
+align_up(uint64_t offset)
+{
+    return (offset + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+}
+
+bool
+snapshot_write(const char * filename, struct snapshot_header * header,
+               const void * const data[NR_SNAPSHOT_SECTIONS])
+{
+    static const char padding[SNAPSHOT_ALIGN];
+
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->byte_order = SNAPSHOT_BYTE_ORDER;
+
+    uint64_t offset = align_up(sizeof(struct snapshot_header));
+    for (int i = 0; i < NR_SNAPSHOT_SECTIONS; i++) {
+        header->sections[i].offset = offset;
+        offset = align_up(offset + header->sections[i].length);
+    }
+
+    FILE * f = fopen(filename, "wb");
+    if (f == NULL) {
+        return false;
+    }
+
+    bool ok = fwrite(header, sizeof(struct snapshot_header), 1, f) == 1;
+    uint64_t written = sizeof(struct snapshot_header);
+    for (int i = 0; ok && i < NR_SNAPSHOT_SECTIONS; i++) {
+        uint64_t length = header->sections[i].length;
+        ok = fwrite(padding, 1, header->sections[i].offset - written, f) ==
+             header->sections[i].offset - written;
+        if (ok && length > 0) {
+            ok = fwrite(data[i], 1, length, f) == length;
+        }
+        written = header->sections[i].offset + length;
+    }
+
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+bool
+snapshot_open(struct snapshot * s, const char * filename)
+{
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    s->base = NULL;
+    s->size = 0;
+    s->header = NULL;
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    s->base = base;
+    s->size = st.st_size;
+    s->header = base;
+
+    const struct snapshot_header *h = s->header;
+    bool ok = memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) == 0 &&
+              h->version == SNAPSHOT_VERSION &&
+              h->byte_order == SNAPSHOT_BYTE_ORDER &&
+              h->nr_nodes > 0 && h->nr_ways > 0;
+    for (int i = 0; ok && i < NR_SNAPSHOT_SECTIONS; i++) {
+        uint64_t offset = h->sections[i].offset;
+        uint64_t length = h->sections[i].length;
+        ok = offset % SNAPSHOT_ALIGN == 0 && offset <= s->size && length <= s->size - offset;
+    }
+
+    if (!ok) {
+        snapshot_close(s);
+        return false;
+    }
+    return true;
+}
+
+void
+snapshot_close(struct snapshot * s)
+{
+    if (s->base != NULL) {
+        munmap(s->base, s->size);
+    }
+    s->base = NULL;
+    s->size = 0;
+    s->header = NULL;
+}
+
+const void *
+snapshot_section(const struct snapshot * s, enum snapshot_section section,
+                 size_t elem_size, size_t count)
+{
+    if (s->header->sections[section].length != (uint64_t)elem_size * count) {
+        return NULL;
+    }
+    return (const char *)s->base + s->header->sections[section].offset;
+}
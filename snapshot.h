@@ -0,0 +1,117 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * A snapshot is a binary image of a loaded map that can be opened with mmap
+ * and used in place, without parsing or copying. It starts with a header
+ * that gives the offset and length of each section; every section is a flat
+ * array aligned to SNAPSHOT_ALIGN bytes. Snapshots are only readable on
+ * machines with the byte order they were written with.
+ */
+#define SNAPSHOT_MAGIC "SSMAPBIN"
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_ALIGN 64
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+enum snapshot_section {
+    SNAP_NODE_LAT,          // int32 per node, in 1e-7 degrees
+    SNAP_NODE_LON,          // int32 per node, in 1e-7 degrees
+    SNAP_NODE_WAYS_FIRST,   // int per node + 1, offsets into SNAP_NODE_WAY_IDS
+    SNAP_NODE_WAY_IDS,      // int, way ids of all nodes concatenated
+    SNAP_WAYS,              // struct snapshot_way per way
+    SNAP_WAY_NODE_IDS,      // int, node ids of all ways concatenated
+    SNAP_NAMES,             // NUL-terminated way names concatenated
+    SNAP_FORWARD_FIRST,     // optional adjacency: the CSR arrays of
+    SNAP_FORWARD_TARGET,    // the forward and reverse graphs
+    SNAP_FORWARD_WAY,
+    SNAP_FORWARD_COST,
+    SNAP_REVERSE_FIRST,
+    SNAP_REVERSE_TARGET,
+    SNAP_REVERSE_WAY,
+    SNAP_REVERSE_COST,
+    SNAP_LOCATION_POINTS,   // the spatial index of the nodes: x, y, z
+    SNAP_LOCATION_IDS,      // doubles, node ids and split axes per tree
+    SNAP_LOCATION_SPLIT,    // entry
+    SNAP_NAME_KEYS,         // the trigram index of the way names: keys,
+    SNAP_NAME_FIRST,        // offsets of their posting lists and the
+    SNAP_NAME_IDS,          // concatenated posting lists
+    SNAP_NODE_ORDER,        // optional, int per node: the node id of each
+                            // node as numbered in the graphs
+    NR_SNAPSHOT_SECTIONS,
+};
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t nr_nodes;
+    int32_t nr_ways;
+    int32_t nr_edges;       // edges per graph, or -1 without adjacency
+    int32_t reserved;
+    struct {
+        uint64_t offset;
+        uint64_t length;    // in bytes
+    } sections[NR_SNAPSHOT_SECTIONS];
+};
+
+struct snapshot_way {
+    uint32_t name;          // offset of the name in SNAP_NAMES
+    float maxspeed;
+    uint32_t first_node;    // offset of the node ids in SNAP_WAY_NODE_IDS
+    int32_t num_nodes;
+    uint32_t oneway;
+};
+
+/**
+ * A snapshot file mapped into memory.
+ */
+struct snapshot {
+    void *base;
+    size_t size;
+    const struct snapshot_header *header;
+};
+
+/**
+ * @return true if the file starts with the snapshot magic number.
+ */
+bool snapshot_detect(const char * filename);
+
+/**
+ * Write a snapshot. The offsets in the header are filled in from the lengths,
+ * which the caller sets along with the other header fields.
+ *
+ * @param filename The file to write.
+ * @param header The header, with the section lengths set.
+ * @param data The contents of each section; may be NULL for empty sections.
+ * @return true on success, false if the file cannot be written.
+ */
+bool snapshot_write(const char * filename, struct snapshot_header * header,
+                    const void * const data[NR_SNAPSHOT_SECTIONS]);
+
+/**
+ * Map a snapshot into memory and check its header.
+ *
+ * @return true on success, false if the file cannot be mapped or is not a
+ * valid snapshot.
+ */
+bool snapshot_open(struct snapshot * s, const char * filename);
+
+/**
+ * Unmap a snapshot. Pointers into it become invalid.
+ */
+void snapshot_close(struct snapshot * s);
+
+/**
+ * Look up a section, checking that it holds exactly count elements of the
+ * given size.
+ *
+ * @return A pointer to the section, or NULL if its length does not match.
+ */
+const void * snapshot_section(const struct snapshot * s, enum snapshot_section section,
+                              size_t elem_size, size_t count);
+
+#endif /* _SNAPSHOT_H_ */
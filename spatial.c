@@ -0,0 +1,230 @@
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "spatial.h"
+#include "geo.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static void
+unit_vector(double lat, double lon, double p[3])
+{
+    double phi = lat * M_PI / 180.;
+    double lambda = lon * M_PI / 180.;
+    p[0] = cos(phi) * cos(lambda);
+    p[1] = cos(phi) * sin(lambda);
+    p[2] = sin(phi);
+}
+
+static inline double
+squared_chord(const double a[3], const double b[3])
+{
+    double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+static inline void
+swap_points(struct spatial_index * idx, int i, int j)
+{
+    double *a = &idx->points[3 * i], *b = &idx->points[3 * j];
+    for (int d = 0; d < 3; d++) {
+        double t = a[d];
+        a[d] = b[d];
+        b[d] = t;
+    }
+    int t = idx->ids[i];
+    idx->ids[i] = idx->ids[j];
+    idx->ids[j] = t;
+}
+
+/**
+ * Reorder the points in [lo, hi) so that the one at index nth is where it
+ * would be if they were sorted on the given axis, with no larger value
+ * before it and no smaller value after it.
+ */
+static void
+select_nth(struct spatial_index * idx, int lo, int hi, int nth, int axis)
+{
+    const double *p = idx->points;
+    hi--;
+    while (lo < hi) {
+        // median of three as the pivot, which also keeps sorted runs fast
+        int mid = lo + (hi - lo) / 2;
+        if (p[3 * mid + axis] < p[3 * lo + axis]) swap_points(idx, mid, lo);
+        if (p[3 * hi + axis] < p[3 * lo + axis]) swap_points(idx, hi, lo);
+        if (p[3 * hi + axis] < p[3 * mid + axis]) swap_points(idx, hi, mid);
+        double pivot = p[3 * mid + axis];
+
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (p[3 * i + axis] < pivot) i++;
+            while (p[3 * j + axis] > pivot) j--;
+            if (i <= j) {
+                swap_points(idx, i, j);
+                i++;
+                j--;
+            }
+        }
+        if (nth <= j) {
+            hi = j;
+        } else if (nth >= i) {
+            lo = i;
+        } else {
+            return;
+        }
+    }
+}
+
+/**
+ * Build the subtree over [lo, hi), whose points lie within the box from min
+ * to max. Each subtree is split on the longest side of its box, at the
+ * median point, and the box is cut in two at that point for the halves.
+ */
+static void
+build(struct spatial_index * idx, int lo, int hi, const double min[3], const double max[3])
+{
+    double box_min[3], box_max[3];
+    memcpy(box_min, min, sizeof(box_min));
+    memcpy(box_max, max, sizeof(box_max));
+
+    while (hi - lo > 1) {
+        int axis = 0;
+        for (int d = 1; d < 3; d++) {
+            if (box_max[d] - box_min[d] > box_max[axis] - box_min[axis]) {
+                axis = d;
+            }
+        }
+
+        int mid = lo + (hi - lo) / 2;
+        select_nth(idx, lo, hi, mid, axis);
+        idx->split[mid] = axis;
+        double split = idx->points[3 * mid + axis];
+
+        double left_max[3];
+        memcpy(left_max, box_max, sizeof(left_max));
+        left_max[axis] = split;
+        build(idx, lo, mid, box_min, left_max);
+        box_min[axis] = split;
+        lo = mid + 1;
+    }
+}
+
+bool
+spatial_index_build(struct spatial_index * idx, int count, const double lat[],
+                    const double lon[])
+{
+    idx->count = count;
+    idx->points = malloc(((size_t)count + 1) * 3 * sizeof(double));
+    idx->ids = malloc(((size_t)count + 1) * sizeof(int));
+    idx->split = calloc((size_t)count + 1, 1);
+    if (!idx->points || !idx->ids || !idx->split) {
+        spatial_index_free(idx);
+        return false;
+    }
+
+    double min[3] = { DBL_MAX, DBL_MAX, DBL_MAX };
+    double max[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+    for (int i = 0; i < count; i++) {
+        double *p = &idx->points[3 * i];
+        unit_vector(lat[i], lon[i], p);
+        idx->ids[i] = i;
+        for (int d = 0; d < 3; d++) {
+            min[d] = p[d] < min[d] ? p[d] : min[d];
+            max[d] = p[d] > max[d] ? p[d] : max[d];
+        }
+    }
+    build(idx, 0, count, min, max);
+    return true;
+}
+
+void
+spatial_index_free(struct spatial_index * idx)
+{
+    free(idx->points);
+    free(idx->ids);
+    free(idx->split);
+    memset(idx, 0, sizeof(struct spatial_index));
+}
+
+/**
+ * The k closest points found so far, closest first, with their squared
+ * chord lengths.
+ */
+struct nearest {
+    int k;
+    int n;
+    int *ids;
+    double *d2;
+};
+
+static inline double
+worst(const struct nearest * b)
+{
+    return b->n < b->k ? DBL_MAX : b->d2[b->n - 1];
+}
+
+static void
+consider(struct nearest * b, double d2, int id)
+{
+    if (b->n == b->k &&
+        (d2 > b->d2[b->n - 1] || (d2 == b->d2[b->n - 1] && id > b->ids[b->n - 1]))) {
+        return;
+    }
+    int i = b->n < b->k ? b->n++ : b->n - 1;
+    while (i > 0 && (b->d2[i - 1] > d2 || (b->d2[i - 1] == d2 && b->ids[i - 1] > id))) {
+        b->d2[i] = b->d2[i - 1];
+        b->ids[i] = b->ids[i - 1];
+        i--;
+    }
+    b->d2[i] = d2;
+    b->ids[i] = id;
+}
+
+static void
+search(const struct spatial_index * idx, int lo, int hi, const double q[3], struct nearest * b)
+{
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const double *p = &idx->points[3 * mid];
+        consider(b, squared_chord(p, q), idx->ids[mid]);
+
+        // descend into the side of the split holding the query first; the
+        // other side can only help if the split is closer than the worst
+        // point found so far
+        int axis = idx->split[mid];
+        double diff = q[axis] - p[axis];
+        if (diff < 0) {
+            search(idx, lo, mid, q, b);
+            lo = mid + 1;
+        } else {
+            search(idx, mid + 1, hi, q, b);
+            hi = mid;
+        }
+        if (diff * diff > worst(b)) {
+            return;
+        }
+    }
+}
+
+int
+spatial_index_nearest(const struct spatial_index * idx, double lat, double lon, int k,
+                      int ids[], double km[])
+{
+    double q[3];
+    struct nearest b = { k < idx->count ? k : idx->count, 0, ids, km };
+    if (b.k <= 0) {
+        return 0;
+    }
+
+    unit_vector(lat, lon, q);
+    search(idx, 0, idx->count, q, &b);
+    for (int i = 0; i < b.n; i++) {
+        double chord = sqrt(km[i]);
+        km[i] = 2 * EARTH_RADIUS_KM * asin(chord / 2 > 1 ? 1 : chord / 2);
+    }
+    return b.n;
+}
@@ -0,0 +1,59 @@
+#ifndef _SPATIAL_H_
+#define _SPATIAL_H_
+
+#include <stdbool.h>
+
+/**
+ * A k-d tree over points on the earth's surface. Each point is stored as a
+ * unit vector in three dimensions rather than as latitude and longitude, so
+ * the straight-line (chord) distance between two vectors grows with the
+ * great-circle distance between the points, and there is no special case
+ * around the poles or the date line.
+ *
+ * The tree is implicit: the points of a subtree occupy a range of the
+ * arrays, with the splitting point in the middle and the two halves on
+ * either side, so no child pointers are stored.
+ */
+struct spatial_index {
+    int count;
+    double *points;         // x, y, z of each point, in tree order
+    int *ids;               // the id of each point, in tree order
+    unsigned char *split;   // the axis each subtree is split on
+};
+
+/**
+ * Build the index.
+ *
+ * @param idx The index to fill in.
+ * @param count The number of points, which are identified by their index.
+ * @param lat The latitude of each point, in degrees.
+ * @param lon The longitude of each point, in degrees.
+ * @return true on success, false if memory allocation fails.
+ */
+bool spatial_index_build(struct spatial_index * idx, int count, const double lat[],
+                         const double lon[]);
+
+/**
+ * Release the memory held by an index. It is safe to call this on a
+ * zero-initialized index that was never built.
+ */
+void spatial_index_free(struct spatial_index * idx);
+
+/**
+ * Find the points closest to a location. Points at the same distance are
+ * ordered by id.
+ *
+ * @param idx The index.
+ * @param lat The latitude of the location, in degrees.
+ * @param lon The longitude of the location, in degrees.
+ * @param k The number of points to find.
+ * @param ids Receives the ids of the points found, closest first.
+ * @param km Receives the great-circle distance to each of them in
+ *           kilometres.
+ * @return The number of points found, which is k unless the index holds
+ * fewer points.
+ */
+int spatial_index_nearest(const struct spatial_index * idx, double lat, double lon, int k,
+                          int ids[], double km[]);
+
+#endif /* _SPATIAL_H_ */
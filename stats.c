@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "stats.h"
+
+static const char * const kind_names[NR_QUERY_KINDS] = {
+    "path", "path time", "find way", "find node", "nearest", "isochrone", "matrix",
+};
+
+bool
+query_log_init(struct query_log * log, const char * trace_file)
+{
+    memset(log, 0, sizeof(struct query_log));
+    if (trace_file != NULL) {
+        log->trace = fopen(trace_file, "w");
+        if (log->trace == NULL) {
+            fprintf(stderr, "error: could not open %s\n", trace_file);
+            return false;
+        }
+        // whole lines, so the trace can be followed while queries run
+        setvbuf(log->trace, NULL, _IOLBF, 0);
+    }
+    if (pthread_mutex_init(&log->lock, NULL) != 0) {
+        if (log->trace != NULL) {
+            fclose(log->trace);
+        }
+        return false;
+    }
+    return true;
+}
+
+void
+query_log_free(struct query_log * log)
+{
+    if (log->trace != NULL) {
+        fclose(log->trace);
+    }
+    pthread_mutex_destroy(&log->lock);
+    memset(log, 0, sizeof(struct query_log));
+}
+
+static int
+latency_bucket(double micros)
+{
+    int bucket = 0;
+    for (double limit = 1; bucket < STATS_BUCKETS - 1 && micros >= limit; limit *= 2) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static void
+add_counters(struct query_counters * total, const struct query_counters * c)
+{
+    total->settled += c->settled;
+    total->relaxed += c->relaxed;
+    total->pushes += c->pushes;
+    total->pops += c->pops;
+    total->decreases += c->decreases;
+    total->bytes += c->bytes;
+}
+
+static void
+write_trace(FILE * f, const struct query_record * r)
+{
+    const struct query_counters *c = &r->counters;
+    fprintf(f, "{\"query\": \"%s\"", kind_names[r->kind]);
+    if (r->method != NULL) {
+        fprintf(f, ", \"method\": \"%s\"", r->method);
+    }
+    if (r->from != -1) {
+        fprintf(f, ", \"from\": %d", r->from);
+    }
+    if (r->to != -1) {
+        fprintf(f, ", \"to\": %d", r->to);
+    }
+    fprintf(f, ", \"us\": %.1f, \"settled\": %lu, \"relaxed\": %lu, \"pushes\": %lu, "
+            "\"pops\": %lu, \"decreases\": %lu, \"bytes\": %lu}\n", r->micros, c->settled,
+            c->relaxed, c->pushes, c->pops, c->decreases, c->bytes);
+}
+
+void
+query_log_add(struct query_log * log, const struct query_record * r)
+{
+    pthread_mutex_lock(&log->lock);
+    struct query_totals *t = &log->totals[r->kind];
+    t->count++;
+    add_counters(&t->counters, &r->counters);
+    t->micros += r->micros;
+    if (r->micros > t->max_micros) {
+        t->max_micros = r->micros;
+    }
+    t->histogram[latency_bucket(r->micros)]++;
+    log->last = *r;
+    log->has_last = true;
+    if (log->trace != NULL) {
+        write_trace(log->trace, r);
+    }
+    pthread_mutex_unlock(&log->lock);
+}
+
+static void
+print_last(const struct query_record * r, FILE * out)
+{
+    const struct query_counters *c = &r->counters;
+    fprintf(out, "Last query: %s", kind_names[r->kind]);
+    if (r->method != NULL) {
+        fprintf(out, " %s", r->method);
+    }
+    if (r->from != -1) {
+        fprintf(out, " from %d", r->from);
+    }
+    if (r->to != -1) {
+        fprintf(out, " to %d", r->to);
+    }
+    fprintf(out, ", %.3f ms\n", r->micros / 1e3);
+    fprintf(out, "  %lu settled, %lu relaxed, %lu pushes, %lu pops, %lu decrease-keys, "
+            "%lu bytes allocated\n", c->settled, c->relaxed, c->pushes, c->pops, c->decreases,
+            c->bytes);
+}
+
+/**
+ * Print the histograms side by side, one column per kind of query that has
+ * been run and one row per bucket from the fastest to the slowest query.
+ */
+static void
+print_histograms(const struct query_log * log, FILE * out)
+{
+    int first = STATS_BUCKETS, last = -1;
+    for (int k = 0; k < NR_QUERY_KINDS; k++) {
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            if (log->totals[k].histogram[b] > 0) {
+                first = b < first ? b : first;
+                last = b > last ? b : last;
+            }
+        }
+    }
+    if (last == -1) {
+        return;
+    }
+
+    fprintf(out, "Latency histogram:\n%12s", "");
+    for (int k = 0; k < NR_QUERY_KINDS; k++) {
+        if (log->totals[k].count > 0) {
+            fprintf(out, " %10s", kind_names[k]);
+        }
+    }
+    fprintf(out, "\n");
+    for (int b = first; b <= last; b++) {
+        // bucket b holds the queries under 2^b microseconds
+        char label[32];
+        if (b == STATS_BUCKETS - 1) {
+            snprintf(label, sizeof(label), ">= %lu us", 1ul << (b - 1));
+        } else {
+            snprintf(label, sizeof(label), "< %lu us", 1ul << b);
+        }
+        fprintf(out, "%12s", label);
+        for (int k = 0; k < NR_QUERY_KINDS; k++) {
+            if (log->totals[k].count > 0) {
+                fprintf(out, " %10lu", log->totals[k].histogram[b]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+void
+query_log_print(struct query_log * log, FILE * out)
+{
+    pthread_mutex_lock(&log->lock);
+    if (!log->has_last) {
+        fprintf(out, "No queries yet.\n");
+        pthread_mutex_unlock(&log->lock);
+        return;
+    }
+
+    print_last(&log->last, out);
+    fprintf(out, "%-10s %8s %10s %10s %10s %12s %12s %12s %12s %12s %12s\n", "query", "count",
+            "total ms", "mean us", "max us", "settled", "relaxed", "pushes", "pops",
+            "decreases", "bytes");
+    for (int k = 0; k < NR_QUERY_KINDS; k++) {
+        const struct query_totals *t = &log->totals[k];
+        const struct query_counters *c = &t->counters;
+        if (t->count == 0) {
+            continue;
+        }
+        fprintf(out, "%-10s %8lu %10.3f %10.1f %10.1f %12lu %12lu %12lu %12lu %12lu %12lu\n",
+                kind_names[k], t->count, t->micros / 1e3, t->micros / t->count, t->max_micros,
+                c->settled, c->relaxed, c->pushes, c->pops, c->decreases, c->bytes);
+    }
+    print_histograms(log, out);
+    pthread_mutex_unlock(&log->lock);
+}
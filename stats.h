@@ -0,0 +1,106 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/**
+ * The work done by a query. The searches count it as they go whether or
+ * not statistics are enabled, since an increment costs nothing next to the
+ * memory access beside it; only reading the clock and logging the query
+ * are left out when they are disabled.
+ */
+struct query_counters {
+    unsigned long settled;      // nodes whose travel time became final
+    unsigned long relaxed;      // edges followed out of settled nodes
+    unsigned long pushes;       // heap insertions
+    unsigned long pops;         // heap removals
+    unsigned long decreases;    // heap decrease-key operations
+    unsigned long bytes;        // memory allocated for the query
+};
+
+/**
+ * The kinds of queries that are logged, one for each REPL command that
+ * searches the map.
+ */
+enum query_kind {
+    QUERY_PATH,             // path create, or a --batch query
+    QUERY_PATH_TIME,
+    QUERY_FIND_WAY,
+    QUERY_FIND_NODE,
+    QUERY_NEAREST,
+    QUERY_ISOCHRONE,
+    QUERY_MATRIX,           // one row, from a source to every target
+    NR_QUERY_KINDS,
+};
+
+/**
+ * One logged query.
+ */
+struct query_record {
+    enum query_kind kind;
+    const char *method;     // the search algorithm, or NULL
+    int from;               // the node searched from, or -1
+    int to;                 // the node searched for, or -1
+    struct query_counters counters;
+    double micros;          // wall time
+};
+
+/**
+ * The latency histogram has a bucket per power of two microseconds, the
+ * first for queries under 1 us and the last for everything from about
+ * 17 seconds up.
+ */
+#define STATS_BUCKETS 25
+
+struct query_totals {
+    unsigned long count;
+    struct query_counters counters;
+    double micros;
+    double max_micros;
+    unsigned long histogram[STATS_BUCKETS];
+};
+
+/**
+ * The queries run on a map so far: the last one, the totals and latency
+ * histogram of each kind, and optionally a trace file that gets a JSON
+ * object per query, one per line. Queries may be added from several
+ * threads at the same time.
+ */
+struct query_log {
+    pthread_mutex_t lock;
+    FILE *trace;
+    bool has_last;
+    struct query_record last;
+    struct query_totals totals[NR_QUERY_KINDS];
+};
+
+/**
+ * Start an empty log.
+ *
+ * @param log The log to initialize.
+ * @param trace_file The file to write the trace to, or NULL for none. It is
+ *                   truncated.
+ * @return true on success, false if the trace file cannot be opened, after
+ * printing an error message.
+ */
+bool query_log_init(struct query_log * log, const char * trace_file);
+
+/**
+ * Close the trace file of a log and release its resources.
+ */
+void query_log_free(struct query_log * log);
+
+/**
+ * Add a finished query to the log.
+ */
+void query_log_add(struct query_log * log, const struct query_record * r);
+
+/**
+ * Print the last query, a table of the totals of each kind of query and
+ * their latency histograms to out.
+ */
+void query_log_print(struct query_log * log, FILE * out);
+
+#endif /* _STATS_H_ */
@@ -3,7 +3,22 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include "streets.h"
+#include "graph.h"
+#include "heap.h"
+#include "ch.h"
+#include "alt.h"
+#include "snapshot.h"
+#include "nameindex.h"
+#include "spatial.h"
+#include "geo.h"
+#include "order.h"
+#include "arena.h"
+#include "stats.h"
 #define INFINITY_COST 1e308
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -16,163 +31,153 @@
 */
 
 /**
- * this is the structure that should record all the information about a node.
+ * this is the structure that should record all the information about a way.
 */
 
-struct node {
-    double lat;
-    double lon;
+struct way {
     int id;
     int osmid;
-    int num_ways;
-    int *way_ids;
+    const char *name;
+    float speed_limit;
+    bool one_way;
+    int num_nodes;
+    int *node_ids;
 };
 
 
 /**
- * this is the structure that stores priority node IDs in a priority queue.
-*/
-
-typedef struct HeapNode {
-    int node_id;     // The node identifier
-    double priority; // The node's priority
-} HeapNode;
-
-
-/**
- * this is the structure that follows minheap properties.
+ * this is the structure that should keep a list of all node and way objects
 */
 
-
-typedef struct MinHeap {
-    int size;       // Current size of the heap
-    int capacity;   // Maximum capacity of the heap
-    HeapNode *elements; // Array of heap nodes
-} MinHeap;
+struct ssmap {
+    int nr_nodes;
+    int nr_ways;
+    // The nodes are stored as arrays indexed by node id rather than as
+    // records. Coordinates are fixed point, in units of 1 / COORD_SCALE
+    // degrees.
+    int32_t *node_lat;
+    int32_t *node_lon;
+    // The ways of node i are node_way_ids[node_ways_first[i]] up to
+    // node_way_ids[node_ways_first[i + 1]]. While nodes are being added
+    // each list is appended after its length, node_ways_first[i] points at
+    // the length or is -1, and ssmap_initialize packs the lists in order.
+    int *node_ways_first;
+    int *node_way_ids;
+    size_t node_way_used;
+    size_t node_way_capacity;
+    struct way *ways;
+    // The node id arrays of the ways and their names, which are interned so
+    // that ways with the same name share it, are allocated from the arena
+    // and released all at once.
+    struct arena arena;
+    struct string_pool names;
+    struct graph forward;   // road segments in their direction of travel
+    struct graph reverse;   // the same segments flipped, for backward searches
+    float max_speed;        // highest speed limit of any way, in km/hr
+    struct contraction_hierarchy ch;    // built on demand by ssmap_prepare_ch
+    struct landmarks landmarks;         // built on demand by ssmap_prepare_alt
+    struct name_index way_names;        // trigrams of the way names, for find
+    // The nodes of each way in increasing order, the inverse of the way
+    // lists of the nodes: way i has nodes way_nodes[way_nodes_first[i]] up
+    // to way_nodes[way_nodes_first[i + 1]].
+    int *way_nodes_first;
+    int *way_nodes;
+    struct spatial_index locations;     // node coordinates, for nearest
+    // After ssmap_reorder_nodes the graphs, and everything built on them,
+    // number the nodes in a different order than the map: to_internal maps
+    // a node id to its number in the graphs and to_external maps it back.
+    // Both are NULL while the graphs use the node ids.
+    int *to_internal;
+    int *to_external;
+    // When loaded from a snapshot, names, id arrays and possibly the graphs
+    // point into the mapped file instead of owning their memory.
+    struct snapshot snapshot;
+    bool graphs_mapped;
+    bool indexes_mapped;    // the name and spatial indexes
+    // Each thread's struct workspace for searching this map. Workspaces of
+    // other threads are freed when those threads exit.
+    pthread_key_t workspace;
+    struct tree_cache *trees;   // NULL unless ssmap_enable_tree_cache was called
+    struct query_log *log;      // NULL unless ssmap_enable_stats was called
+};
 
 /**
- * The following are methods that allow for the minheap to implement a Priority Queue.
- * Used CSC263 notes for reference, and Chat-GPT.
- * https://chat.openai.com/share/748cadf8-8358-47e2-a72e-3260fabd87e2
-*/
+ * Node coordinates are kept to 1e-7 degrees, about a centimetre, which is
+ * the precision of OpenStreetMap itself and of the map files. Converting
+ * back by division gives the same double as parsing the original decimal.
+ */
+#define COORD_SCALE 1e7
 
-MinHeap *
-create_min_heap(int capacity) {
-    MinHeap *heap = (MinHeap *)malloc(sizeof(MinHeap));
-    heap->size = 0;
-    heap->capacity = capacity;
-    heap->elements = (HeapNode *)malloc(sizeof(HeapNode) * capacity);
-    return heap;
+static inline int32_t
+to_fixed(double degrees)
+{
+    return (int32_t)lround(degrees * COORD_SCALE);
 }
 
-void 
-swap_heap_nodes(HeapNode *a, HeapNode *b) {
-    HeapNode temp = *a;
-    *a = *b;
-    *b = temp;
+static inline double
+node_lat(const struct ssmap * m, int node)
+{
+    return m->node_lat[node] / COORD_SCALE;
 }
 
-void 
-min_heapify(MinHeap *heap, int idx) {
-    int smallest = idx;
-    int left = 2 * idx + 1;
-    int right = 2 * idx + 2;
-
-    if (left < heap->size && heap->elements[left].priority < heap->elements[smallest].priority)
-        smallest = left;
-
-    if (right < heap->size && heap->elements[right].priority < heap->elements[smallest].priority)
-        smallest = right;
-
-    if (smallest != idx) {
-        swap_heap_nodes(&heap->elements[idx], &heap->elements[smallest]);
-        min_heapify(heap, smallest);
-    }
+static inline double
+node_lon(const struct ssmap * m, int node)
+{
+    return m->node_lon[node] / COORD_SCALE;
 }
 
-HeapNode 
-remove_min(MinHeap *heap) {
-    if (heap->size <= 0)
-        return (HeapNode){-1, 0}; // Return a default value if heap is empty
-
-    HeapNode root = heap->elements[0];
-    heap->elements[0] = heap->elements[--heap->size];
-    min_heapify(heap, 0);
-
-    return root;
+static inline int
+node_num_ways(const struct ssmap * m, int node)
+{
+    return m->node_ways_first[node + 1] - m->node_ways_first[node];
 }
 
-void 
-decrease_key(MinHeap *heap, int node_id, double priority) {
-    // Find the node in the heap
-    int i;
-    for (i = 0; i < heap->size; i++) {
-        if (heap->elements[i].node_id == node_id) {
-            heap->elements[i].priority = priority;
-            break;
-        }
-    }
-    
-    // Move up through the heap and fix disturbed heap property
-    while (i != 0 && heap->elements[(i - 1) / 2].priority > heap->elements[i].priority) {
-        swap_heap_nodes(&heap->elements[i], &heap->elements[(i - 1) / 2]);
-        i = (i - 1) / 2;
-    }
+static inline const int *
+node_ways(const struct ssmap * m, int node)
+{
+    return m->node_way_ids + m->node_ways_first[node];
 }
 
-void 
-insert_into_heap(MinHeap *heap, int node_id, double priority) {
-    if (heap->size == heap->capacity) {
-        // Heap is full
-        return;
-    }
-
-    // Insert the new key at the end of the heap
-    int i = heap->size++;
-    heap->elements[i].node_id = node_id;
-    heap->elements[i].priority = priority;
-
-    // Fix the min heap property if it's violated
-    while (i != 0 && heap->elements[(i - 1) / 2].priority > heap->elements[i].priority) {
-        swap_heap_nodes(&heap->elements[i], &heap->elements[(i - 1) / 2]);
-        i = (i - 1) / 2;
-    }
-}
+static bool pack_node_ways(struct ssmap * m);
+static bool build_graphs(struct ssmap * m);
+static bool build_name_index(struct ssmap * m);
+static bool build_way_nodes(struct ssmap * m);
+static bool build_spatial_index(struct ssmap * m);
+static void find_max_speed(struct ssmap * m);
+static void workspace_free(void * arg);
+static void tree_cache_free(struct tree_cache * c);
+static void tree_cache_clear(struct tree_cache * c);
 
-void 
-destroy_min_heap(MinHeap *heap) {
-    free(heap->elements);
-    free(heap);
+/**
+ * @return The number of a node in the graphs.
+ */
+static inline int
+internal_id(const struct ssmap * m, int id)
+{
+    return m->to_internal ? m->to_internal[id] : id;
 }
 
-
-
 /**
- * this is the structure that should record all the information about a way.
-*/
-
-struct way {
-    int id;
-    int osmid;
-    char *name;
-    float speed_limit;
-    bool one_way;
-    int num_nodes;
-    int *node_ids;
-};
-
+ * @return The node id of a node numbered in the graphs.
+ */
+static inline int
+external_id(const struct ssmap * m, int node)
+{
+    return m->to_external ? m->to_external[node] : node;
+}
 
 /**
- * this is the structure that should keep a list of all node and way objects
-*/
-
-struct ssmap {
-    int nr_nodes;
-    int nr_ways;
-    struct node *nodes;
-    struct way *ways;
-
-};
+ * Translate node numbers from the graphs into node ids, in place.
+ */
+static void
+external_ids(const struct ssmap * m, int count, int nodes[])
+{
+    if (m->to_external) {
+        for (int i = 0; i < count; i++) {
+            nodes[i] = m->to_external[nodes[i]];
+        }
+    }
+}
 
 
 /**
@@ -194,21 +199,48 @@ ssmap_create(int nr_nodes, int nr_ways)
         // Out of memory
         return NULL;
     }
-    map->nodes = (struct node *)malloc(nr_nodes * sizeof(struct node));
-    if (!map->nodes) {
+    map->node_lat = calloc(nr_nodes, sizeof(int32_t));
+    map->node_lon = calloc(nr_nodes, sizeof(int32_t));
+    map->node_ways_first = malloc(((size_t)nr_nodes + 1) * sizeof(int));
+    // room for a length and two ways per node to start with
+    map->node_way_used = 0;
+    map->node_way_capacity = 3 * (size_t)nr_nodes;
+    map->node_way_ids = malloc(map->node_way_capacity * sizeof(int));
+    map->ways = (struct way *)calloc(nr_ways, sizeof(struct way));
+    if (!map->node_lat || !map->node_lon || !map->node_ways_first || !map->node_way_ids ||
+        !map->ways || pthread_key_create(&map->workspace, workspace_free) != 0) {
         // Out of memory, clean up space and return NULL
+        free(map->node_lat);
+        free(map->node_lon);
+        free(map->node_ways_first);
+        free(map->node_way_ids);
+        free(map->ways);
         free(map);
         return NULL;
     }
-    map->ways = (struct way *)malloc(nr_ways * sizeof(struct way));
-    if (!map->ways) {
-        // Out of memory, clean up space and return NULL
-        free(map->nodes);
-        free(map);
-        return NULL;
+    for (int i = 0; i <= nr_nodes; i++) {
+        map->node_ways_first[i] = -1;
     }
+    arena_init(&map->arena);
+    string_pool_init(&map->names, &map->arena);
     map->nr_nodes = nr_nodes;
     map->nr_ways = nr_ways;
+    memset(&map->forward, 0, sizeof(struct graph));
+    memset(&map->reverse, 0, sizeof(struct graph));
+    map->max_speed = 0;
+    memset(&map->ch, 0, sizeof(struct contraction_hierarchy));
+    memset(&map->landmarks, 0, sizeof(struct landmarks));
+    memset(&map->way_names, 0, sizeof(struct name_index));
+    map->way_nodes_first = NULL;
+    map->way_nodes = NULL;
+    memset(&map->locations, 0, sizeof(struct spatial_index));
+    map->to_internal = NULL;
+    map->to_external = NULL;
+    memset(&map->snapshot, 0, sizeof(struct snapshot));
+    map->graphs_mapped = false;
+    map->indexes_mapped = false;
+    map->trees = NULL;
+    map->log = NULL;
 
     return map;
 }
@@ -221,6 +253,20 @@ ssmap_initialize(struct ssmap * m)
         return false;
     }
 
+    if (!pack_node_ways(m)) {
+        printf("ssmap_initialize: Out of memory when packing the ways of the nodes.\n");
+        return false;
+    }
+    find_max_speed(m);
+    if (!build_graphs(m)) {
+        printf("ssmap_initialize: Out of memory when building the road graph.\n");
+        return false;
+    }
+    if (!build_name_index(m) || !build_way_nodes(m) || !build_spatial_index(m)) {
+        printf("ssmap_initialize: Out of memory when building the search indexes.\n");
+        return false;
+    }
+
     return true;
 }
 
@@ -230,15 +276,40 @@ ssmap_destroy(struct ssmap * m)
     if (m == NULL) {
         return;
     }
-    for (int i = 0; i < m->nr_ways; i++) {
-        free(m->ways[i].name);
-        free(m->ways[i].node_ids);
-    }
-    for (int i = 0; i < m->nr_nodes; i++) {
-        free(m->nodes[i].way_ids);
+    if (m->snapshot.base == NULL) {
+        free(m->node_lat);
+        free(m->node_lon);
+        free(m->node_ways_first);
+        free(m->node_way_ids);
     }
     free(m->ways);
-    free(m->nodes);
+    arena_free(&m->arena);
+    string_pool_free(&m->names);
+    if (!m->graphs_mapped) {
+        graph_free(&m->forward);
+        graph_free(&m->reverse);
+        free(m->to_external);
+    }
+    free(m->to_internal);
+    snapshot_close(&m->snapshot);
+    ch_free(&m->ch);
+    landmarks_free(&m->landmarks);
+    if (!m->indexes_mapped) {
+        name_index_free(&m->way_names);
+        spatial_index_free(&m->locations);
+    }
+    free(m->way_nodes_first);
+    free(m->way_nodes);
+    struct workspace *ws = pthread_getspecific(m->workspace);
+    if (ws != NULL) {
+        workspace_free(ws);
+    }
+    pthread_key_delete(m->workspace);
+    tree_cache_free(m->trees);
+    if (m->log != NULL) {
+        query_log_free(m->log);
+        free(m->log);
+    }
     m->nr_ways = 0;
     m->nr_nodes = 0;
     free(m);
@@ -256,7 +327,7 @@ ssmap_add_way(struct ssmap * m, int id, const char * name, float maxspeed, bool
     struct way *new_way = &(m->ways[id]);
     new_way->id = id;
     new_way->osmid = -1; // Assuming OSM ID is not used directly in this context
-    new_way->name = strdup(name); // Duplicating the name string
+    new_way->name = string_pool_intern(&m->names, name);
     if (!new_way->name) {
         printf("Out of memory when setting name for way ID: %d\n", id);
         return NULL;
@@ -266,70 +337,408 @@ ssmap_add_way(struct ssmap * m, int id, const char * name, float maxspeed, bool
     new_way->num_nodes = num_nodes;
 
     // Allocating memory for node_ids array and copy the contents
-    new_way->node_ids = (int *)malloc(num_nodes * sizeof(int));
+    new_way->node_ids = arena_alloc(&m->arena, num_nodes * sizeof(int), sizeof(int));
     if (!new_way->node_ids) {
         printf("Out of memory when allocating node IDs for way ID: %d\n", id);
-        // Freeing the previously allocated name string to avoid memory leak
-        free(new_way->name);
         return NULL;
     }
-    for (int i = 0; i < num_nodes; i++) {
-        new_way->node_ids[i] = node_ids[i];
-    }
+    memcpy(new_way->node_ids, node_ids, num_nodes * sizeof(int));
 
     return new_way;
 
 }
 
-struct node * 
+bool
 ssmap_add_node(struct ssmap * m, int id, double lat, double lon, 
                int num_ways, const int way_ids[num_ways])
 {
-    // Allocating memory for a new node structure
-    struct node *new_node = &(m->nodes[id]);
-    new_node->id = id;
-    // Assuming OSM ID is not used
-    new_node->lat = lat; // init latitude
-    new_node->lon = lon; // init longitude
-    new_node->num_ways = num_ways;
-
-    // Allocating memory for way_ids array and copy the contents
-    if (num_ways > 0) {
-        new_node->way_ids = (int *)malloc(num_ways * sizeof(int));
-        if (!new_node->way_ids) {
+    if (id < 0 || id >= m->nr_nodes || num_ways < 0 ||
+        !(fabs(lat) <= 90) || !(fabs(lon) <= 180)) {
+        return false;
+    }
+    m->node_lat[id] = to_fixed(lat);
+    m->node_lon[id] = to_fixed(lon);
+
+    // Append the way ids, after their count, to the shared array
+    size_t needed = m->node_way_used + 1 + num_ways;
+    if (needed > m->node_way_capacity) {
+        size_t capacity = 2 * m->node_way_capacity > needed ? 2 * m->node_way_capacity : needed;
+        int *grown = realloc(m->node_way_ids, capacity * sizeof(int));
+        if (!grown) {
             printf("Out of memory when allocating way IDs for node ID: %d\n", id);
-            return NULL;
+            return false;
         }
-        for (int i = 0; i < num_ways; i++) {
-            new_node->way_ids[i] = way_ids[i];
+        m->node_way_ids = grown;
+        m->node_way_capacity = capacity;
+    }
+    int *list = m->node_way_ids + m->node_way_used;
+    list[0] = num_ways;
+    memcpy(list + 1, way_ids, num_ways * sizeof(int));
+    m->node_ways_first[id] = m->node_way_used;
+    m->node_way_used = needed;
+    return true;
+}
+
+/**
+ * Lay the way lists of the nodes out in node order, without their counts,
+ * so that node_ways_first can be used as offsets. A node that was never
+ * added gets an empty list.
+ */
+static bool
+pack_node_ways(struct ssmap * m)
+{
+    int V = m->nr_nodes;
+    size_t total = 0;
+    for (int i = 0; i < V; i++) {
+        if (m->node_ways_first[i] >= 0) {
+            total += m->node_way_ids[m->node_ways_first[i]];
+        }
+    }
+    if (total >= INT_MAX) {
+        return false;
+    }
+
+    int *packed = malloc((total + 1) * sizeof(int));
+    if (!packed) {
+        return false;
+    }
+    int k = 0;
+    for (int i = 0; i < V; i++) {
+        int start = m->node_ways_first[i];
+        m->node_ways_first[i] = k;
+        if (start >= 0) {
+            int count = m->node_way_ids[start];
+            memcpy(packed + k, m->node_way_ids + start + 1, count * sizeof(int));
+            k += count;
+        }
+    }
+    m->node_ways_first[V] = k;
+    free(m->node_way_ids);
+    m->node_way_ids = packed;
+    m->node_way_used = m->node_way_capacity = total;
+    return true;
+}
+
+void
+ssmap_memory_usage(const struct ssmap * m, size_t * node_bytes, size_t * way_bytes)
+{
+    *node_bytes = m->nr_nodes * (2 * sizeof(int32_t) + sizeof(int)) + sizeof(int) +
+                  m->node_ways_first[m->nr_nodes] * sizeof(int);
+    *way_bytes = m->nr_ways * sizeof(struct way) + m->names.bytes;
+    for (int i = 0; i < m->nr_ways; i++) {
+        *way_bytes += m->ways[i].num_nodes * sizeof(int);
+        if (m->snapshot.base != NULL) {
+            *way_bytes += strlen(m->ways[i].name) + 1;  // not interned
         }
-    } else {
-        new_node->way_ids = NULL;
     }
+}
+
+/**
+ * The work done so far by the queries of the calling thread. The searches
+ * add to it whether or not statistics are enabled, and a query's share is
+ * the difference between its start and its end.
+ */
+static __thread struct query_counters work;
+
+/**
+ * @return Memory from malloc or calloc, counted as allocated by the query
+ * the calling thread is running.
+ */
+static void *
+query_malloc(size_t size)
+{
+    work.bytes += size;
+    return malloc(size);
+}
+
+static void *
+query_calloc(size_t count, size_t size)
+{
+    work.bytes += count * size;
+    return calloc(count, size);
+}
+
+/**
+ * Where a query started, for the statistics of ssmap_enable_stats.
+ */
+struct query_probe {
+    struct query_counters start;
+    struct timespec begin;
+};
+
+static inline void
+query_begin(const struct ssmap * m, struct query_probe * p)
+{
+    if (m->log != NULL) {
+        p->start = work;
+        clock_gettime(CLOCK_MONOTONIC, &p->begin);
+    }
+}
+
+/**
+ * Record a query that was started with query_begin.
+ *
+ * @param method The search algorithm, or NULL.
+ * @param from The node searched from, or -1.
+ * @param to The node searched for, or -1.
+ */
+static void
+query_end(const struct ssmap * m, const struct query_probe * p, enum query_kind kind,
+          const char * method, int from, int to)
+{
+    if (m->log == NULL) {
+        return;
+    }
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    struct query_record r = {
+        .kind = kind,
+        .method = method,
+        .from = from,
+        .to = to,
+        .counters = {
+            .settled = work.settled - p->start.settled,
+            .relaxed = work.relaxed - p->start.relaxed,
+            .pushes = work.pushes - p->start.pushes,
+            .pops = work.pops - p->start.pops,
+            .decreases = work.decreases - p->start.decreases,
+            .bytes = work.bytes - p->start.bytes,
+        },
+        .micros = (end.tv_sec - p->begin.tv_sec) * 1e6 + (end.tv_nsec - p->begin.tv_nsec) / 1e3,
+    };
+    query_log_add(m->log, &r);
+}
+
+bool
+ssmap_enable_stats(struct ssmap * m, const char * trace_file)
+{
+    if (m->log != NULL) {
+        query_log_free(m->log);
+        free(m->log);
+        m->log = NULL;
+    }
+    struct query_log *log = malloc(sizeof(struct query_log));
+    if (!log) {
+        return false;
+    }
+    if (!query_log_init(log, trace_file)) {
+        free(log);
+        return false;
+    }
+    m->log = log;
+    return true;
+}
 
-    return new_node;
+void
+ssmap_print_stats(const struct ssmap * m, FILE * out)
+{
+    if (m->log == NULL) {
+        fprintf(out, "Statistics are not being recorded; start with --stats or --trace.\n");
+        return;
+    }
+    query_log_print(m->log, out);
 }
 
 void
-ssmap_print_way(const struct ssmap * m, int id)
+ssmap_print_way(const struct ssmap * m, int id, FILE * out)
 {
     if (id < 0 || id >= m->nr_ways) {
-        printf("error: way %d does not exist.\n", id);
+        fprintf(out, "error: way %d does not exist.\n", id);
         return;
     }
-    printf("Way %d: %s\n", m->ways[id].id, m->ways[id].name);
+    fprintf(out, "Way %d: %s\n", m->ways[id].id, m->ways[id].name);
 }
 
 void
-ssmap_print_node(const struct ssmap * m, int id)
+ssmap_print_node(const struct ssmap * m, int id, FILE * out)
 {
     if (id < 0 || id >= m->nr_nodes) {
-        printf("error: node %d does not exist.\n", id);
+        fprintf(out, "error: node %d does not exist.\n", id);
         return;
     }
-    printf("Node %d: (%.7lf, %.7lf)\n", m->nodes[id].id, m->nodes[id].lat, m->nodes[id].lon);
+    fprintf(out, "Node %d: (%.7lf, %.7lf)\n", id, node_lat(m, id), node_lon(m, id));
+}
+
+
+static int
+compare_ids(const void * a, const void * b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Find the ways whose names contain a keyword, with the name index if the
+ * keyword is long enough and a scan over all names otherwise.
+ *
+ * @return A heap-allocated array of *count way ids in increasing order, or
+ * NULL if memory allocation fails.
+ */
+static int *
+matching_ways(const struct ssmap * m, const char * name, int * count)
+{
+    int *ways;
+    int nr_candidates = name_index_candidates(&m->way_names, name, &ways);
+
+    if (nr_candidates < 0) {
+        ways = query_malloc((m->nr_ways + 1) * sizeof(int));
+        if (!ways) {
+            return NULL;
+        }
+        *count = 0;
+        for (int i = 0; i < m->nr_ways; i++) {
+            if (strstr(m->ways[i].name, name) != NULL) {
+                ways[(*count)++] = i;
+            }
+        }
+        return ways;
+    }
+
+    if (!ways) {
+        ways = query_malloc(sizeof(int));
+    } else {
+        // the name index allocated the candidate list
+        work.bytes += (nr_candidates + 1) * sizeof(int);
+    }
+    *count = 0;
+    for (int i = 0; ways && i < nr_candidates; i++) {
+        if (strstr(m->ways[ways[i]].name, name) != NULL) {
+            ways[(*count)++] = ways[i];
+        }
+    }
+    return ways;
+}
+
+/**
+ * Merge the node lists of a set of ways.
+ *
+ * @return A heap-allocated array of *count distinct node ids in increasing
+ * order, or NULL if memory allocation fails.
+ */
+static int *
+nodes_of_ways(const struct ssmap * m, int nr_ways, const int ways[], int * count)
+{
+    size_t total = 0;
+    for (int i = 0; i < nr_ways; i++) {
+        total += m->way_nodes_first[ways[i] + 1] - m->way_nodes_first[ways[i]];
+    }
+
+    int *nodes = query_malloc((total + 1) * sizeof(int));
+    if (!nodes) {
+        return NULL;
+    }
+    int n = 0;
+    for (int i = 0; i < nr_ways; i++) {
+        int first = m->way_nodes_first[ways[i]];
+        int size = m->way_nodes_first[ways[i] + 1] - first;
+        memcpy(nodes + n, m->way_nodes + first, size * sizeof(int));
+        n += size;
+    }
+    if (nr_ways > 1) {
+        qsort(nodes, n, sizeof(int), compare_ids);
+    }
+
+    *count = 0;
+    for (int i = 0; i < n; i++) {
+        if (*count == 0 || nodes[i] != nodes[*count - 1]) {
+            nodes[(*count)++] = nodes[i];
+        }
+    }
+    return nodes;
+}
+
+/**
+ * @return The index of the first element of the sorted list that is not
+ * less than id, searching forward from lo by doubling steps. This is fast
+ * when a short list is intersected with a long one.
+ */
+static int
+gallop(const int list[], int lo, int size, int id)
+{
+    int step = 1;
+    int hi = lo;
+    while (hi < size && list[hi] < id) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    if (hi > size) {
+        hi = size;
+    }
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (list[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool
+contains_id(const int list[], int size, int id)
+{
+    return bsearch(&id, list, size, sizeof(int), compare_ids) != NULL;
+}
+
+/**
+ * @return true if the node lies on one way from ways1 and on a different
+ * way from ways2.
+ */
+static bool
+on_distinct_ways(const struct ssmap * m, int node, int nr_ways1, const int ways1[],
+                 int nr_ways2, const int ways2[])
+{
+    int match1 = -1, match2 = -1;
+    const int *ways = node_ways(m, node);
+    for (int j = 0; j < node_num_ways(m, node); j++) {
+        int w = ways[j];
+        bool in1 = contains_id(ways1, nr_ways1, w);
+        bool in2 = contains_id(ways2, nr_ways2, w);
+        if ((in1 && match2 != -1 && match2 != w) || (in2 && match1 != -1 && match1 != w)) {
+            return true;
+        }
+        if (in1) {
+            match1 = w;
+        }
+        if (in2) {
+            match2 = w;
+        }
+    }
+    return false;
+}
+
+int
+ssmap_nearest_nodes(const struct ssmap * m, double lat, double lon, int k, int ids[],
+                    double km[])
+{
+    return spatial_index_nearest(&m->locations, lat, lon, k, ids, km);
 }
 
+void
+ssmap_print_nearest(const struct ssmap * m, double lat, double lon, int k, FILE * out)
+{
+    if (k > m->nr_nodes) {
+        k = m->nr_nodes;
+    }
+    struct query_probe probe;
+    query_begin(m, &probe);
+    int *ids = query_malloc((k + 1) * sizeof(int));
+    double *km = query_malloc((k + 1) * sizeof(double));
+    if (!ids || !km) {
+        fprintf(stderr, "Memory allocation failed.\n");
+    } else {
+        int count = ssmap_nearest_nodes(m, lat, lon, k, ids, km);
+        for (int i = 0; i < count; i++) {
+            fprintf(out, "Node %d: (%.7lf, %.7lf) %.1f m\n", ids[i], node_lat(m, ids[i]),
+                    node_lon(m, ids[i]), km[i] * 1000);
+        }
+    }
+    free(ids);
+    free(km);
+    query_end(m, &probe, QUERY_NEAREST, NULL, -1, -1);
+}
 
 /**
  * Find all way objects with a particular keyword in its name and print them.
@@ -345,15 +754,23 @@ ssmap_print_node(const struct ssmap * m, int id)
 
 
 void 
-ssmap_find_way_by_name(const struct ssmap * m, const char * name)
+ssmap_find_way_by_name(const struct ssmap * m, const char * name, FILE * out)
 {
-    for (int i = 0; i < m->nr_ways; i++) {
-        if (strstr(m->ways[i].name, name) != NULL) {
-            printf("%d ", m->ways[i].id);
-        }
+    struct query_probe probe;
+    query_begin(m, &probe);
+    int count;
+    int *ways = matching_ways(m, name, &count);
+    if (!ways) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return;
     }
-    printf("\n");
-    
+
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%d ", m->ways[ways[i]].id);
+    }
+    fprintf(out, "\n");
+    free(ways);
+    query_end(m, &probe, QUERY_FIND_WAY, NULL, -1, -1);
 }
 
 /**
@@ -377,66 +794,84 @@ ssmap_find_way_by_name(const struct ssmap * m, const char * name)
 
 
 void 
-ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const char * name2)
+ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const char * name2,
+                         FILE * out)
 {
+    int nr_ways1 = 0, nr_ways2 = 0, nr_nodes1 = 0, nr_nodes2 = 0;
+    int *ways1 = NULL, *ways2 = NULL, *nodes1 = NULL, *nodes2 = NULL;
+    struct query_probe probe;
+    query_begin(m, &probe);
+
+    if ((ways1 = matching_ways(m, name1, &nr_ways1)) == NULL ||
+        (nodes1 = nodes_of_ways(m, nr_ways1, ways1, &nr_nodes1)) == NULL) {
+        goto failed;
+    }
+
     if (name2 == NULL) {
-        for (int i = 0; i < m->nr_nodes; i++) {
-            // Checking the way name for the keyword of every node id of
-            for (int j = 0; j < m->nodes[i].num_ways; j++) {
-                if (strstr(m->ways[m->nodes[i].way_ids[j]].name, name1) != NULL) {
-                    printf("%d ", m->nodes[i].id);
-                    break;
-                }
-            }
+        for (int i = 0; i < nr_nodes1; i++) {
+            fprintf(out, "%d ", nodes1[i]);
         }
-        printf("\n");
-    } else {
-        for (int i = 0; i < m->nr_nodes; i++) {
-            bool found1 = false;
-            bool found2 = false;
-            for (int j = 0; j < m->nodes[i].num_ways; j++) {
-                if (strstr(m->ways[m->nodes[i].way_ids[j]].name, name1) != NULL) {
-                    found1 = true;
-                }
-                if (strstr(m->ways[m->nodes[i].way_ids[j]].name, name2) != NULL) {
-                    found2 = true;
-                }
-            }
-            if (found1 && found2) {
-                printf("%d ", m->nodes[i].id);
-            }
+        fprintf(out, "\n");
+        goto done;
+    }
+
+    if ((ways2 = matching_ways(m, name2, &nr_ways2)) == NULL ||
+        (nodes2 = nodes_of_ways(m, nr_ways2, ways2, &nr_nodes2)) == NULL) {
+        goto failed;
+    }
+
+    // walk the shorter node list and gallop through the longer one
+    const int *shorter = nr_nodes1 <= nr_nodes2 ? nodes1 : nodes2;
+    const int *longer = nr_nodes1 <= nr_nodes2 ? nodes2 : nodes1;
+    int nr_shorter = nr_nodes1 <= nr_nodes2 ? nr_nodes1 : nr_nodes2;
+    int nr_longer = nr_nodes1 <= nr_nodes2 ? nr_nodes2 : nr_nodes1;
+    int pos = 0;
+    for (int i = 0; i < nr_shorter && pos < nr_longer; i++) {
+        pos = gallop(longer, pos, nr_longer, shorter[i]);
+        if (pos < nr_longer && longer[pos] == shorter[i] &&
+            on_distinct_ways(m, shorter[i], nr_ways1, ways1, nr_ways2, ways2)) {
+            fprintf(out, "%d ", shorter[i]);
         }
-        printf("\n");
     }
+    fprintf(out, "\n");
+    goto done;
+
+failed:
+    fprintf(stderr, "Memory allocation failed.\n");
+done:
+    free(ways1);
+    free(ways2);
+    free(nodes1);
+    free(nodes2);
+    query_end(m, &probe, QUERY_FIND_NODE, NULL, -1, -1);
 }
 
-/**
- * Converts from degree to radian
- *
- * @param deg The angle in degrees.
- * @return the equivalent value in radian
- */
-#define d2r(deg) ((deg) * M_PI/180.)
-
 /**
  * Calculates the distance between two nodes using the Haversine formula.
  *
+ * @param m The ssmap structure holding the nodes.
  * @param x The first node.
  * @param y the second node.
  * @return the distance between two nodes, in kilometre.
  */
-static double
-distance_between_nodes(const struct node * x, const struct node * y) {
-    double R = 6371.;       
-    double lat1 = x->lat;
-    double lon1 = x->lon;
-    double lat2 = y->lat;
-    double lon2 = y->lon;
-    double dlat = d2r(lat2-lat1); 
-    double dlon = d2r(lon2-lon1); 
-    double a = pow(sin(dlat/2), 2) + cos(d2r(lat1)) * cos(d2r(lat2)) * pow(sin(dlon/2), 2);
-    double c = 2 * atan2(sqrt(a), sqrt(1-a)); 
-    return R * c; 
+static inline double
+distance_between_nodes(const struct ssmap * m, int x, int y) {
+    return geo_distance(node_lat(m, x), node_lon(m, x), node_lat(m, y), node_lon(m, y));
+}
+
+/**
+ * Converts a distance to the time it takes at a speed limit.
+ *
+ * @param km The distance in kilometres.
+ * @param speed_limit The speed in km/h.
+ * @return the travel time in minutes.
+ */
+static inline double
+travel_minutes(double km, double speed_limit) {
+    double distance = km * 1000; // Distance in meters
+    double speed = speed_limit / 3.6; // Convert speed to m/s
+    double time_seconds = distance / speed; // Time in seconds
+    return time_seconds / 60.0; // Convert time to minutes
 }
 
 /**
@@ -445,11 +880,13 @@ distance_between_nodes(const struct node * x, const struct node * y) {
 
 int
 shared_way(const struct ssmap * m, int node1, int node2) {
-    for (int i = 0; i < m->nodes[node1].num_ways; i++) {
-        for (int j = 0; j < m->nodes[node2].num_ways; j++) {
-            if (m->nodes[node1].way_ids[i] == m->nodes[node2].way_ids[j]) {
+    const int *ways1 = node_ways(m, node1);
+    const int *ways2 = node_ways(m, node2);
+    for (int i = 0; i < node_num_ways(m, node1); i++) {
+        for (int j = 0; j < node_num_ways(m, node2); j++) {
+            if (ways1[i] == ways2[j]) {
                 // Found a common way id, return it.
-                return m->nodes[node1].way_ids[i];
+                return ways1[i];
             }
         }
     }
@@ -462,14 +899,212 @@ shared_way(const struct ssmap * m, int node1, int node2) {
  * Function to calculate travel time between two nodes in minutes
  * */ 
 double 
-calculate_travel_time(struct node node1, struct node node2, double speed_limit) {
-    struct node *a_ptr = &node1;
-    struct node *b_ptr = &node2;
-    double distance = distance_between_nodes(a_ptr, b_ptr) * 1000; // Distance in meters
+calculate_travel_time(const struct ssmap * m, int node1, int node2, double speed_limit) {
+    return travel_minutes(distance_between_nodes(m, node1, node2), speed_limit);
+}
 
-    double speed = speed_limit / 3.6; // Convert speed to m/s
-    double time_seconds = distance / speed; // Time in seconds
-    return time_seconds / 60.0; // Convert time to minutes
+
+/**
+ * Record the highest speed limit on the map, used by the A* potential.
+ */
+static void
+find_max_speed(struct ssmap * m)
+{
+    m->max_speed = 0;
+    for (int i = 0; i < m->nr_ways; i++) {
+        if (m->ways[i].speed_limit > m->max_speed) {
+            m->max_speed = m->ways[i].speed_limit;
+        }
+    }
+}
+
+/**
+ * Index the way names by trigram so that find way does not have to scan
+ * every name.
+ */
+static bool
+build_name_index(struct ssmap * m)
+{
+    const char **names = malloc(m->nr_ways * sizeof(char *));
+    if (!names) {
+        return false;
+    }
+    for (int i = 0; i < m->nr_ways; i++) {
+        names[i] = m->ways[i].name;
+    }
+    bool ok = name_index_build(&m->way_names, m->nr_ways, names);
+    free(names);
+    return ok;
+}
+
+/**
+ * Invert the way lists of the nodes into a sorted node list per way, for
+ * find node.
+ */
+static bool
+build_way_nodes(struct ssmap * m)
+{
+    int W = m->nr_ways;
+    size_t total = m->node_ways_first[m->nr_nodes];
+
+    m->way_nodes_first = calloc(W + 1, sizeof(int));
+    m->way_nodes = malloc((total + 1) * sizeof(int));
+    int *fill = malloc((W + 1) * sizeof(int));
+    if (!m->way_nodes_first || !m->way_nodes || !fill) {
+        free(fill);
+        return false;
+    }
+
+    // a node that lists the same way twice is only added to it once
+    for (int i = 0; i < m->nr_nodes; i++) {
+        const int *ways = node_ways(m, i);
+        for (int j = 0; j < node_num_ways(m, i); j++) {
+            fill[ways[j]] = -1;
+        }
+        for (int j = 0; j < node_num_ways(m, i); j++) {
+            int w = ways[j];
+            if (fill[w] != i) {
+                fill[w] = i;
+                m->way_nodes_first[w + 1]++;
+            }
+        }
+    }
+    for (int w = 0; w < W; w++) {
+        m->way_nodes_first[w + 1] += m->way_nodes_first[w];
+        fill[w] = m->way_nodes_first[w];
+    }
+    // nodes are visited in increasing order, so every list comes out sorted
+    for (int i = 0; i < m->nr_nodes; i++) {
+        const int *ways = node_ways(m, i);
+        for (int j = 0; j < node_num_ways(m, i); j++) {
+            int w = ways[j];
+            if (fill[w] == m->way_nodes_first[w] || m->way_nodes[fill[w] - 1] != i) {
+                m->way_nodes[fill[w]++] = i;
+            }
+        }
+    }
+    free(fill);
+    return true;
+}
+
+/**
+ * Index the node coordinates for nearest node lookups.
+ */
+static bool
+build_spatial_index(struct ssmap * m)
+{
+    double *lat = malloc((m->nr_nodes + 1) * sizeof(double));
+    double *lon = malloc((m->nr_nodes + 1) * sizeof(double));
+    bool ok = lat && lon;
+    if (ok) {
+        for (int i = 0; i < m->nr_nodes; i++) {
+            lat[i] = node_lat(m, i);
+            lon[i] = node_lon(m, i);
+        }
+        ok = spatial_index_build(&m->locations, m->nr_nodes, lat, lon);
+    }
+    free(lat);
+    free(lon);
+    return ok;
+}
+
+/**
+ * Build the forward and reverse CSR graphs from the ways of the map. Every
+ * pair of consecutive nodes in a way becomes an edge in its direction of
+ * travel, plus an edge going back if the way is not one-way. Travel times are
+ * computed here once so that searches never call the distance function; the
+ * segments are gathered first so that their lengths can be computed in bulk.
+ */
+static bool
+build_graphs(struct ssmap * m)
+{
+    int nr_segments = 0;
+    for (int i = 0; i < m->nr_ways; i++) {
+        if (m->ways[i].num_nodes > 1) {
+            nr_segments += m->ways[i].num_nodes - 1;
+        }
+    }
+
+    int *seg_from = malloc((nr_segments + 1) * sizeof(int));
+    int *seg_to = malloc((nr_segments + 1) * sizeof(int));
+    int *seg_way = malloc((nr_segments + 1) * sizeof(int));
+    double *km = malloc((nr_segments + 1) * sizeof(double));
+    double *lat = malloc((m->nr_nodes + 1) * sizeof(double));
+    double *lon = malloc((m->nr_nodes + 1) * sizeof(double));
+    double *cos_lat = malloc((m->nr_nodes + 1) * sizeof(double));
+    int *from = NULL, *to = NULL, *way = NULL;
+    double *cost = NULL;
+    bool ok = false;
+
+    if (!seg_from || !seg_to || !seg_way || !km || !lat || !lon || !cos_lat) {
+        goto done;
+    }
+
+    int n = 0, nr_edges = 0;
+    for (int i = 0; i < m->nr_ways; i++) {
+        const struct way *w = &m->ways[i];
+        if (w->speed_limit <= 0) {
+            continue;   // a road that cannot be driven on adds no edges
+        }
+
+        for (int j = 0; j < w->num_nodes - 1; j++) {
+            int a = w->node_ids[j];
+            int b = w->node_ids[j + 1];
+            if (a < 0 || a >= m->nr_nodes || b < 0 || b >= m->nr_nodes || a == b) {
+                continue;
+            }
+            seg_from[n] = a; seg_to[n] = b; seg_way[n] = i; n++;
+            nr_edges += w->one_way ? 1 : 2;
+        }
+    }
+
+    for (int i = 0; i < m->nr_nodes; i++) {
+        lat[i] = node_lat(m, i);
+        lon[i] = node_lon(m, i);
+        cos_lat[i] = cos(lat[i] * M_PI / 180.);
+    }
+    struct geo_points points = { lat, lon, cos_lat };
+    geo_segment_lengths(geo_best_kernel(), &points, n, seg_from, seg_to, km);
+
+    // the coordinates are no longer needed, so make room for the edges
+    free(lat);
+    free(lon);
+    free(cos_lat);
+    lat = lon = cos_lat = NULL;
+
+    from = malloc((nr_edges + 1) * sizeof(int));
+    to = malloc((nr_edges + 1) * sizeof(int));
+    way = malloc((nr_edges + 1) * sizeof(int));
+    cost = malloc((nr_edges + 1) * sizeof(double));
+    if (!from || !to || !way || !cost) {
+        goto done;
+    }
+
+    int e = 0;
+    for (int k = 0; k < n; k++) {
+        int a = seg_from[k], b = seg_to[k], i = seg_way[k];
+        double time = travel_minutes(km[k], m->ways[i].speed_limit);
+        from[e] = a; to[e] = b; way[e] = i; cost[e] = time; e++;
+        if (!m->ways[i].one_way) {
+            from[e] = b; to[e] = a; way[e] = i; cost[e] = time; e++;
+        }
+    }
+
+    ok = graph_build(&m->forward, m->nr_nodes, e, from, to, way, cost) &&
+         graph_reverse(&m->forward, &m->reverse);
+done:
+    free(seg_from);
+    free(seg_to);
+    free(seg_way);
+    free(km);
+    free(lat);
+    free(lon);
+    free(cos_lat);
+    free(from);
+    free(to);
+    free(way);
+    free(cost);
+    return ok;
 }
 
 
@@ -513,106 +1148,159 @@ calculate_travel_time(struct node node1, struct node node2, double speed_limit)
  */
 
 
+/**
+ * Mark each position of a path at which the node comes up again later in
+ * the path, with a hash set of the nodes seen so far from the end.
+ *
+ * @return true on success, false if memory allocation fails.
+ */
+static bool
+find_repeats(int size, const int node_ids[size], bool repeated[size])
+{
+    size_t capacity = 16;
+    while (capacity < 2 * (size_t)size) {
+        capacity *= 2;
+    }
+    int *slots = query_malloc(capacity * sizeof(int));
+    if (!slots) {
+        return false;
+    }
+    memset(slots, -1, capacity * sizeof(int));
+
+    for (int i = size - 1; i >= 0; i--) {
+        size_t h = ((uint32_t)node_ids[i] * 2654435761u) & (capacity - 1);
+        repeated[i] = false;
+        while (slots[h] != -1 && !repeated[i]) {
+            repeated[i] = slots[h] == node_ids[i];
+            h = (h + 1) & (capacity - 1);
+        }
+        if (!repeated[i]) {
+            slots[h] = node_ids[i];
+        }
+    }
+    free(slots);
+    return true;
+}
+
+/**
+ * Look up the road segment from one node straight to another among the
+ * edges of the forward graph, which only hold segments in their direction
+ * of travel. If more than one way has the segment, the first way the two
+ * nodes share is preferred.
+ *
+ * @return The way of the segment, or -1 if the graph has none.
+ */
+static int
+segment_way(const struct ssmap * m, int from, int to)
+{
+    const struct graph *g = &m->forward;
+    int u = internal_id(m, from), v = internal_id(m, to);
+    int first = -1, count = 0;
+    for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+        if (g->target[e] == v && count++ == 0) {
+            first = g->way[e];
+        }
+    }
+    if (count > 1) {
+        int shared = shared_way(m, from, to);
+        for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+            if (g->target[e] == v && g->way[e] == shared) {
+                return shared;
+            }
+        }
+    }
+    return first;
+}
+
+/**
+ * Check a step of a path against the first way its two nodes share, which
+ * tells apart the reasons it cannot be taken. Used for the steps that are
+ * not a segment of the graph.
+ *
+ * @return The way to take, or -1 after printing why there is none.
+ */
+static int
+checked_way(const struct ssmap * m, int current_node_id, int next_node_id, FILE * out)
+{
+    bool adjacent_in_way = false;
+
+    int way_id = shared_way(m, current_node_id, next_node_id);
+    if (way_id == -1) {
+        fprintf(out, "error: there are no roads between node %d and node %d.\n", current_node_id, next_node_id);
+        return -1;
+    }
+    const struct way *way1 = &m->ways[way_id];
+    int j = 0;
+    for (; j < way1->num_nodes - 1; j++) {
+        if (((way1->node_ids[j] == next_node_id) && (way1->node_ids[j + 1] == current_node_id)) || ((way1->node_ids[j] == current_node_id) && (way1->node_ids[j + 1] == next_node_id))) {
+            adjacent_in_way = true;
+            break;
+        }
+    }
+    if (!adjacent_in_way) {
+        fprintf(out, "error: cannot go directly from node %d to node %d.\n", current_node_id, next_node_id);
+        return -1;
+    }
+    if (way1->one_way && !(way1->node_ids[j] == current_node_id && way1->node_ids[j + 1] == next_node_id)) {
+        fprintf(out, "error: cannot go in reverse from node %d to node %d.\n", current_node_id, next_node_id);
+        return -1;
+    }
+    return way_id;
+}
+
 double 
-ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[size])
+ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[size], FILE * out)
 {
     double total_travel_time = 0.0;
-    struct node *curr_ptr;
-    struct node *next_ptr;
+    struct query_probe probe;
+    query_begin(m, &probe);
 
     // Error 1: Check for valid node IDs
     for (int i = 0; i < size; i++) {
         if (node_ids[i] < 0 || node_ids[i] >= m->nr_nodes) {
-            printf("error: node %d does not exist.\n", node_ids[i]);
-            return -1.0;
+            fprintf(out, "error: node %d does not exist.\n", node_ids[i]);
+            total_travel_time = -1.0;
+            goto done;
         }
     }
 
+    bool *repeated = query_malloc((size + 1) * sizeof(bool));
+    if (!repeated || !find_repeats(size, node_ids, repeated)) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        free(repeated);
+        total_travel_time = -1.0;
+        goto done;
+    }
 
     for (int i = 0; i < size - 1; i++) {
         int current_node_id = node_ids[i];
         int next_node_id = node_ids[i + 1];
-        curr_ptr = &m->nodes[current_node_id];
-        next_ptr = &m->nodes[next_node_id];
 
         // Error 5: Check for duplicate nodes
-        int index = i + 1;
-        while (index < size) {
-            if (node_ids[index] != current_node_id) {
-                index++;
-            } else {
-                printf("error: node %d appeared more than once.\n", current_node_id);
-                return -1.0;
-            }
+        if (repeated[i]) {
+            fprintf(out, "error: node %d appeared more than once.\n", current_node_id);
+            total_travel_time = -1.0;
+            break;
         }
 
-        // Iterate through all ways to find a connecting road
-        bool adjacent_in_way = false;
-
-        int way_id = shared_way(m, current_node_id, next_node_id);
-        if (way_id == -1) {
-            printf("error: there are no roads between node %d and node %d.\n", current_node_id, next_node_id);
-            return -1.0;
-        }
-        struct way way1 = m->ways[way_id];
-        int j = 0;
-        for (; j < way1.num_nodes - 1; j++) {
-            if (((way1.node_ids[j] == next_node_id) && (way1.node_ids[j + 1] == current_node_id)) || ((way1.node_ids[j] == current_node_id) && (way1.node_ids[j + 1] == next_node_id))) {
-                adjacent_in_way = true;
-                break;
-            }
-        }
-        if (!adjacent_in_way) {
-            printf("error: cannot go directly from node %d to node %d.\n", current_node_id, next_node_id);
-            return -1.0;
-        }
-        if (way1.one_way && !(way1.node_ids[j] == current_node_id && way1.node_ids[j + 1] == next_node_id)) {
-            printf("error: cannot go in reverse from node %d to node %d.\n", current_node_id, next_node_id);
-            return -1.0;
+        // Nearly every step of a valid path is a segment of the graph; the
+        // rest are checked against the ways to report what is wrong
+        int way_id = segment_way(m, current_node_id, next_node_id);
+        if (way_id == -1 && (way_id = checked_way(m, current_node_id, next_node_id, out)) == -1) {
+            total_travel_time = -1.0;
+            break;
         }
 
         // Calculate travel time for this segment.
-        total_travel_time += calculate_travel_time(*curr_ptr, *next_ptr, way1.speed_limit);
-    
+        total_travel_time += calculate_travel_time(m, current_node_id, next_node_id,
+                                                   m->ways[way_id].speed_limit);
     }
 
+    free(repeated);
+done:
+    query_end(m, &probe, QUERY_PATH_TIME, NULL, size > 0 ? node_ids[0] : -1,
+              size > 0 ? node_ids[size - 1] : -1);
     return total_travel_time;
-
-}
-
-
-/**
- * Function finds the neighbors or adjecent nodes of given node and
- * return all of them in a MinHeap
-*/
-
-struct MinHeap *
-find_neighbors(const struct ssmap * m, int node_id) {
-    struct node curr_node = m->nodes[node_id];
-    struct MinHeap* heap = create_min_heap(curr_node.num_ways * 2);
-    for (int i = 0; i < curr_node.num_ways; i++) {
-        struct way way1 = m->ways[curr_node.way_ids[i]];
-        if (way1.node_ids[0] == node_id) {
-            insert_into_heap(heap, way1.node_ids[1], 0.0);
-        } else if (way1.node_ids[way1.num_nodes - 1] == node_id) {
-            if (!way1.one_way){
-                insert_into_heap(heap, way1.node_ids[way1.num_nodes - 2], 0.0);
-            }
-        } else {
-            for (int j = 0; j < way1.num_nodes; j++) {
-                if (way1.node_ids[j] == node_id) {
-                    if (way1.one_way) {
-                        insert_into_heap(heap, way1.node_ids[j + 1], 0.0);
-                    }  else {
-                        insert_into_heap(heap, way1.node_ids[j - 1], 0.0);
-                        insert_into_heap(heap, way1.node_ids[j + 1], 0.0);
-                    }
-                    
-                }
-            }
-        }
-    }
-    return heap;
 }
 
 
@@ -634,97 +1322,1539 @@ find_neighbors(const struct ssmap * m, int node_id) {
  */
 
 
-void 
-ssmap_path_create(const struct ssmap * m, int start_id, int end_id)
+/**
+ * What a search knows about one node. A label is only valid while its epoch
+ * matches the epoch of the search, and any other label reads as unreached,
+ * so a search is reset by bumping its epoch instead of clearing every label.
+ */
+struct label {
+    double time;            // tentative travel time from the root
+    double potential;       // A* potential, negative until computed
+    int predecessor;
+    unsigned epoch;
+    bool visited;
+};
+
+/**
+ * The state of a single-direction search: tentative travel times, the
+ * edge tree that produced them and the nodes that are already settled.
+ */
+struct search {
+    struct heap heap;
+    struct label *labels;
+    unsigned epoch;
+    int settled;            // number of nodes taken off the queue
+    // Optional A* potential: a lower bound on the travel time from each node
+    // to the goal, added to the queue key. map is NULL for a plain Dijkstra
+    // search.
+    const struct ssmap *map;
+    int goal;
+    bool use_landmarks;     // tighten the potential with the ALT bound
+};
+
+/**
+ * The memory a query needs. Each thread allocates one the first time it
+ * searches a map and reuses it for all of its later queries on that map.
+ */
+struct workspace {
+    struct search fwd;
+    struct search bwd;
+    int *hops;              // scratch copy of a path while shortcuts are unpacked
+    int *path;              // result buffer for ssmap_path_create_with
+};
+
+static void
+search_free(struct search * s)
 {
-    int V = m->nr_nodes;
-    if (start_id < 0 || end_id >= V){
-        printf("No path found from %d to %d.\n", start_id, end_id);
-        return;
-    }
-    MinHeap* heap = create_min_heap(V);
-    double* times = malloc(V * sizeof(double));
-    int* predecessors = malloc(V * sizeof(int));
-    bool* visited = malloc(V * sizeof(bool));
+    heap_free(&s->heap);
+    free(s->labels);
+    s->labels = NULL;
+}
 
-    if (!times || !predecessors || !visited || !heap) {
-        fprintf(stderr, "Memory allocation failed.\n");
-        // Cleanup and early exit if memory allocation fails.
-        free(times); 
-        free(predecessors);
-        free(visited);
-        destroy_min_heap(heap);
-        return;
+static bool
+search_init(struct search * s, int V)
+{
+    bool heap_ok = heap_init(&s->heap, V);
+    work.bytes += (V + 1) * (sizeof(struct heap_item) + sizeof(int));
+    // no query uses epoch 0, so every label starts out stale
+    s->labels = query_calloc(V, sizeof(struct label));
+    s->epoch = 0;
+    s->settled = 0;
+    s->map = NULL;
+    s->goal = -1;
+    s->use_landmarks = false;
+
+    if (!heap_ok || !s->labels) {
+        search_free(s);
+        return false;
     }
-    times[start_id] = 0.0;
-    predecessors[start_id] = -1;
-    visited[start_id] = false;
+    return true;
+}
 
-    for (int i = 0; i < V; i++) {
-        if (i != start_id) {
-            times[i] = INFINITY_COST;
-            predecessors[i] = -1;
-            visited[i] = false;
-            insert_into_heap(heap, i, INFINITY_COST);
-        }
+/**
+ * Forget the previous query. This costs as much as the queue the previous
+ * query left behind, not the size of the map.
+ */
+static void
+search_reset(struct search * s)
+{
+    heap_clear(&s->heap);
+    if (++s->epoch == 0) {
+        // the counter wrapped around, so old labels could look current again
+        memset(s->labels, 0, s->heap.capacity * sizeof(struct label));
+        s->epoch = 1;
     }
+    s->settled = 0;
+    s->map = NULL;
+    s->goal = -1;
+    s->use_landmarks = false;
+}
 
+/**
+ * @return The label of a node, reinitialized as unreached if it was left
+ * behind by an earlier query.
+ */
+static inline struct label *
+search_label(struct search * s, int node)
+{
+    struct label *l = &s->labels[node];
+    if (l->epoch != s->epoch) {
+        l->time = INFINITY_COST;
+        l->potential = -1.0;
+        l->predecessor = -1;
+        l->epoch = s->epoch;
+        l->visited = false;
+    }
+    return l;
+}
 
-    insert_into_heap(heap, start_id, 0.0);
+/**
+ * @return The tentative travel time of a node, or INFINITY_COST if the
+ * current query has not reached it.
+ */
+static inline double
+search_time(const struct search * s, int node)
+{
+    const struct label *l = &s->labels[node];
+    return l->epoch == s->epoch ? l->time : INFINITY_COST;
+}
 
-    while (heap->size > 0) {
-        int current_node = remove_min(heap).node_id;
+/**
+ * @return true if the current query has settled the node.
+ */
+static inline bool
+search_settled(const struct search * s, int node)
+{
+    const struct label *l = &s->labels[node];
+    return l->epoch == s->epoch && l->visited;
+}
 
-        if (current_node == end_id) {
-            break; // Found the shortest path to the destination.
-        }
-        visited[current_node] = true;
+/**
+ * Turn a search into an A* search towards goal. The potential of a node is
+ * the time it takes to drive the straight-line distance to the goal at the
+ * highest speed limit on the map. No road is shorter than the straight line
+ * or faster than that limit, so the potential never overestimates and the
+ * paths found stay optimal.
+ */
+static void
+search_set_goal(struct search * s, const struct ssmap * m, int goal)
+{
+    s->map = m;
+    s->goal = goal;
+}
 
-        struct node current_map_node = m->nodes[current_node];
-        MinHeap* neighbors = find_neighbors(m, current_node);
-        while (neighbors->size > 0) {
-            int next_node = remove_min(neighbors).node_id;
-            if (visited[next_node]) continue; // Ensure forward movement.
-            int common_way = shared_way(m, current_node, next_node);
-            double time = calculate_travel_time(current_map_node, m->nodes[next_node], m->ways[common_way].speed_limit);
-            double new_time = times[current_node] + time;
-            if (new_time < times[next_node]) {
-                times[next_node] = new_time;
-                predecessors[next_node] = current_node;
-                decrease_key(heap, next_node, new_time);
+static double
+search_potential(struct search * s, struct label * l, int node)
+{
+    if (s->map == NULL) {
+        return 0.0;
+    }
+    if (l->potential < 0) {
+        const struct ssmap *m = s->map;
+        // shave off a little so rounding errors in the distance function
+        // cannot make the estimate larger than a real route
+        l->potential = 0.999999 *
+            calculate_travel_time(m, external_id(m, node), external_id(m, s->goal), m->max_speed);
+        if (s->use_landmarks) {
+            double bound = landmarks_lower_bound(&m->landmarks, node, s->goal);
+            if (bound > l->potential) {
+                l->potential = bound;
             }
         }
-        destroy_min_heap(neighbors);
     }
+    return l->potential;
+}
 
-    // Reconstruct and print the path from end_id to start_id.
-    int u = end_id;
-    int *path = (int *)malloc(V * sizeof(int));
-    if (!path) {
-        fprintf(stderr, "Memory allocation failed.\n");
-        // Cleanup and early exit if memory allocation fails.
-        free(times); 
-        free(predecessors); 
-        destroy_min_heap(heap);
-        free(visited);
-        return;
+/**
+ * Give a node a new tentative travel time, queueing it if it has not been
+ * reached before. Nodes only enter the queue once they are reached, so the
+ * cost of a query depends on the area it explores rather than the size of
+ * the map.
+ */
+static void
+search_update(struct search * s, int node, int predecessor, double time)
+{
+    struct label *l = search_label(s, node);
+    double key = time + search_potential(s, l, node);
+    l->time = time;
+    l->predecessor = predecessor;
+    if (heap_contains(&s->heap, node)) {
+        heap_decrease_key(&s->heap, node, key);
+        work.decreases++;
+    } else {
+        heap_push(&s->heap, node, key);
+        work.pushes++;
     }
+}
 
-    if ((u == start_id) || (predecessors[u] != -1)) {
-        int cc = 0;
-        while (u != -1) {
-            path[cc++] = u;
-            u = predecessors[u];
-        }
-        for (int i = cc - 1; i >= 0; i--) {
-            printf("%d ", path[i]);
+/**
+ * Settle the closest queued node and relax its edges in g.
+ *
+ * @return The node that was settled.
+ */
+static int
+search_settle_next(struct search * s, const struct graph * g)
+{
+    int current_node = heap_pop(&s->heap).id;
+    struct label *current = &s->labels[current_node];
+    current->visited = true;
+    s->settled++;
+    work.pops++;
+    work.settled++;
+    work.relaxed += g->first[current_node + 1] - g->first[current_node];
+
+    for (int e = g->first[current_node]; e < g->first[current_node + 1]; e++) {
+        int next_node = g->target[e];
+        struct label *next = search_label(s, next_node);
+        if (next->visited) continue; // Ensure forward movement.
+        double new_time = current->time + g->cost[e];
+        if (new_time < next->time) {
+            search_update(s, next_node, current_node, new_time);
         }
-        printf("\n");
-    } else {
-        printf("No path found from %d to %d.\n", start_id, end_id);
     }
-    free(visited);
-    free(times);
-    free(predecessors);
-    destroy_min_heap(heap);
-}
\ No newline at end of file
+    return current_node;
+}
+
+/**
+ * Advance a search until the travel time of node is final: until the node
+ * is settled or next in the queue, or the queue runs out. A search that is
+ * suspended this way can be advanced again later towards another node.
+ *
+ * @return true if any node had to be settled.
+ */
+static bool
+search_resume(struct search * s, const struct graph * g, int node)
+{
+    bool advanced = false;
+    while (s->heap.size > 0 && !search_settled(s, node) && s->heap.items[0].id != node) {
+        search_settle_next(s, g);
+        advanced = true;
+    }
+    return advanced;
+}
+
+static void
+workspace_free(void * arg)
+{
+    struct workspace *ws = arg;
+    search_free(&ws->fwd);
+    search_free(&ws->bwd);
+    free(ws->hops);
+    free(ws->path);
+    free(ws);
+}
+
+/**
+ * @return The workspace of the calling thread for map m, allocated on first
+ * use, or NULL if memory allocation fails.
+ */
+static struct workspace *
+get_workspace(const struct ssmap * m)
+{
+    struct workspace *ws = pthread_getspecific(m->workspace);
+    if (ws != NULL) {
+        return ws;
+    }
+
+    int V = m->nr_nodes;
+    ws = query_calloc(1, sizeof(struct workspace));
+    if (!ws) {
+        return NULL;
+    }
+    bool fwd_ok = search_init(&ws->fwd, V);
+    bool bwd_ok = search_init(&ws->bwd, V);
+    ws->hops = query_malloc(V * sizeof(int));
+    ws->path = query_malloc(V * sizeof(int));
+    if (!fwd_ok || !bwd_ok || !ws->hops || !ws->path ||
+        pthread_setspecific(m->workspace, ws) != 0) {
+        workspace_free(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+/**
+ * Write the chain of predecessors ending at node into path, starting from
+ * the root of the search.
+ *
+ * @return The number of nodes written.
+ */
+static int
+unwind_predecessors(const struct search * s, int node, int path[])
+{
+    int cc = 0;
+    for (int u = node; u != -1; u = s->labels[u].predecessor) {
+        path[cc++] = u;
+    }
+    for (int i = 0, j = cc - 1; i < j; i++, j--) {
+        int tmp = path[i];
+        path[i] = path[j];
+        path[j] = tmp;
+    }
+    return cc;
+}
+
+/**
+ * Dijkstra search from start_id that stops once end_id is settled. If
+ * goal_directed is set, the search is an A* search guided by the straight-line
+ * distance to end_id, which settles the same path but explores far fewer
+ * nodes away from the destination. If use_landmarks is set as well, the
+ * landmark bounds tighten the guidance further.
+ *
+ * @return The number of nodes written to path, or 0 if end_id is unreachable.
+ */
+static int
+dijkstra(const struct ssmap * m, struct workspace * ws, int start_id, int end_id,
+         bool goal_directed, bool use_landmarks, int path[], int * settled)
+{
+    struct search *s = &ws->fwd;
+    search_reset(s);
+    if (goal_directed) {
+        search_set_goal(s, m, end_id);
+        s->use_landmarks = use_landmarks;
+    }
+
+    search_update(s, start_id, -1, 0.0);
+    search_resume(s, &m->forward, end_id);
+
+    int cc = 0;
+    if (search_time(s, end_id) < INFINITY_COST) {
+        cc = unwind_predecessors(s, end_id, path);
+    }
+    *settled = s->settled;
+    return cc;
+}
+
+/**
+ * Bidirectional Dijkstra search. One search grows forward from start_id over
+ * the forward graph while another grows backward from end_id over the
+ * reverse graph, always advancing the side with the smaller queue minimum.
+ * Every time a node is reached by both searches, the route through it is a
+ * candidate. The searches stop once the two queue minimums add up to at least
+ * the best candidate, since no undiscovered route can be shorter.
+ *
+ * @return The number of nodes written to path, or 0 if end_id is unreachable.
+ */
+static int
+bidirectional_dijkstra(const struct ssmap * m, struct workspace * ws, int start_id, int end_id,
+                       int path[], int * settled)
+{
+    struct search *fwd = &ws->fwd, *bwd = &ws->bwd;
+    search_reset(fwd);
+    search_reset(bwd);
+
+    double best = INFINITY_COST;
+    int meeting_node = -1;
+
+    search_update(fwd, start_id, -1, 0.0);
+    search_update(bwd, end_id, -1, 0.0);
+    if (start_id == end_id) {
+        best = 0.0;
+        meeting_node = start_id;
+    }
+
+    while (fwd->heap.size > 0 && bwd->heap.size > 0) {
+        if (heap_min_key(&fwd->heap) + heap_min_key(&bwd->heap) >= best) {
+            break;
+        }
+
+        bool forward = heap_min_key(&fwd->heap) <= heap_min_key(&bwd->heap);
+        struct search *s = forward ? fwd : bwd;
+        struct search *other = forward ? bwd : fwd;
+        const struct graph *g = forward ? &m->forward : &m->reverse;
+
+        int u = search_settle_next(s, g);
+        for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+            int v = g->target[e];
+            double through = search_time(s, v) + search_time(other, v);
+            if (through < best) {
+                best = through;
+                meeting_node = v;
+            }
+        }
+    }
+
+    int cc = 0;
+    if (meeting_node != -1) {
+        cc = unwind_predecessors(fwd, meeting_node, path);
+        // the backward predecessors lead from the meeting node to end_id
+        for (int u = bwd->labels[meeting_node].predecessor; u != -1;
+             u = bwd->labels[u].predecessor) {
+            path[cc++] = u;
+        }
+    }
+    *settled = fwd->settled + bwd->settled;
+    return cc;
+}
+
+/**
+ * Contraction hierarchy search. Like the bidirectional search, but both sides
+ * only follow edges towards higher ranked nodes, and each side keeps going
+ * until its own queue minimum reaches the best meeting cost, since the
+ * two sides no longer explore the same graph. Shortcuts on the resulting
+ * path are then unpacked into the road segments they stand for.
+ *
+ * @return The number of nodes written to path, 0 if end_id is unreachable or
+ * -1 if the unpacked path does not fit in path.
+ */
+static int
+ch_dijkstra(const struct ssmap * m, struct workspace * ws, int start_id, int end_id,
+            int path[], int * settled)
+{
+    const struct contraction_hierarchy *ch = &m->ch;
+    struct search *fwd = &ws->fwd, *bwd = &ws->bwd;
+    search_reset(fwd);
+    search_reset(bwd);
+
+    double best = INFINITY_COST;
+    int meeting_node = -1;
+
+    search_update(fwd, start_id, -1, 0.0);
+    search_update(bwd, end_id, -1, 0.0);
+    if (start_id == end_id) {
+        best = 0.0;
+        meeting_node = start_id;
+    }
+
+    while (true) {
+        bool fwd_open = fwd->heap.size > 0 && heap_min_key(&fwd->heap) < best;
+        bool bwd_open = bwd->heap.size > 0 && heap_min_key(&bwd->heap) < best;
+        if (!fwd_open && !bwd_open) {
+            break;
+        }
+
+        bool forward = fwd_open &&
+            (!bwd_open || heap_min_key(&fwd->heap) <= heap_min_key(&bwd->heap));
+        struct search *s = forward ? fwd : bwd;
+        struct search *other = forward ? bwd : fwd;
+        const struct graph *g = forward ? &ch->upward : &ch->downward;
+
+        int u = search_settle_next(s, g);
+        for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+            int v = g->target[e];
+            double through = search_time(s, v) + search_time(other, v);
+            if (through < best) {
+                best = through;
+                meeting_node = v;
+            }
+        }
+    }
+
+    int cc = 0;
+    if (meeting_node != -1) {
+        // the predecessors are hierarchy edges that may be shortcuts, so
+        // collect them aside and unpack them one at a time
+        int *hops = ws->hops;
+        int up = unwind_predecessors(fwd, meeting_node, hops);
+        int V = m->nr_nodes;
+        bool fits = true;
+
+        path[0] = hops[0];
+        cc = 1;
+        for (int i = 0; fits && i + 1 < up; i++) {
+            fits = ch_unpack(ch, hops[i], hops[i + 1], path, &cc, V);
+        }
+        for (int u = meeting_node; fits && bwd->labels[u].predecessor != -1;
+             u = bwd->labels[u].predecessor) {
+            fits = ch_unpack(ch, u, bwd->labels[u].predecessor, path, &cc, V);
+        }
+        if (!fits) {
+            cc = -1;
+        }
+    }
+    *settled = fwd->settled + bwd->settled;
+    return cc;
+}
+
+/**
+ * The names of the search algorithms, indexed by enum ssmap_algorithm.
+ */
+static const char * const algorithm_names[] = {
+    [SSMAP_DIJKSTRA] = "dijkstra",
+    [SSMAP_BIDIRECTIONAL] = "bidir",
+    [SSMAP_ASTAR] = "astar",
+    [SSMAP_CH] = "ch",
+    [SSMAP_ALT] = "alt",
+};
+
+#define NR_ALGORITHMS ((int)(sizeof(algorithm_names) / sizeof(algorithm_names[0])))
+
+bool
+ssmap_algorithm_by_name(const char * name, enum ssmap_algorithm * algorithm)
+{
+    for (int i = 0; i < NR_ALGORITHMS; i++) {
+        if (strcmp(name, algorithm_names[i]) == 0) {
+            *algorithm = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+ssmap_algorithm_available(const struct ssmap * m, enum ssmap_algorithm algorithm)
+{
+    switch (algorithm) {
+    case SSMAP_CH:
+        return m->ch.rank != NULL;
+    case SSMAP_ALT:
+        return m->landmarks.count > 0;
+    default:
+        return true;
+    }
+}
+
+bool
+ssmap_prepare_ch(struct ssmap * m)
+{
+    struct timespec begin, end;
+
+    ch_free(&m->ch);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if (!ch_build(&m->ch, &m->forward)) {
+        printf("ssmap_prepare_ch: Out of memory when building the contraction hierarchy.\n");
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double millis = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+    printf("Contraction hierarchy built in %.1f ms: %d shortcuts added to %d road segments.\n",
+           millis, m->ch.nr_shortcuts, m->forward.nr_edges);
+    return true;
+}
+
+bool
+ssmap_prepare_alt(struct ssmap * m, int count)
+{
+    struct timespec begin, end;
+
+    landmarks_free(&m->landmarks);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if (!landmarks_build(&m->landmarks, &m->forward, &m->reverse, count)) {
+        printf("ssmap_prepare_alt: Could not build %d landmarks.\n", count);
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double millis = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+    double kb = 2.0 * m->landmarks.count * m->nr_nodes * sizeof(float) / 1024;
+    printf("%d landmarks selected in %.1f ms, %.1f KB of distance tables.\n",
+           m->landmarks.count, millis, kb);
+    return true;
+}
+
+/**
+ * The names of the node orders, indexed by enum ssmap_node_order.
+ */
+static const char * const order_names[] = {
+    [SSMAP_ORDER_HILBERT] = "hilbert",
+    [SSMAP_ORDER_BFS] = "bfs",
+};
+
+#define NR_ORDERS ((int)(sizeof(order_names) / sizeof(order_names[0])))
+
+bool
+ssmap_node_order_by_name(const char * name, enum ssmap_node_order * order)
+{
+    for (int i = 0; i < NR_ORDERS; i++) {
+        if (strcmp(name, order_names[i]) == 0) {
+            *order = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Compute the order of the nodes, as numbered in the graphs, that a
+ * renumbering should put them in.
+ */
+static bool
+compute_node_order(const struct ssmap * m, enum ssmap_node_order order, int nodes[])
+{
+    if (order == SSMAP_ORDER_BFS) {
+        return order_bfs(&m->forward, &m->reverse, nodes);
+    }
+
+    int V = m->nr_nodes;
+    double *lat = malloc((V + 1) * sizeof(double));
+    double *lon = malloc((V + 1) * sizeof(double));
+    bool ok = lat && lon;
+    if (ok) {
+        for (int i = 0; i < V; i++) {
+            lat[i] = node_lat(m, external_id(m, i));
+            lon[i] = node_lon(m, external_id(m, i));
+        }
+        ok = order_hilbert(V, lat, lon, nodes);
+    }
+    free(lat);
+    free(lon);
+    return ok;
+}
+
+bool
+ssmap_reorder_nodes(struct ssmap * m, enum ssmap_node_order order)
+{
+    struct timespec begin, end;
+
+    if (m->ch.rank != NULL || m->landmarks.count > 0) {
+        printf("ssmap_reorder_nodes: The nodes must be reordered before the contraction "
+               "hierarchy and landmarks are built.\n");
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    int V = m->nr_nodes;
+    int *nodes = malloc((V + 1) * sizeof(int));
+    int *new_id = malloc((V + 1) * sizeof(int));
+    int *to_internal = malloc((V + 1) * sizeof(int));
+    struct graph forward, reverse;
+    memset(&forward, 0, sizeof(struct graph));
+    memset(&reverse, 0, sizeof(struct graph));
+
+    bool ok = nodes && new_id && to_internal && compute_node_order(m, order, nodes);
+    if (ok) {
+        for (int k = 0; k < V; k++) {
+            new_id[nodes[k]] = k;
+        }
+        ok = graph_permute(&m->forward, new_id, &forward) &&
+             graph_permute(&m->reverse, new_id, &reverse);
+    }
+    if (!ok) {
+        printf("ssmap_reorder_nodes: Out of memory when reordering the nodes.\n");
+        graph_free(&forward);
+        graph_free(&reverse);
+        free(nodes);
+        free(new_id);
+        free(to_internal);
+        return false;
+    }
+
+    // nodes becomes the new to_external, composed with the old numbering
+    for (int k = 0; k < V; k++) {
+        nodes[k] = external_id(m, nodes[k]);
+        to_internal[nodes[k]] = k;
+    }
+    if (!m->graphs_mapped) {
+        graph_free(&m->forward);
+        graph_free(&m->reverse);
+        free(m->to_external);
+    }
+    free(m->to_internal);
+    m->forward = forward;
+    m->reverse = reverse;
+    m->graphs_mapped = false;
+    m->to_external = nodes;
+    m->to_internal = to_internal;
+    free(new_id);
+    if (m->trees != NULL) {
+        // the cached trees are numbered the old way
+        tree_cache_clear(m->trees);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double millis = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+    printf("Nodes reordered by %s in %.1f ms.\n", order_names[order], millis);
+    return true;
+}
+
+/**
+ * A shortest-path tree kept after its query has returned, with the Dijkstra
+ * search that grew it suspended where it stopped.
+ */
+struct cached_tree {
+    struct search search;
+    int source;                 // root of the tree, or -1 if the slot is free
+    unsigned long last_used;    // when a query last took the tree
+    bool busy;                  // a query is using the tree
+};
+
+/**
+ * The trees of the sources queried most recently. The lock guards the slots
+ * and counters only: a query marks the tree it takes busy and searches it
+ * without holding the lock, so queries from different sources do not wait
+ * for each other.
+ */
+struct tree_cache {
+    pthread_mutex_t lock;
+    int capacity;
+    struct cached_tree *trees;
+    unsigned long clock;
+    struct ssmap_cache_stats stats;
+};
+
+/**
+ * How a query was answered by the tree cache, for the counters.
+ */
+enum tree_outcome {
+    TREE_HIT,               // the tree already held the answer
+    TREE_RESUMED,           // the tree had to be grown further
+    TREE_MISS,              // a new tree was started
+};
+
+static void
+tree_cache_free(struct tree_cache * c)
+{
+    if (c == NULL) {
+        return;
+    }
+    for (int i = 0; i < c->capacity; i++) {
+        search_free(&c->trees[i].search);
+    }
+    free(c->trees);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+/**
+ * Drop every tree, keeping the memory of the slots for new ones.
+ */
+static void
+tree_cache_clear(struct tree_cache * c)
+{
+    for (int i = 0; i < c->capacity; i++) {
+        c->trees[i].source = -1;
+        c->trees[i].last_used = 0;
+    }
+}
+
+bool
+ssmap_enable_tree_cache(struct ssmap * m, int capacity)
+{
+    if (capacity < 0) {
+        return false;
+    }
+    tree_cache_free(m->trees);
+    m->trees = NULL;
+    if (capacity == 0) {
+        return true;
+    }
+
+    struct tree_cache *c = calloc(1, sizeof(struct tree_cache));
+    if (!c) {
+        return false;
+    }
+    // the searches are allocated when their slots are first used
+    c->trees = calloc(capacity, sizeof(struct cached_tree));
+    if (!c->trees || pthread_mutex_init(&c->lock, NULL) != 0) {
+        free(c->trees);
+        free(c);
+        return false;
+    }
+    c->capacity = capacity;
+    tree_cache_clear(c);
+    m->trees = c;
+    return true;
+}
+
+void
+ssmap_cache_stats(const struct ssmap * m, struct ssmap_cache_stats * stats)
+{
+    struct tree_cache *c = m->trees;
+    memset(stats, 0, sizeof(struct ssmap_cache_stats));
+    if (c == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    *stats = c->stats;
+    stats->capacity = c->capacity;
+    stats->trees = 0;
+    for (int i = 0; i < c->capacity; i++) {
+        if (c->trees[i].source != -1) {
+            stats->trees++;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/**
+ * Take the tree of source for a query. If there is none, the least recently
+ * used tree that is not busy is dropped and its slot starts a new search
+ * from source instead. The slot is given to source and marked busy while the
+ * lock is held, so that concurrent queries from source do not start a second
+ * tree, and the new search is set up after releasing it, since that can take
+ * time in the size of the map.
+ *
+ * @param fresh Set to whether a new tree was started.
+ * @return The tree, or NULL if the tree of source or every slot is busy, or
+ * memory allocation fails; the query then runs without the cache and is
+ * counted as a miss.
+ */
+static struct cached_tree *
+tree_cache_acquire(const struct ssmap * m, int source, bool * fresh)
+{
+    struct tree_cache *c = m->trees;
+    struct cached_tree *t = NULL;
+    int victim = -1;
+    *fresh = false;
+
+    pthread_mutex_lock(&c->lock);
+    for (int i = 0; i < c->capacity; i++) {
+        struct cached_tree *u = &c->trees[i];
+        if (u->source == source) {
+            t = u->busy ? NULL : u;
+            victim = -1;
+            break;
+        }
+        if (!u->busy && (victim == -1 || u->last_used < c->trees[victim].last_used)) {
+            victim = i;
+        }
+    }
+    if (victim != -1) {
+        t = &c->trees[victim];
+        t->source = source;
+        *fresh = true;
+    }
+    if (t != NULL) {
+        t->busy = true;
+        t->last_used = ++c->clock;
+    } else {
+        c->stats.misses++;
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (t == NULL || !*fresh) {
+        return t;
+    }
+
+    // only a slot that never held a tree has a search to allocate
+    if (t->search.labels == NULL && !search_init(&t->search, m->nr_nodes)) {
+        pthread_mutex_lock(&c->lock);
+        t->source = -1;
+        t->busy = false;
+        c->stats.misses++;
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
+    }
+    search_reset(&t->search);
+    search_update(&t->search, source, -1, 0.0);
+    return t;
+}
+
+/**
+ * Hand a tree taken by tree_cache_acquire back to the cache.
+ */
+static void
+tree_cache_release(const struct ssmap * m, struct cached_tree * t, enum tree_outcome outcome)
+{
+    struct tree_cache *c = m->trees;
+    pthread_mutex_lock(&c->lock);
+    t->busy = false;
+    switch (outcome) {
+    case TREE_HIT:
+        c->stats.hits++;
+        break;
+    case TREE_RESUMED:
+        c->stats.resumed++;
+        break;
+    case TREE_MISS:
+        c->stats.misses++;
+        break;
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/**
+ * Dijkstra search from start_id on the cached tree of start_id, which only
+ * has to be grown further if end_id is not settled in it yet. The path is
+ * the same one dijkstra finds, since the tree is grown in the same order.
+ *
+ * @return The number of nodes written to path, 0 if end_id is unreachable or
+ * -1 if the cache cannot take the query.
+ */
+static int
+cached_dijkstra(const struct ssmap * m, int start_id, int end_id, int path[], int * settled)
+{
+    bool fresh;
+    struct cached_tree *t = tree_cache_acquire(m, start_id, &fresh);
+    if (!t) {
+        return -1;
+    }
+
+    struct search *s = &t->search;
+    int before = s->settled;
+    bool advanced = search_resume(s, &m->forward, end_id);
+    int cc = 0;
+    if (search_time(s, end_id) < INFINITY_COST) {
+        cc = unwind_predecessors(s, end_id, path);
+    }
+    *settled = s->settled - before;
+    tree_cache_release(m, t, fresh ? TREE_MISS : advanced ? TREE_RESUMED : TREE_HIT);
+    return cc;
+}
+
+/**
+ * Run one of the search algorithms.
+ *
+ * @return The number of nodes written to path, 0 if end_id is unreachable or
+ * -1 if memory allocation fails.
+ */
+static int
+find_path(const struct ssmap * m, int start_id, int end_id, enum ssmap_algorithm algorithm,
+          int path[], int * settled)
+{
+    struct workspace *ws = get_workspace(m);
+    if (!ws) {
+        return -1;
+    }
+
+    switch (algorithm) {
+    case SSMAP_BIDIRECTIONAL:
+        return bidirectional_dijkstra(m, ws, start_id, end_id, path, settled);
+    case SSMAP_ASTAR:
+        return dijkstra(m, ws, start_id, end_id, true, false, path, settled);
+    case SSMAP_ALT:
+        return dijkstra(m, ws, start_id, end_id, true, true, path, settled);
+    case SSMAP_CH:
+        return ch_dijkstra(m, ws, start_id, end_id, path, settled);
+    case SSMAP_DIJKSTRA:
+    default:
+        return dijkstra(m, ws, start_id, end_id, false, false, path, settled);
+    }
+}
+
+/**
+ * Sum the travel times of the edges along a path produced by find_path.
+ */
+static double
+path_minutes(const struct ssmap * m, int cc, const int path[cc])
+{
+    const struct graph *g = &m->forward;
+    double total = 0.0;
+    for (int i = 0; i + 1 < cc; i++) {
+        double best = INFINITY_COST;
+        for (int e = g->first[path[i]]; e < g->first[path[i] + 1]; e++) {
+            if (g->target[e] == path[i + 1] && g->cost[e] < best) {
+                best = g->cost[e];
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+int
+ssmap_path_find(const struct ssmap * m, int start_id, int end_id,
+                enum ssmap_algorithm algorithm, int path[], double * minutes)
+{
+    int V = m->nr_nodes;
+    if (start_id < 0 || start_id >= V || end_id < 0 || end_id >= V) {
+        return 0;
+    }
+    if (!ssmap_algorithm_available(m, algorithm)) {
+        return -1;
+    }
+
+    struct query_probe probe;
+    query_begin(m, &probe);
+    int settled;
+    int start = internal_id(m, start_id), end = internal_id(m, end_id);
+    int cc = -1;
+    if (algorithm == SSMAP_DIJKSTRA && m->trees != NULL) {
+        cc = cached_dijkstra(m, start, end, path, &settled);
+    }
+    if (cc < 0) {
+        cc = find_path(m, start, end, algorithm, path, &settled);
+    }
+    if (cc > 0 && minutes != NULL) {
+        *minutes = path_minutes(m, cc, path);
+    }
+    external_ids(m, cc, path);
+    query_end(m, &probe, QUERY_PATH, algorithm_names[algorithm], start_id, end_id);
+    return cc;
+}
+
+void
+ssmap_path_create_with(const struct ssmap * m, int start_id, int end_id,
+                       enum ssmap_algorithm algorithm, FILE * out)
+{
+    int V = m->nr_nodes;
+    if (start_id < 0 || start_id >= V || end_id < 0 || end_id >= V) {
+        fprintf(out, "No path found from %d to %d.\n", start_id, end_id);
+        return;
+    }
+
+    if (!ssmap_algorithm_available(m, algorithm)) {
+        fprintf(out, "error: the %s search needs preprocessing that has not been done.\n",
+                algorithm_names[algorithm]);
+        return;
+    }
+
+    struct workspace *ws = get_workspace(m);
+    if (!ws) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return;
+    }
+    int *path = ws->path;
+
+    int cc = ssmap_path_find(m, start_id, end_id, algorithm, path, NULL);
+    if (cc < 0) {
+        fprintf(stderr, "Memory allocation failed.\n");
+    } else if (cc > 0) {
+        for (int i = 0; i < cc; i++) {
+            fprintf(out, "%d ", path[i]);
+        }
+        fprintf(out, "\n");
+    } else {
+        fprintf(out, "No path found from %d to %d.\n", start_id, end_id);
+    }
+}
+
+bool
+ssmap_travel_times(const struct ssmap * m, int source, int nr_targets, const int targets[],
+                   double minutes[])
+{
+    struct query_probe probe;
+    query_begin(m, &probe);
+    int root = internal_id(m, source);
+    bool fresh = false;
+    struct cached_tree *t = m->trees != NULL ? tree_cache_acquire(m, root, &fresh) : NULL;
+    struct search *s;
+    if (t != NULL) {
+        s = &t->search;
+    } else {
+        struct workspace *ws = get_workspace(m);
+        if (!ws) {
+            return false;
+        }
+        s = &ws->fwd;
+        search_reset(s);
+        search_update(s, root, -1, 0.0);
+    }
+
+    // the search only grows as far as the farthest target, and the times of
+    // the targets it passed on the way stay final
+    bool advanced = false;
+    for (int i = 0; i < nr_targets; i++) {
+        int target = internal_id(m, targets[i]);
+        advanced |= search_resume(s, &m->forward, target);
+        double time = search_time(s, target);
+        minutes[i] = time < INFINITY_COST ? time : -1.0;
+    }
+
+    if (t != NULL) {
+        tree_cache_release(m, t, fresh ? TREE_MISS : advanced ? TREE_RESUMED : TREE_HIT);
+    }
+    query_end(m, &probe, QUERY_MATRIX, "dijkstra", source, -1);
+    return true;
+}
+
+/**
+ * Settle every node that can be reached from source within budget minutes.
+ * The search stops as soon as the closest queued node is over budget, so it
+ * only explores the reachable area and its immediate frontier.
+ *
+ * @return The number of nodes written to nodes, in order of travel time.
+ */
+static int
+bounded_search(const struct ssmap * m, struct search * s, int source, double budget,
+               int nodes[])
+{
+    int count = 0;
+    search_reset(s);
+    search_update(s, source, -1, 0.0);
+    while (s->heap.size > 0 && heap_min_key(&s->heap) <= budget) {
+        nodes[count++] = search_settle_next(s, &m->forward);
+    }
+    return count;
+}
+
+int
+ssmap_isochrone(const struct ssmap * m, int source, double budget, int nodes[],
+                double minutes[])
+{
+    if (source < 0 || source >= m->nr_nodes) {
+        return -1;
+    }
+
+    struct query_probe probe;
+    query_begin(m, &probe);
+    struct workspace *ws = get_workspace(m);
+    if (!ws) {
+        return -1;
+    }
+
+    int count = bounded_search(m, &ws->fwd, internal_id(m, source), budget, nodes);
+    if (minutes != NULL) {
+        for (int i = 0; i < count; i++) {
+            minutes[i] = search_time(&ws->fwd, nodes[i]);
+        }
+    }
+    external_ids(m, count, nodes);
+    query_end(m, &probe, QUERY_ISOCHRONE, NULL, source, -1);
+    return count;
+}
+
+void
+ssmap_print_isochrone(const struct ssmap * m, int source, double budget, bool edges,
+                      FILE * out)
+{
+    if (source < 0 || source >= m->nr_nodes) {
+        fprintf(out, "error: node %d does not exist.\n", source);
+        return;
+    }
+
+    struct query_probe probe;
+    query_begin(m, &probe);
+    struct workspace *ws = get_workspace(m);
+    if (!ws) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return;
+    }
+    struct search *s = &ws->fwd;
+    int count = bounded_search(m, s, internal_id(m, source), budget, ws->path);
+
+    fprintf(out, "%d nodes reachable from %d within %.4f minutes:\n", count, source, budget);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%d ", external_id(m, ws->path[i]));
+    }
+    fprintf(out, "\n");
+
+    if (edges) {
+        // the road segments that leave the reachable area
+        const struct graph *g = &m->forward;
+        fprintf(out, "boundary edges:\n");
+        for (int i = 0; i < count; i++) {
+            int u = ws->path[i];
+            for (int e = g->first[u]; e < g->first[u + 1]; e++) {
+                int v = g->target[e];
+                if (!search_settled(s, v)) {
+                    fprintf(out, "%d %d\n", external_id(m, u), external_id(m, v));
+                }
+            }
+        }
+    }
+    query_end(m, &probe, QUERY_ISOCHRONE, NULL, source, -1);
+}
+
+void
+ssmap_path_compare(const struct ssmap * m, int start_id, int end_id, FILE * out)
+{
+    int V = m->nr_nodes;
+    if (start_id < 0 || start_id >= V || end_id < 0 || end_id >= V) {
+        fprintf(out, "No path found from %d to %d.\n", start_id, end_id);
+        return;
+    }
+
+    struct workspace *ws = get_workspace(m);
+    if (!ws) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return;
+    }
+    int *path = ws->path;
+
+    double baseline = 0.0;
+    for (int i = 0; i < NR_ALGORITHMS; i++) {
+        struct timespec begin, end;
+        int settled;
+
+        if (!ssmap_algorithm_available(m, i)) {
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        int cc = find_path(m, internal_id(m, start_id), internal_id(m, end_id), i, path,
+                           &settled);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (cc < 0) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            break;
+        }
+        double millis = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+        if (i == SSMAP_DIJKSTRA) {
+            baseline = millis;
+        }
+        fprintf(out, "%-10s %8d nodes settled %10.3f ms ", algorithm_names[i], settled, millis);
+        // no speedup without both timings, e.g. below the clock resolution
+        if (baseline > 0 && millis > 0) {
+            fprintf(out, "(%6.1fx)  ", baseline / millis);
+        } else {
+            fprintf(out, "(%7s)  ", "-");
+        }
+        if (cc > 0) {
+            fprintf(out, "%.4f minutes, %d nodes\n", path_minutes(m, cc, path), cc);
+        } else {
+            fprintf(out, "no path\n");
+        }
+    }
+}
+
+void 
+ssmap_path_create(const struct ssmap * m, int start_id, int end_id, FILE * out)
+{
+    ssmap_path_create_with(m, start_id, end_id, SSMAP_DIJKSTRA, out);
+}
+
+int
+ssmap_nr_nodes(const struct ssmap * m)
+{
+    return m->nr_nodes;
+}
+
+int
+ssmap_nr_ways(const struct ssmap * m)
+{
+    return m->nr_ways;
+}
+
+const char *
+ssmap_way_name(const struct ssmap * m, int id)
+{
+    return id >= 0 && id < m->nr_ways ? m->ways[id].name : NULL;
+}
+
+bool
+ssmap_write_snapshot(const struct ssmap * m, const char * filename, bool with_graphs)
+{
+    int V = m->nr_nodes;
+    int W = m->nr_ways;
+    size_t nr_node_way_ids = m->node_ways_first[V], nr_way_node_ids = 0, name_bytes = 0;
+
+    for (int i = 0; i < W; i++) {
+        nr_way_node_ids += m->ways[i].num_nodes;
+        name_bytes += strlen(m->ways[i].name) + 1;
+    }
+
+    struct snapshot_way *ways = malloc(W * sizeof(struct snapshot_way));
+    int *way_node_ids = malloc((nr_way_node_ids + 1) * sizeof(int));
+    char *names = malloc(name_bytes + 1);
+    bool ok = false;
+
+    if (!ways || !way_node_ids || !names) {
+        printf("ssmap_write_snapshot: Out of memory.\n");
+        goto done;
+    }
+
+    // the node arrays are written as they are
+    size_t name_offset = 0, k = 0;
+    for (int i = 0; i < W; i++) {
+        const struct way *w = &m->ways[i];
+        size_t length = strlen(w->name) + 1;
+        ways[i] = (struct snapshot_way){
+            .name = name_offset,
+            .maxspeed = w->speed_limit,
+            .first_node = k,
+            .num_nodes = w->num_nodes,
+            .oneway = w->one_way,
+        };
+        memcpy(names + name_offset, w->name, length);
+        name_offset += length;
+        memcpy(way_node_ids + k, w->node_ids, w->num_nodes * sizeof(int));
+        k += w->num_nodes;
+    }
+
+    struct snapshot_header header;
+    const void *data[NR_SNAPSHOT_SECTIONS] = {
+        [SNAP_NODE_LAT] = m->node_lat,
+        [SNAP_NODE_LON] = m->node_lon,
+        [SNAP_NODE_WAYS_FIRST] = m->node_ways_first,
+        [SNAP_NODE_WAY_IDS] = m->node_way_ids,
+        [SNAP_WAYS] = ways,
+        [SNAP_WAY_NODE_IDS] = way_node_ids,
+        [SNAP_NAMES] = names,
+    };
+    memset(&header, 0, sizeof(header));
+    header.nr_nodes = V;
+    header.nr_ways = W;
+    header.nr_edges = -1;
+    header.sections[SNAP_NODE_LAT].length = V * sizeof(int32_t);
+    header.sections[SNAP_NODE_LON].length = V * sizeof(int32_t);
+    header.sections[SNAP_NODE_WAYS_FIRST].length = (V + 1) * sizeof(int);
+    header.sections[SNAP_NODE_WAY_IDS].length = nr_node_way_ids * sizeof(int);
+    header.sections[SNAP_WAYS].length = W * sizeof(struct snapshot_way);
+    header.sections[SNAP_WAY_NODE_IDS].length = nr_way_node_ids * sizeof(int);
+    header.sections[SNAP_NAMES].length = name_bytes;
+
+    const struct spatial_index *loc = &m->locations;
+    const struct name_index *idx = &m->way_names;
+    data[SNAP_LOCATION_POINTS] = loc->points;
+    data[SNAP_LOCATION_IDS] = loc->ids;
+    data[SNAP_LOCATION_SPLIT] = loc->split;
+    data[SNAP_NAME_KEYS] = idx->keys;
+    data[SNAP_NAME_FIRST] = idx->first;
+    data[SNAP_NAME_IDS] = idx->ids;
+    header.sections[SNAP_LOCATION_POINTS].length = 3 * V * sizeof(double);
+    header.sections[SNAP_LOCATION_IDS].length = V * sizeof(int);
+    header.sections[SNAP_LOCATION_SPLIT].length = V;
+    header.sections[SNAP_NAME_KEYS].length = idx->nr_keys * sizeof(uint32_t);
+    header.sections[SNAP_NAME_FIRST].length = (idx->nr_keys + 1) * sizeof(int);
+    header.sections[SNAP_NAME_IDS].length = idx->first[idx->nr_keys] * sizeof(int);
+
+    if (with_graphs) {
+        const struct graph *graphs[2] = { &m->forward, &m->reverse };
+        for (int i = 0; i < 2; i++) {
+            const struct graph *g = graphs[i];
+            int base = i == 0 ? SNAP_FORWARD_FIRST : SNAP_REVERSE_FIRST;
+            data[base] = g->first;
+            data[base + 1] = g->target;
+            data[base + 2] = g->way;
+            data[base + 3] = g->cost;
+            header.sections[base].length = (V + 1) * sizeof(int);
+            header.sections[base + 1].length = g->nr_edges * sizeof(int);
+            header.sections[base + 2].length = g->nr_edges * sizeof(int);
+            header.sections[base + 3].length = g->nr_edges * sizeof(double);
+        }
+        header.nr_edges = m->forward.nr_edges;
+        // the graphs number the nodes in this order
+        if (m->to_external != NULL) {
+            data[SNAP_NODE_ORDER] = m->to_external;
+            header.sections[SNAP_NODE_ORDER].length = V * sizeof(int);
+        }
+    }
+
+    ok = snapshot_write(filename, &header, data);
+    if (!ok) {
+        printf("ssmap_write_snapshot: Could not write %s.\n", filename);
+    }
+done:
+    free(ways);
+    free(way_node_ids);
+    free(names);
+    return ok;
+}
+
+/**
+ * Point a graph at CSR arrays inside a snapshot, checking that every offset,
+ * target and way is in range and every cost is a finite, non-negative time,
+ * so that searches and path times cannot run off the arrays.
+ */
+static bool
+map_graph(struct graph * g, const struct snapshot * snap, int base, int V, int E, int W)
+{
+    g->nr_nodes = V;
+    g->nr_edges = E;
+    g->first = (int *)snapshot_section(snap, base, sizeof(int), V + 1);
+    g->target = (int *)snapshot_section(snap, base + 1, sizeof(int), E);
+    g->way = (int *)snapshot_section(snap, base + 2, sizeof(int), E);
+    g->cost = (double *)snapshot_section(snap, base + 3, sizeof(double), E);
+    if (!g->first || (E > 0 && (!g->target || !g->way || !g->cost))) {
+        return false;
+    }
+    if (g->first[0] != 0 || g->first[V] != E) {
+        return false;
+    }
+    for (int u = 0; u < V; u++) {
+        if (g->first[u] > g->first[u + 1]) {
+            return false;
+        }
+    }
+    for (int e = 0; e < E; e++) {
+        if (g->target[e] < 0 || g->target[e] >= V || g->way[e] < 0 || g->way[e] >= W ||
+            !isfinite(g->cost[e]) || g->cost[e] < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Use the node order of the graphs in the snapshot, checking that it is a
+ * permutation of the node ids.
+ */
+static bool
+map_node_order(struct ssmap * m)
+{
+    int V = m->nr_nodes;
+    const int *order = snapshot_section(&m->snapshot, SNAP_NODE_ORDER, sizeof(int), V);
+    if (!order) {
+        return false;
+    }
+    m->to_internal = malloc((V + 1) * sizeof(int));
+    if (!m->to_internal) {
+        return false;
+    }
+    for (int i = 0; i < V; i++) {
+        m->to_internal[i] = -1;
+    }
+    for (int k = 0; k < V; k++) {
+        if (order[k] < 0 || order[k] >= V || m->to_internal[order[k]] != -1) {
+            return false;
+        }
+        m->to_internal[order[k]] = k;
+    }
+    m->to_external = (int *)order;
+    return true;
+}
+
+/**
+ * Point the name and spatial indexes into the snapshot, checking that they
+ * cannot lead a lookup outside the maps arrays.
+ */
+static bool
+map_indexes(struct ssmap * m)
+{
+    const struct snapshot *snap = &m->snapshot;
+    const struct snapshot_header *h = snap->header;
+    int V = m->nr_nodes;
+    int W = m->nr_ways;
+
+    struct spatial_index *loc = &m->locations;
+    loc->count = V;
+    loc->points = (double *)snapshot_section(snap, SNAP_LOCATION_POINTS, 3 * sizeof(double), V);
+    loc->ids = (int *)snapshot_section(snap, SNAP_LOCATION_IDS, sizeof(int), V);
+    loc->split = (unsigned char *)snapshot_section(snap, SNAP_LOCATION_SPLIT, 1, V);
+    if (!loc->points || !loc->ids || !loc->split) {
+        return false;
+    }
+    for (int i = 0; i < V; i++) {
+        if (loc->ids[i] < 0 || loc->ids[i] >= V || loc->split[i] > 2) {
+            return false;
+        }
+    }
+
+    struct name_index *idx = &m->way_names;
+    size_t nr_keys = h->sections[SNAP_NAME_KEYS].length / sizeof(uint32_t);
+    size_t nr_ids = h->sections[SNAP_NAME_IDS].length / sizeof(int);
+    if (nr_keys >= INT_MAX || nr_ids >= INT_MAX) {
+        return false;
+    }
+    idx->nr_keys = nr_keys;
+    idx->keys = (uint32_t *)snapshot_section(snap, SNAP_NAME_KEYS, sizeof(uint32_t), nr_keys);
+    idx->first = (int *)snapshot_section(snap, SNAP_NAME_FIRST, sizeof(int), nr_keys + 1);
+    idx->ids = (int *)snapshot_section(snap, SNAP_NAME_IDS, sizeof(int), nr_ids);
+    if (!idx->keys || !idx->first || (nr_ids > 0 && !idx->ids)) {
+        return false;
+    }
+    if (idx->first[0] != 0 || idx->first[nr_keys] != (int)nr_ids) {
+        return false;
+    }
+    for (size_t i = 0; i < nr_keys; i++) {
+        if (idx->first[i] > idx->first[i + 1] || (i > 0 && idx->keys[i - 1] >= idx->keys[i])) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < nr_ids; i++) {
+        if (idx->ids[i] < 0 || idx->ids[i] >= W) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct ssmap *
+ssmap_load_snapshot(const char * filename)
+{
+    struct snapshot snap;
+    if (!snapshot_open(&snap, filename)) {
+        return NULL;
+    }
+
+    const struct snapshot_header *h = snap.header;
+    int V = h->nr_nodes;
+    int W = h->nr_ways;
+    size_t nr_node_way_ids = h->sections[SNAP_NODE_WAY_IDS].length / sizeof(int);
+    size_t nr_way_node_ids = h->sections[SNAP_WAY_NODE_IDS].length / sizeof(int);
+    size_t name_bytes = h->sections[SNAP_NAMES].length;
+
+    const int32_t *lat = snapshot_section(&snap, SNAP_NODE_LAT, sizeof(int32_t), V);
+    const int32_t *lon = snapshot_section(&snap, SNAP_NODE_LON, sizeof(int32_t), V);
+    const int *node_ways_first = snapshot_section(&snap, SNAP_NODE_WAYS_FIRST, sizeof(int), V + 1);
+    const int *node_way_ids = snapshot_section(&snap, SNAP_NODE_WAY_IDS, sizeof(int), nr_node_way_ids);
+    const struct snapshot_way *ways = snapshot_section(&snap, SNAP_WAYS, sizeof(struct snapshot_way), W);
+    const int *way_node_ids = snapshot_section(&snap, SNAP_WAY_NODE_IDS, sizeof(int), nr_way_node_ids);
+    const char *names = snapshot_section(&snap, SNAP_NAMES, 1, name_bytes);
+
+    if (!lat || !lon || !node_ways_first || !node_way_ids || !ways || !way_node_ids ||
+        !names || name_bytes == 0 || names[name_bytes - 1] != '\0') {
+        snapshot_close(&snap);
+        return NULL;
+    }
+
+    struct ssmap *m = ssmap_create(V, W);
+    if (m == NULL) {
+        snapshot_close(&snap);
+        return NULL;
+    }
+    // from here on ssmap_destroy unmaps the snapshot
+    m->snapshot = snap;
+
+    // The node arrays are used straight from the mapped file, as are the
+    // id arrays and names of the ways, whose records are filled in place.
+    free(m->node_lat);
+    free(m->node_lon);
+    free(m->node_ways_first);
+    free(m->node_way_ids);
+    m->node_lat = (int32_t *)lat;
+    m->node_lon = (int32_t *)lon;
+    m->node_ways_first = (int *)node_ways_first;
+    m->node_way_ids = (int *)node_way_ids;
+    m->node_way_used = m->node_way_capacity = nr_node_way_ids;
+    if (node_ways_first[0] != 0 || (size_t)node_ways_first[V] != nr_node_way_ids) {
+        goto invalid;
+    }
+    for (int i = 0; i < V; i++) {
+        if (node_ways_first[i] > node_ways_first[i + 1] ||
+            lat[i] < -90 * COORD_SCALE || lat[i] > 90 * COORD_SCALE ||
+            lon[i] < -180 * COORD_SCALE || lon[i] > 180 * COORD_SCALE) {
+            goto invalid;
+        }
+    }
+    for (size_t j = 0; j < nr_node_way_ids; j++) {
+        if (node_way_ids[j] < 0 || node_way_ids[j] >= W) {
+            goto invalid;
+        }
+    }
+    for (int i = 0; i < W; i++) {
+        const struct snapshot_way *sw = &ways[i];
+        if (sw->name >= name_bytes || sw->num_nodes <= 0 ||
+            sw->first_node > nr_way_node_ids || sw->num_nodes > nr_way_node_ids - sw->first_node) {
+            goto invalid;
+        }
+        struct way *w = &m->ways[i];
+        w->id = i;
+        w->osmid = -1;
+        w->name = names + sw->name;
+        w->speed_limit = sw->maxspeed;
+        w->one_way = sw->oneway != 0;
+        w->num_nodes = sw->num_nodes;
+        w->node_ids = (int *)way_node_ids + sw->first_node;
+        for (int j = 0; j < w->num_nodes; j++) {
+            if (w->node_ids[j] < 0 || w->node_ids[j] >= V) {
+                goto invalid;
+            }
+        }
+    }
+
+    find_max_speed(m);
+    if (h->nr_edges >= 0) {
+        m->graphs_mapped = true;
+        if (!map_graph(&m->forward, &m->snapshot, SNAP_FORWARD_FIRST, V, h->nr_edges, W) ||
+            !map_graph(&m->reverse, &m->snapshot, SNAP_REVERSE_FIRST, V, h->nr_edges, W)) {
+            goto invalid;
+        }
+        if (h->sections[SNAP_NODE_ORDER].length > 0 && !map_node_order(m)) {
+            goto invalid;
+        }
+    } else if (!build_graphs(m)) {
+        goto invalid;
+    }
+    m->indexes_mapped = true;
+    if (!map_indexes(m) || !build_way_nodes(m)) {
+        goto invalid;
+    }
+    return m;
+
+invalid:
+    ssmap_destroy(m);
+    return NULL;
+}
@@ -7,7 +7,6 @@
 #define INVALID_ID (-1)
 
 struct ssmap;
-struct node;
 struct way;
 struct path;
 
@@ -20,6 +19,50 @@ struct path;
  */
 struct ssmap * ssmap_create(int nr_nodes, int nr_ways);
 
+/**
+ * Open a map snapshot written by ssmap_write_snapshot. The file is mapped
+ * into memory and its arrays are used in place: the node coordinates and
+ * way lists, the node lists and names of the ways, the name and spatial
+ * indexes and, if the snapshot has them, the road graphs. Nothing is parsed,
+ * but every offset and id in them is checked in one pass over the arrays,
+ * O(V + E + W), so that a corrupt file cannot make queries read outside
+ * them. The small per-way records and the sorted node list of each way used
+ * by find node are rebuilt in memory, as are the graphs if the snapshot has
+ * none. The map is then ready for queries without ssmap_initialize.
+ *
+ * @param filename The snapshot file.
+ * @return A heap-allocated ssmap structure, or NULL if the file cannot be
+ * mapped or is not a valid snapshot.
+ */
+struct ssmap * ssmap_load_snapshot(const char * filename);
+
+/**
+ * Write a map to a binary snapshot that ssmap_load_snapshot can open.
+ *
+ * @param m An ssmap structure that has been initialized.
+ * @param filename The file to write.
+ * @param with_graphs Whether to include the road graphs, which makes the file
+ *                    larger but saves building them when it is opened.
+ * @return true on success, false otherwise.
+ */
+bool ssmap_write_snapshot(const struct ssmap * m, const char * filename, bool with_graphs);
+
+/**
+ * @return The number of nodes in the map.
+ */
+int ssmap_nr_nodes(const struct ssmap * m);
+
+/**
+ * @return The number of ways in the map.
+ */
+int ssmap_nr_ways(const struct ssmap * m);
+
+/**
+ * @return The name of a way, or NULL if the way id is invalid. The name
+ * belongs to the map.
+ */
+const char * ssmap_way_name(const struct ssmap * m, int id);
+
 /**
  * Perform any other initialization after ways and nodes have been added.
  *
@@ -55,7 +98,9 @@ struct way * ssmap_add_way(struct ssmap * m, int id, const char * name,
                            const int node_ids[num_nodes]);
 
 /**
- * Add a new node object to the ssmap data structure.
+ * Add a new node object to the ssmap data structure. Nodes are not stored
+ * as records: the coordinates are kept to 1e-7 degrees in arrays indexed by
+ * node id, and the way ids of all nodes share one array.
  *
  * @param m The ssmap structure for which the node object should be added.
  * @param id The id of the node object.
@@ -63,10 +108,21 @@ struct way * ssmap_add_way(struct ssmap * m, int id, const char * name,
  * @param lon The longitude of this node.
  * @param num_ways The number of ways associated with this node object.
  * @param way_ids An array of way ids assocaited with this node object.
- * @return The node object that was just added. 
+ * @return true on success, false if the id or coordinates are out of range
+ * or memory allocation fails.
+ */
+bool ssmap_add_node(struct ssmap * m, int id, double lat, double lon, 
+                    int num_ways, const int way_ids[num_ways]);
+
+/**
+ * Measure the memory that holds the nodes and ways of a map, including the
+ * id lists and names but not the graphs and indexes built from them.
+ *
+ * @param m An ssmap structure that has been initialized.
+ * @param node_bytes Receives the bytes used by the nodes.
+ * @param way_bytes Receives the bytes used by the ways.
  */
-struct node * ssmap_add_node(struct ssmap * m, int id, double lat, double lon, 
-                             int num_ways, const int way_ids[num_ways]);
+void ssmap_memory_usage(const struct ssmap * m, size_t * node_bytes, size_t * way_bytes);
 
 /**
  * Find a way object by id, then print its information
@@ -80,8 +136,9 @@ struct node * ssmap_add_node(struct ssmap * m, int id, double lat, double lon,
  * <id> does not exist."
  * @param m The ssmap structure where the way object should be located.
  * @param id The id of the way object to be printed.
+ * @param out Where to print it.
  */
-void ssmap_print_way(const struct ssmap * m, int id);
+void ssmap_print_way(const struct ssmap * m, int id, FILE * out);
 
 /**
  * Find a node object by id, then print its information
@@ -95,8 +152,39 @@ void ssmap_print_way(const struct ssmap * m, int id);
  * <id> does not exist."
  * @param m The ssmap structure where the node object should be located.
  * @param id The id of the node object to be printed.
+ * @param out Where to print it.
+ */
+void ssmap_print_node(const struct ssmap * m, int id, FILE * out);
+
+/**
+ * Find the nodes closest to a location, by great-circle distance. The nodes
+ * are kept in a k-d tree, so this takes logarithmic time for small k.
+ *
+ * @param m The ssmap structure.
+ * @param lat The latitude of the location, in degrees.
+ * @param lon The longitude of the location, in degrees.
+ * @param k The number of nodes to find.
+ * @param ids Receives the node ids, closest first. Nodes at the same
+ *            distance are ordered by id.
+ * @param km Receives the distance to each node, in kilometres.
+ * @return The number of nodes found, which is k unless the map has fewer
+ * nodes.
+ */
+int ssmap_nearest_nodes(const struct ssmap * m, double lat, double lon, int k, int ids[],
+                        double km[]);
+
+/**
+ * Print the k nodes closest to a location, closest first, in the format of
+ * ssmap_print_node followed by the distance in metres, e.g.
+ * Node 12: (43.6616957, -79.3947648) 15.2 m
+ *
+ * @param m The ssmap structure.
+ * @param lat The latitude of the location, in degrees.
+ * @param lon The longitude of the location, in degrees.
+ * @param k The number of nodes to print.
+ * @param out Where to print them.
  */
-void ssmap_print_node(const struct ssmap * m, int id);
+void ssmap_print_nearest(const struct ssmap * m, double lat, double lon, int k, FILE * out);
 
 /**
  * Find all way objects with a particular keyword in its name and print them.
@@ -108,8 +196,9 @@ void ssmap_print_node(const struct ssmap * m, int id);
  * 
  * @param m The ssmap structure where the way objects should be located.
  * @param name The keyword that should be used to search for way objects.
+ * @param out Where to print the way ids.
  */
-void ssmap_find_way_by_name(const struct ssmap * m, const char * name);
+void ssmap_find_way_by_name(const struct ssmap * m, const char * name, FILE * out);
 
 /**
  * Find all node objects that are associated with way objects that have the 
@@ -128,8 +217,10 @@ void ssmap_find_way_by_name(const struct ssmap * m, const char * name);
  * @param name2 The second keyword that should be used to search for a node.
  *              This parameter is allowed to NULL. In which case, the function
  *              displays all nodes with ways that have name1 in their names.
+ * @param out Where to print the node ids.
  */
-void ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const char * name2);
+void ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const char * name2,
+                              FILE * out);
 
 /**
  * Calculate the travel time of a path (an ordered array of node ids)
@@ -163,13 +254,14 @@ void ssmap_find_node_by_names(const struct ssmap * m, const char * name1, const
  * another. E.g., suppose the path is [a, b, c, d], it means the travelers starts
  * from node a, goes to node b, c, and finaly node d in that order. For each 
  * adjacent set of nodes, there must be a valid way object that connects them.
+ * @param out Where to print errors.
  * @return the total travel time of a path in MINUTES, which can be calculated as 
  * the sum of the distance between each node divided by the speed limit of each 
  * segment. E.g., suppose the path is [a, b, c] and way x and y connects a and b,
  * b and c, respectively. Then the travel time would be distance(a, b) / maxspeed(x)
  * + distance(b, c) / maxspeed(y). Hint: use the distance function provided.
  */
-double ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[size]);
+double ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[size], FILE * out);
 
 /**
  * Compute a path from one node to another.
@@ -186,7 +278,255 @@ double ssmap_path_travel_time(const struct ssmap * m, int size, int node_ids[siz
  * @param m The ssmap structure where the path will be created.
  * @param start_id the starting node id 
  * @param end_id the destination node id
+ * @param out Where to print the path.
+ */
+void ssmap_path_create(const struct ssmap * m, int start_id, int end_id, FILE * out);
+
+/**
+ * The search algorithms that ssmap_path_create_with can use. All of them
+ * find a path with the minimum travel time, they only differ in how much of
+ * the map they explore to find it.
+ */
+enum ssmap_algorithm {
+    SSMAP_DIJKSTRA,         // grow a single search from the start node
+    SSMAP_BIDIRECTIONAL,    // grow searches from both ends until they meet
+    SSMAP_ASTAR,            // search guided by the straight-line distance
+    SSMAP_CH,               // contraction hierarchy, see ssmap_prepare_ch
+    SSMAP_ALT,              // A* with landmark bounds, see ssmap_prepare_alt
+};
+
+/**
+ * Build a contraction hierarchy so that SSMAP_CH searches can be used. This
+ * takes far longer than a single query but makes every later query explore
+ * only a few hundred nodes. Prints the preprocessing time and the number of
+ * shortcuts added.
+ *
+ * @param m An ssmap structure that has been initialized.
+ * @return true on success, false if memory allocation fails.
+ */
+bool ssmap_prepare_ch(struct ssmap * m);
+
+/**
+ * Select landmarks and compute their distance tables so that SSMAP_ALT
+ * searches can be used. Each landmark costs two full searches at load time
+ * and two floats per node of memory; more landmarks give tighter bounds and
+ * faster queries. Prints the preprocessing time and the size of the tables.
+ *
+ * @param m An ssmap structure that has been initialized.
+ * @param count The number of landmarks to select.
+ * @return true on success, false if count is not positive or memory
+ * allocation fails.
+ */
+bool ssmap_prepare_alt(struct ssmap * m, int count);
+
+/**
+ * The orders that ssmap_reorder_nodes can put the nodes in.
+ */
+enum ssmap_node_order {
+    SSMAP_ORDER_HILBERT,    // along a Hilbert curve over the coordinates
+    SSMAP_ORDER_BFS,        // breadth-first over the roads
+};
+
+/**
+ * Renumber the nodes inside the road graphs so that nodes which are searched
+ * together are stored close together in memory, which makes searches faster
+ * on large maps. Node ids do not change: every function still takes and
+ * returns the ids of the map. Must be called before ssmap_prepare_ch and
+ * ssmap_prepare_alt. Prints the time taken.
+ *
+ * @param m An ssmap structure that has been initialized.
+ * @param order The order to put the nodes in.
+ * @return true on success, false if the hierarchy or landmarks have been
+ * built already or memory allocation fails.
+ */
+bool ssmap_reorder_nodes(struct ssmap * m, enum ssmap_node_order order);
+
+/**
+ * Look up a node order by name, "hilbert" or "bfs".
+ *
+ * @param name The name of the order.
+ * @param order Set to the matching order if one is found.
+ * @return true if the name is known, false otherwise.
+ */
+bool ssmap_node_order_by_name(const char * name, enum ssmap_node_order * order);
+
+/**
+ * Look up a search algorithm by the name used in the path create command,
+ * e.g. "dijkstra", "bidir", "astar", "ch" or "alt".
+ *
+ * @param name The name of the algorithm.
+ * @param algorithm Set to the matching algorithm if one is found.
+ * @return true if the name is known, false otherwise.
+ */
+bool ssmap_algorithm_by_name(const char * name, enum ssmap_algorithm * algorithm);
+
+/**
+ * Same as ssmap_path_create, but using the given search algorithm.
+ *
+ * @param m The ssmap structure where the path will be created.
+ * @param start_id the starting node id 
+ * @param end_id the destination node id
+ * @param algorithm the search algorithm to use
+ * @param out Where to print the path.
+ */
+void ssmap_path_create_with(const struct ssmap * m, int start_id, int end_id,
+                            enum ssmap_algorithm algorithm, FILE * out);
+
+/**
+ * @return true if the preprocessing that a search algorithm depends on has
+ * been done, e.g. ssmap_prepare_ch for SSMAP_CH.
+ */
+bool ssmap_algorithm_available(const struct ssmap * m, enum ssmap_algorithm algorithm);
+
+/**
+ * Compute a path from one node to another without printing anything. The
+ * map is only read, so several threads may call this at the same time. Each
+ * thread keeps its search memory between calls; it is released when the
+ * thread exits or, for the calling thread, by ssmap_destroy.
+ *
+ * @param m The ssmap structure where the path will be created.
+ * @param start_id the starting node id 
+ * @param end_id the destination node id
+ * @param algorithm the search algorithm to use
+ * @param path Receives the node ids of the path. Must have room for
+ *             ssmap_nr_nodes(m) entries.
+ * @param minutes If not NULL, receives the travel time of the path.
+ * @return The number of nodes in the path, 0 if there is no path or a node
+ * id is invalid, or -1 if the algorithm is not available or memory
+ * allocation fails.
+ */
+int ssmap_path_find(const struct ssmap * m, int start_id, int end_id,
+                    enum ssmap_algorithm algorithm, int path[], double * minutes);
+
+/**
+ * Keep the shortest-path trees of the last capacity sources that were
+ * searched with SSMAP_DIJKSTRA by ssmap_path_find, and by ssmap_travel_times,
+ * instead of discarding them when the query returns. A later query from the
+ * same source to a node the tree has already settled is answered without
+ * searching, and one to a node further away grows the suspended search from
+ * where it stopped. The least recently used tree is dropped to make room for
+ * a new source. Each tree takes as much memory as a search workspace, about
+ * 50 bytes per node of the map.
+ *
+ * Must not be called while other threads are searching the map.
+ *
+ * @param m An ssmap structure that has been initialized.
+ * @param capacity The number of trees to keep; 0 disables the cache and
+ *                 drops every tree.
+ * @return true on success, false if capacity is negative or memory
+ * allocation fails, in which case the cache is disabled.
+ */
+bool ssmap_enable_tree_cache(struct ssmap * m, int capacity);
+
+/**
+ * The counters of the shortest-path tree cache.
+ */
+struct ssmap_cache_stats {
+    int trees;              // trees currently held
+    int capacity;           // most trees held at once, 0 if disabled
+    unsigned long hits;     // queries answered from a tree as it was
+    unsigned long resumed;  // queries that grew a tree further
+    unsigned long misses;   // queries that started a new tree, or ran
+                            // without one because it was busy
+};
+
+/**
+ * Read the counters of the shortest-path tree cache, which are all zero if
+ * the cache is disabled.
+ *
+ * @param m The ssmap structure.
+ * @param stats Receives the counters.
+ */
+void ssmap_cache_stats(const struct ssmap * m, struct ssmap_cache_stats * stats);
+
+/**
+ * Start recording what each query does: the nodes it settled, the edges it
+ * relaxed, its heap operations, the memory it allocated and how long it
+ * took. Path finding, path time, find, nearest, isochrone and matrix queries
+ * are recorded; ssmap_print_stats shows the last one and the totals and
+ * latency histogram of each kind. Recording only costs two clock reads and
+ * a short locked update per query, and nothing while it is disabled.
+ *
+ * Must not be called while other threads are searching the map.
+ *
+ * @param m An ssmap structure that has been initialized.
+ * @param trace_file If not NULL, each query is also appended to this file as
+ *                   a JSON object on a line of its own.
+ * @return true on success, false if the trace file cannot be opened or
+ * memory allocation fails, in which case recording is disabled.
+ */
+bool ssmap_enable_stats(struct ssmap * m, const char * trace_file);
+
+/**
+ * Print the statistics recorded since ssmap_enable_stats was called, or a
+ * note that recording is disabled.
+ *
+ * @param m The ssmap structure.
+ * @param out Where to print them.
+ */
+void ssmap_print_stats(const struct ssmap * m, FILE * out);
+
+/**
+ * Compute the travel times from one node to many, with a single search that
+ * stops as soon as every target is settled. Like ssmap_path_find, this may be
+ * called from several threads at the same time.
+ *
+ * @param m The ssmap structure.
+ * @param source The starting node id, which must be valid.
+ * @param nr_targets The number of targets.
+ * @param targets The destination node ids, which must be valid. They may
+ *                contain duplicates.
+ * @param minutes Receives the travel time to each target in minutes, or -1
+ *                if the target cannot be reached.
+ * @return true on success, false if memory allocation fails.
+ */
+bool ssmap_travel_times(const struct ssmap * m, int source, int nr_targets, const int targets[],
+                        double minutes[]);
+
+/**
+ * Find every node that can be reached from source within a travel time
+ * budget. The cost depends on the size of the reachable area rather than the
+ * size of the map. Like ssmap_path_find, this may be called from several
+ * threads at the same time.
+ *
+ * @param m The ssmap structure.
+ * @param source The starting node id.
+ * @param budget The travel time budget in minutes.
+ * @param nodes Receives the reachable node ids in order of travel time. Must
+ *              have room for ssmap_nr_nodes(m) entries.
+ * @param minutes If not NULL, receives the travel time to each of them.
+ * @return The number of reachable nodes, including source, or -1 if source
+ * is invalid or memory allocation fails.
+ */
+int ssmap_isochrone(const struct ssmap * m, int source, double budget, int nodes[],
+                    double minutes[]);
+
+/**
+ * Print the nodes that can be reached from source within a travel time
+ * budget, in order of travel time. If edges is set, also print the road
+ * segments that lead from a reachable node to one that is out of reach, one
+ * "from to" pair per line.
+ *
+ * @param m The ssmap structure.
+ * @param source The starting node id.
+ * @param budget The travel time budget in minutes.
+ * @param edges Whether to print the boundary edges.
+ * @param out Where to print them.
+ */
+void ssmap_print_isochrone(const struct ssmap * m, int source, double budget, bool edges,
+                           FILE * out);
+
+/**
+ * Compute a path from one node to another with every available search
+ * algorithm and print, for each of them, the number of nodes it settled, how
+ * long it took, its speedup over plain Dijkstra, or "-" when either timing
+ * is 0, and the travel time of the path it found.
+ *
+ * @param m The ssmap structure where the path will be created.
+ * @param start_id the starting node id 
+ * @param end_id the destination node id
+ * @param out Where to print the comparison.
  */
-void ssmap_path_create(const struct ssmap * m, int start_id, int end_id);
+void ssmap_path_compare(const struct ssmap * m, int start_id, int end_id, FILE * out);
 
 #endif /* _STREETS_H_ */
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "streets.h"
+#include "loader.h"
+#include "rng.h"
+
+#ifndef BENCH_CONF
+#define BENCH_CONF "unknown"
+#endif
+
+#define DEFAULT_QUERIES 1000
+#define DEFAULT_SEED 1
+
+// keywords for find are single words, as the REPL splits on whitespace
+#define MAX_KEYWORD 64
+
+static double
+now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+/**
+ * The latency of every operation of a workload, in microseconds.
+ */
+struct latencies {
+    int count;
+    double *us;
+};
+
+static int
+compare_doubles(const void * a, const void * b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @return The nearest-rank percentile p of the sorted latencies.
+ */
+static double
+percentile(const struct latencies * l, double p)
+{
+    int rank = (int)ceil(p / 100. * l->count);
+    return l->us[rank > 0 ? rank - 1 : 0];
+}
+
+static void
+print_json_string(FILE * out, const char * s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void
+print_workload(FILE * out, const char * name, struct latencies * l, bool last)
+{
+    double total = 0;
+    for (int i = 0; i < l->count; i++) {
+        total += l->us[i];
+    }
+    fprintf(out, "        \"%s\": {\"count\": %d", name, l->count);
+    if (l->count > 0) {
+        qsort(l->us, l->count, sizeof(double), compare_doubles);
+        fprintf(out, ", \"total_ms\": %.3f, \"per_second\": %.1f, \"mean_us\": %.2f, "
+                "\"p50_us\": %.2f, \"p95_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f",
+                total / 1e3, total > 0 ? l->count / (total / 1e6) : 0., total / l->count,
+                percentile(l, 50), percentile(l, 95), percentile(l, 99), l->us[l->count - 1]);
+    }
+    fprintf(out, "}%s\n", last ? "" : ",");
+}
+
+/**
+ * Pick a word of at least three letters, which the name index can look up,
+ * from the name of a random way, or the whole name if it has none.
+ */
+static void
+random_keyword(const struct ssmap * m, struct rng * r, char keyword[MAX_KEYWORD])
+{
+    const char *name = ssmap_way_name(m, rng_below(r, ssmap_nr_ways(m)));
+    const char *words[MAX_KEYWORD];
+    int lengths[MAX_KEYWORD];
+    int nr_words = 0;
+
+    for (const char *p = name; *p != '\0' && nr_words < MAX_KEYWORD; ) {
+        int length = strcspn(p, " ");
+        if (length >= 3) {
+            words[nr_words] = p;
+            lengths[nr_words++] = length;
+        }
+        p += length + strspn(p + length, " ");
+    }
+
+    const char *word = name;
+    int length = strcspn(name, " ");
+    if (nr_words > 0) {
+        int w = rng_below(r, nr_words);
+        word = words[w];
+        length = lengths[w];
+    }
+    if (length >= MAX_KEYWORD) {
+        length = MAX_KEYWORD - 1;
+    }
+    memcpy(keyword, word, length);
+    keyword[length] = '\0';
+}
+
+/**
+ * Run the workloads on one map and append its report to the list in out,
+ * after a comma unless it is the first. The map functions print their
+ * results to stdout, which the caller points at /dev/null, so that printing
+ * is part of the cost as it is in the REPL.
+ *
+ * @return true on success, false if the map cannot be loaded or memory
+ * allocation fails.
+ */
+static bool
+bench_map(FILE * out, const char * filename, int queries, uint64_t seed, bool first)
+{
+    double begin = now_us();
+    struct ssmap *m = load_map(filename);
+    double load_ms = (now_us() - begin) / 1e3;
+    if (m == NULL) {
+        return false;
+    }
+
+    int V = ssmap_nr_nodes(m);
+    struct rng r = { seed };
+    struct latencies create = { 0, malloc((queries + 1) * sizeof(double)) };
+    struct latencies travel = { 0, malloc((queries + 1) * sizeof(double)) };
+    struct latencies way = { 0, malloc((queries + 1) * sizeof(double)) };
+    struct latencies node = { 0, malloc((queries + 1) * sizeof(double)) };
+    int *path = malloc(V * sizeof(int));
+    bool ok = create.us && travel.us && way.us && node.us && path;
+    if (!ok) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        goto done;
+    }
+
+    for (int i = 0; i < queries; i++) {
+        int start_id = rng_below(&r, V), end_id = rng_below(&r, V);
+        double t = now_us();
+        ssmap_path_create(m, start_id, end_id, stdout);
+        create.us[create.count++] = now_us() - t;
+    }
+
+    // path time is given the paths that path find returns, so that it walks
+    // whole paths rather than stopping at the first error; pairs that are
+    // not connected are drawn again, up to a limit for badly connected maps
+    for (int tries = 0; travel.count < queries && tries < 4 * queries; tries++) {
+        int start_id = rng_below(&r, V), end_id = rng_below(&r, V);
+        int cc = ssmap_path_find(m, start_id, end_id, SSMAP_DIJKSTRA, path, NULL);
+        if (cc >= 2) {
+            double t = now_us();
+            ssmap_path_travel_time(m, cc, path, stdout);
+            travel.us[travel.count++] = now_us() - t;
+        }
+    }
+
+    for (int i = 0; i < queries; i++) {
+        char keyword[MAX_KEYWORD];
+        random_keyword(m, &r, keyword);
+        double t = now_us();
+        ssmap_find_way_by_name(m, keyword, stdout);
+        way.us[way.count++] = now_us() - t;
+    }
+
+    // half of the node queries name one way, half an intersection of two
+    for (int i = 0; i < queries; i++) {
+        char keyword1[MAX_KEYWORD], keyword2[MAX_KEYWORD];
+        random_keyword(m, &r, keyword1);
+        bool two = rng_below(&r, 2) == 1;
+        if (two) {
+            random_keyword(m, &r, keyword2);
+        }
+        double t = now_us();
+        ssmap_find_node_by_names(m, keyword1, two ? keyword2 : NULL, stdout);
+        node.us[node.count++] = now_us() - t;
+    }
+    fflush(stdout);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(out, "%s    {\n      \"map\": ", first ? "" : ",\n");
+    print_json_string(out, filename);
+    fprintf(out, ",\n      \"nodes\": %d,\n      \"ways\": %d,\n", V, ssmap_nr_ways(m));
+    fprintf(out, "      \"load_ms\": %.3f,\n", load_ms);
+    fprintf(out, "      \"workloads\": {\n");
+    print_workload(out, "path_create", &create, false);
+    print_workload(out, "path_time", &travel, false);
+    print_workload(out, "find_way", &way, false);
+    print_workload(out, "find_node", &node, true);
+    fprintf(out, "      },\n");
+    // the high-water mark of the whole process, which includes the maps
+    // benchmarked before this one
+    fprintf(out, "      \"peak_rss_kb\": %ld\n", usage.ru_maxrss);
+    fprintf(out, "    }");
+
+done:
+    free(create.us);
+    free(travel.us);
+    free(way.us);
+    free(node.us);
+    free(path);
+    ssmap_destroy(m);
+    return ok;
+}
+
+static void
+usage(const char * prog)
+{
+    fprintf(stderr, "usage: %s [options] MAP...\n"
+            "  --queries N    operations per workload (default %d)\n"
+            "  --seed N       seed of the random workloads (default %d)\n"
+            "  --output OUT   write the JSON report to OUT instead of stdout\n"
+            "Loads each MAP, times path create, path time, find way and find node\n"
+            "on it and reports the latencies as JSON.\n", prog, DEFAULT_QUERIES, DEFAULT_SEED);
+}
+
+int
+main(int argc, char * argv[])
+{
+    static const struct option long_options[] = {
+        { "queries", required_argument, NULL, 'q' },
+        { "seed", required_argument, NULL, 's' },
+        { "output", required_argument, NULL, 'O' },
+        { NULL, 0, NULL, 0 },
+    };
+    int queries = DEFAULT_QUERIES;
+    uint64_t seed = DEFAULT_SEED;
+    const char * output = NULL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'q':
+            queries = atoi(optarg);
+            if (queries <= 0) {
+                fprintf(stderr, "error: --queries needs a positive number.\n");
+                return 1;
+            }
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'O':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // the report goes to the real stdout and everything the map functions
+    // print is thrown away
+    FILE * out = output != NULL ? fopen(output, "w") : fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL) {
+        fprintf(stderr, "error: could not open %s\n", output != NULL ? output : "stdout");
+        return 1;
+    }
+    fflush(stdout);
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "error: could not open /dev/null\n");
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"conf\": \"%s\",\n  \"seed\": %llu,\n  \"queries\": %d,\n",
+            BENCH_CONF, (unsigned long long)seed, queries);
+    fprintf(out, "  \"maps\": [\n");
+    bool ok = true;
+    for (int i = optind; ok && i < argc; i++) {
+        ok = bench_map(out, argv[i], queries, seed, i == optind);
+    }
+    // a map that fails is left out, so the report is valid JSON either way
+    fprintf(out, "\n  ]\n}\n");
+
+    if (fclose(out) != 0) {
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "rng.h"
+
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_REQUESTS 1000
+#define DEFAULT_SEED 1
+#define MAX_REQUEST 4096
+#define MAX_PIPELINE 1024
+
+static const char prompt[] = ">> ";
+
+struct options {
+    const char *address;
+    int connections;
+    int requests;           // per connection
+    int pipeline;           // requests a connection keeps in flight
+    int nodes;              // node ids to draw path queries from
+    const char *method;     // appended to path create, or NULL
+    char **lines;           // requests to replay instead, or NULL
+    int nr_lines;
+    uint64_t seed;
+};
+
+/**
+ * One client connection, run on a thread of its own.
+ */
+struct client {
+    const struct options *opt;
+    int index;
+    double *latencies;      // of each request, in microseconds
+    int completed;
+    int errors;             // responses that start with "error"
+    bool failed;
+};
+
+static double
+now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static int
+compare_doubles(const void * a, const void * b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @return The nearest-rank percentile p of count sorted latencies.
+ */
+static double
+percentile(const double us[], int count, double p)
+{
+    int rank = (int)ceil(p / 100. * count);
+    return us[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * Connect to a Unix socket path, which contains a '/', or to a TCP port on
+ * localhost or host:port, the addresses ssmap --serve takes.
+ *
+ * @return The socket, or -1 after printing an error message.
+ */
+static int
+connect_to(const char * address)
+{
+    if (strchr(address, '/') != NULL) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "error: socket path %s is too long.\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "error: could not connect to %s: %s\n", address, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    char host[256] = "localhost";
+    const char *port = strrchr(address, ':');
+    if (port == NULL) {
+        port = address;
+    } else if ((size_t)(port - address) < sizeof(host)) {
+        memcpy(host, address, port - address);
+        host[port - address] = '\0';
+        port++;
+    } else {
+        fprintf(stderr, "error: host name in %s is too long.\n", address);
+        return -1;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *info;
+    int rc = getaddrinfo(host, port, &hints, &info);
+    if (rc != 0) {
+        fprintf(stderr, "error: could not resolve %s: %s\n", address, gai_strerror(rc));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = info; a != NULL && fd == -1; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    if (fd == -1) {
+        fprintf(stderr, "error: could not connect to %s: %s\n", address, strerror(errno));
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+static bool
+send_all(int fd, const char * data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * A growable buffer of received bytes, holding the responses that have not
+ * been taken yet.
+ */
+struct inbox {
+    char *data;
+    size_t length;
+    size_t capacity;
+    size_t scanned;         // bytes already searched for the end of a response
+};
+
+/**
+ * Receive more bytes into an inbox.
+ *
+ * @return false if the connection was closed or failed.
+ */
+static bool
+receive(int fd, struct inbox * b)
+{
+    if (b->capacity - b->length < 4096) {
+        size_t capacity = b->capacity > 0 ? 2 * b->capacity : 65536;
+        char *data = realloc(b->data, capacity);
+        if (!data) {
+            return false;
+        }
+        b->data = data;
+        b->capacity = capacity;
+    }
+    ssize_t n;
+    do {
+        n = recv(fd, b->data + b->length, b->capacity - b->length, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+    b->length += n;
+    return true;
+}
+
+/**
+ * Find the end of the first response in an inbox: the prompt that follows
+ * it, which starts a line. An empty response is just the prompt.
+ *
+ * @return The length of the response including the prompt, or 0 if it is
+ * not complete yet.
+ */
+static size_t
+response_length(struct inbox * b)
+{
+    if (b->length >= 3 && memcmp(b->data, prompt, 3) == 0) {
+        return 3;
+    }
+    for (size_t i = b->scanned; i + 4 <= b->length; i++) {
+        if (b->data[i] == '\n' && memcmp(b->data + i + 1, prompt, 3) == 0) {
+            b->scanned = 0;
+            return i + 4;
+        }
+    }
+    b->scanned = b->length >= 3 ? b->length - 3 : 0;
+    return 0;
+}
+
+static void
+take_response(struct inbox * b, size_t length)
+{
+    memmove(b->data, b->data + length, b->length - length);
+    b->length -= length;
+}
+
+static void
+make_request(const struct options * opt, struct client * c, struct rng * r, int k,
+             char request[MAX_REQUEST])
+{
+    if (opt->lines != NULL) {
+        int line = ((long)c->index * opt->requests + k) % opt->nr_lines;
+        snprintf(request, MAX_REQUEST, "%s\n", opt->lines[line]);
+    } else {
+        int start = rng_below(r, opt->nodes), end = rng_below(r, opt->nodes);
+        snprintf(request, MAX_REQUEST, "path create %d %d%s%s\n", start, end,
+                 opt->method != NULL ? " " : "", opt->method != NULL ? opt->method : "");
+    }
+}
+
+static void *
+run_client(void * arg)
+{
+    struct client *c = arg;
+    const struct options *opt = c->opt;
+    struct rng r = { opt->seed + (uint64_t)c->index * 0x9e3779b97f4a7c15ull };
+    struct inbox in = { NULL, 0, 0, 0 };
+    double sent_at[opt->pipeline];
+    int sent = 0;
+    size_t length;
+
+    int fd = connect_to(opt->address);
+    if (fd < 0) {
+        c->failed = true;
+        return NULL;
+    }
+    // the greeting prompt
+    while ((length = response_length(&in)) == 0) {
+        if (!receive(fd, &in)) {
+            goto failed;
+        }
+    }
+    take_response(&in, length);
+
+    while (c->completed < opt->requests) {
+        while (sent < opt->requests && sent - c->completed < opt->pipeline) {
+            char request[MAX_REQUEST];
+            make_request(opt, c, &r, sent, request);
+            sent_at[sent % opt->pipeline] = now_us();
+            if (!send_all(fd, request, strlen(request))) {
+                goto failed;
+            }
+            sent++;
+        }
+        while ((length = response_length(&in)) == 0) {
+            if (!receive(fd, &in)) {
+                goto failed;
+            }
+        }
+        double latency = now_us() - sent_at[c->completed % opt->pipeline];
+        if (strncmp(in.data, "error", 5) == 0) {
+            c->errors++;
+        }
+        take_response(&in, length);
+        c->latencies[c->completed++] = latency;
+    }
+    send_all(fd, "quit\n", 5);
+    close(fd);
+    free(in.data);
+    return NULL;
+
+failed:
+    fprintf(stderr, "error: connection %d closed after %d responses.\n", c->index,
+            c->completed);
+    c->failed = true;
+    close(fd);
+    free(in.data);
+    return NULL;
+}
+
+/**
+ * Read the requests of --file, one per line, skipping blank lines.
+ *
+ * @return false if the file cannot be read or has no requests.
+ */
+static bool
+load_lines(struct options * opt, const char * filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open %s\n", filename);
+        return false;
+    }
+    char line[MAX_REQUEST];
+    int capacity = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0') {
+            continue;
+        }
+        if (opt->nr_lines == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 256;
+            char **lines = realloc(opt->lines, capacity * sizeof(char *));
+            if (!lines) {
+                ok = false;
+                break;
+            }
+            opt->lines = lines;
+        }
+        if ((opt->lines[opt->nr_lines] = strdup(line)) == NULL) {
+            ok = false;
+            break;
+        }
+        opt->nr_lines++;
+    }
+    if (!ok) {
+        fprintf(stderr, "Memory allocation failed.\n");
+    } else if (ferror(f) || opt->nr_lines == 0) {
+        fprintf(stderr, "error: no requests read from %s\n", filename);
+        ok = false;
+    }
+    fclose(f);
+    return ok;
+}
+
+static void
+usage(const char * prog)
+{
+    fprintf(stderr, "usage: %s [options] ADDRESS\n"
+            "  --connections N  concurrent connections (default %d)\n"
+            "  --requests N     requests per connection (default %d)\n"
+            "  --pipeline N     requests each connection keeps in flight, up to %d\n"
+            "                   (default 1)\n"
+            "  --nodes N        send 'path create' queries between random nodes\n"
+            "                   below N\n"
+            "  --method NAME    search method for the path queries\n"
+            "  --file QUERIES   send the lines of QUERIES in turn instead\n"
+            "  --seed N         seed of the random queries (default %d)\n"
+            "Drives a server started with ssmap --serve ADDRESS and reports its\n"
+            "throughput and latency.\n", prog, DEFAULT_CONNECTIONS, DEFAULT_REQUESTS,
+            MAX_PIPELINE, DEFAULT_SEED);
+}
+
+int
+main(int argc, char * argv[])
+{
+    static const struct option long_options[] = {
+        { "connections", required_argument, NULL, 'c' },
+        { "requests", required_argument, NULL, 'r' },
+        { "pipeline", required_argument, NULL, 'p' },
+        { "nodes", required_argument, NULL, 'n' },
+        { "method", required_argument, NULL, 'm' },
+        { "file", required_argument, NULL, 'f' },
+        { "seed", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct options opt = {
+        .connections = DEFAULT_CONNECTIONS,
+        .requests = DEFAULT_REQUESTS,
+        .pipeline = 1,
+        .seed = DEFAULT_SEED,
+    };
+    const char *file = NULL;
+    int opt_char;
+
+    while ((opt_char = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt_char) {
+        case 'c':
+            opt.connections = atoi(optarg);
+            break;
+        case 'r':
+            opt.requests = atoi(optarg);
+            break;
+        case 'p':
+            opt.pipeline = atoi(optarg);
+            break;
+        case 'n':
+            opt.nodes = atoi(optarg);
+            break;
+        case 'm':
+            opt.method = optarg;
+            break;
+        case 'f':
+            file = optarg;
+            break;
+        case 's':
+            opt.seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || opt.connections <= 0 || opt.requests <= 0 ||
+        opt.pipeline <= 0 || opt.pipeline > MAX_PIPELINE || (file == NULL && opt.nodes <= 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+    opt.address = argv[optind];
+    if (file != NULL && !load_lines(&opt, file)) {
+        return 1;
+    }
+
+    struct client *clients = calloc(opt.connections, sizeof(struct client));
+    pthread_t *threads = calloc(opt.connections, sizeof(pthread_t));
+    double *all = malloc((size_t)opt.connections * opt.requests * sizeof(double));
+    bool ok = clients && threads && all;
+    int started = 0;
+    for (int i = 0; ok && i < opt.connections; i++) {
+        clients[i] = (struct client){ &opt, i, all + (size_t)i * opt.requests, 0, 0, false };
+    }
+
+    double begin = now_us();
+    while (ok && started < opt.connections &&
+           pthread_create(&threads[started], NULL, run_client, &clients[started]) == 0) {
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double seconds = (now_us() - begin) / 1e6;
+    if (ok && started < opt.connections) {
+        fprintf(stderr, "error: could not start the client threads.\n");
+        ok = false;
+    }
+
+    // the latencies of each client are at the front of its slice
+    int count = 0, errors = 0;
+    for (int i = 0; i < started; i++) {
+        memmove(all + count, clients[i].latencies, clients[i].completed * sizeof(double));
+        count += clients[i].completed;
+        errors += clients[i].errors;
+        ok = ok && !clients[i].failed;
+    }
+    if (count > 0) {
+        double total = 0;
+        for (int i = 0; i < count; i++) {
+            total += all[i];
+        }
+        qsort(all, count, sizeof(double), compare_doubles);
+        printf("%d connections, %d requests in %.3f s: %.1f requests/sec, %d errors\n",
+               started, count, seconds, count / seconds, errors);
+        printf("latency us: mean %.1f p50 %.1f p95 %.1f p99 %.1f max %.1f\n", total / count,
+               percentile(all, count, 50), percentile(all, count, 95),
+               percentile(all, count, 99), all[count - 1]);
+    }
+
+    for (int i = 0; i < opt.nr_lines; i++) {
+        free(opt.lines[i]);
+    }
+    free(opt.lines);
+    free(clients);
+    free(threads);
+    free(all);
+    return ok ? 0 : 1;
+}
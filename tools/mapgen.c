@@ -0,0 +1,516 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+#include "rng.h"
+
+#define DEFAULT_NODES 1000000
+#define DEFAULT_SEED 1
+
+/**
+ * Intersections are laid out on a lattice about 100 metres apart, starting
+ * at ORIGIN_LAT, ORIGIN_LON and growing north and east.
+ */
+#define ORIGIN_LAT 43.6
+#define ORIGIN_LON -79.6
+#define SPACING_LAT 0.0009
+#define SPACING_LON 0.00125
+
+/**
+ * A node is in at most two ways of its row street, where one way ends and
+ * the next begins, and two of its column street.
+ */
+#define MAX_NODE_WAYS 4
+
+// streets are split into ways of this many blocks, like OSM ways
+#define MIN_WAY_BLOCKS 3
+#define MAX_WAY_BLOCKS 30
+
+#define NAME_SIZE 64
+
+enum network {
+    NETWORK_GRID,       // a regular lattice of straight streets
+    NETWORK_PLANAR,     // a jittered lattice with missing blocks and bends
+};
+
+/**
+ * Street classes, every ARTERIAL_EVERY-th street being an arterial and
+ * every COLLECTOR_EVERY-th of the others a collector.
+ */
+enum street_class {
+    STREET_LOCAL,
+    STREET_COLLECTOR,
+    STREET_ARTERIAL,
+};
+#define ARTERIAL_EVERY 10
+#define COLLECTOR_EVERY 4
+
+// the speed limit of each way is drawn from those of its street class
+#define NR_SPEEDS 4
+static const float local_speeds[NR_SPEEDS] = { 30, 40, 40, 50 };
+static const float collector_speeds[NR_SPEEDS] = { 40, 50, 50, 60 };
+static const float arterial_speeds[NR_SPEEDS] = { 60, 60, 70, 80 };
+
+// the share of streets of each class that are one way
+static const double oneway_share[] = { 0.2, 0.1, 0.0 };
+
+/**
+ * Few enough names that they repeat across a large map, as they do in
+ * real regions.
+ */
+static const char * const base_names[] = {
+    "King", "Queen", "Main", "Church", "Oak", "Maple", "Elm", "Pine", "Cedar", "Birch",
+    "Park", "Lake", "Hill", "River", "Mill", "Bay", "College", "Victoria", "Albert",
+    "George", "Wellington", "Dundas", "Bloor", "Front", "Richmond", "Adelaide", "Spadina",
+    "Bathurst", "Ossington", "Dufferin", "Keele", "Jane", "Islington", "Kipling", "Yonge",
+    "Bayview", "Leslie", "Victoria Park", "Pharmacy", "Warden", "Kennedy", "Midland",
+    "Brimley", "McCowan", "Markham", "Sheppard", "Finch", "Steeles", "Eglinton", "Lawrence",
+};
+static const char * const row_suffixes[] = { "Street", "Road", "Avenue", "Street West",
+                                             "Street East", "Crescent" };
+static const char * const column_suffixes[] = { "Avenue", "Drive", "Road", "Lane",
+                                                "Boulevard", "Avenue North" };
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+struct street {
+    char name[NAME_SIZE];
+    enum street_class kind;
+    bool oneway;
+    bool reversed;      // a one-way street that runs west or south
+};
+
+struct way {
+    int street;
+    float speed;
+    int first;          // the nodes of the way are ids[first] up to ids[first + count]
+    int count;
+};
+
+struct generator {
+    enum network network;
+    uint64_t seed;
+    struct rng rng;
+    int rows, columns;
+    int *intersections;         // node id of each lattice point, or -1 until used
+    struct street *streets;     // rows then columns
+    // nodes
+    int nr_nodes, node_capacity;
+    double *lat, *lon;
+    unsigned char *nr_node_ways;
+    int (*node_ways)[MAX_NODE_WAYS];
+    // ways
+    int nr_ways, way_capacity;
+    struct way *ways;
+    int nr_ids, id_capacity;
+    int *ids;
+};
+
+/**
+ * Grow the ways or the id list to hold at least count elements, doubling
+ * its capacity.
+ *
+ * @return true on success, false if memory allocation fails.
+ */
+static bool
+reserve(void ** array, int * capacity, int count, size_t size)
+{
+    if (count <= *capacity) {
+        return true;
+    }
+    int grown = *capacity ? *capacity : 1024;
+    while (grown < count) {
+        grown *= 2;
+    }
+    void *p = realloc(*array, (size_t)grown * size);
+    if (p == NULL) {
+        return false;
+    }
+    *array = p;
+    *capacity = grown;
+    return true;
+}
+
+static int
+add_node(struct generator * g, double lat, double lon)
+{
+    if (g->nr_nodes == g->node_capacity) {
+        int capacity = g->node_capacity ? 2 * g->node_capacity : 1024;
+        double *lats = realloc(g->lat, capacity * sizeof(double));
+        if (lats) {
+            g->lat = lats;
+        }
+        double *lons = realloc(g->lon, capacity * sizeof(double));
+        if (lons) {
+            g->lon = lons;
+        }
+        unsigned char *counts = realloc(g->nr_node_ways, capacity);
+        if (counts) {
+            g->nr_node_ways = counts;
+        }
+        int (*ways)[MAX_NODE_WAYS] = realloc(g->node_ways, capacity * sizeof(int[MAX_NODE_WAYS]));
+        if (ways) {
+            g->node_ways = ways;
+        }
+        if (!lats || !lons || !counts || !ways) {
+            return -1;
+        }
+        g->node_capacity = capacity;
+    }
+    g->lat[g->nr_nodes] = lat;
+    g->lon[g->nr_nodes] = lon;
+    g->nr_node_ways[g->nr_nodes] = 0;
+    return g->nr_nodes++;
+}
+
+/**
+ * @return A number in [-1, 1) that only depends on the seed and the key, so
+ * that features of the lattice do not depend on the order they are made in.
+ */
+static double
+hashed_uniform(const struct generator * g, uint64_t key)
+{
+    struct rng r = { g->seed ^ (key * 0xd6e8feb86659fd93ull) };
+    return 2 * rng_uniform(&r) - 1;
+}
+
+/**
+ * @return The node of a lattice point, created on first use so that points
+ * without any road do not become nodes.
+ */
+static int
+intersection(struct generator * g, int row, int column)
+{
+    int *id = &g->intersections[(size_t)row * g->columns + column];
+    if (*id == -1) {
+        double lat = ORIGIN_LAT + row * SPACING_LAT;
+        double lon = ORIGIN_LON + column * SPACING_LON;
+        if (g->network == NETWORK_PLANAR) {
+            // within a third of the spacing, so the blocks keep their shape
+            uint64_t key = (uint64_t)row * g->columns + column;
+            lat += hashed_uniform(g, 2 * key) * SPACING_LAT / 3;
+            lon += hashed_uniform(g, 2 * key + 1) * SPACING_LON / 3;
+        }
+        *id = add_node(g, lat, lon);
+    }
+    return *id;
+}
+
+/**
+ * @return Whether the block from a lattice point to the next one along a
+ * row (or a column if vertical) has a road. Planar networks lose some
+ * blocks, which leaves dead ends and T junctions.
+ */
+static bool
+has_block(const struct generator * g, int row, int column, bool vertical)
+{
+    if (g->network == NETWORK_GRID) {
+        return true;
+    }
+    uint64_t key = ((uint64_t)row * g->columns + column) * 2 + vertical;
+    return hashed_uniform(g, key ^ (0x5bd1e995ull << 32)) > -0.84;
+}
+
+static bool
+append_id(struct generator * g, int id)
+{
+    if (id == -1 || !reserve((void **)&g->ids, &g->id_capacity, g->nr_ids + 1, sizeof(int))) {
+        return false;
+    }
+    g->ids[g->nr_ids++] = id;
+    return true;
+}
+
+/**
+ * Add the way of a street over the lattice points from..to of one row or
+ * column, with bends between the points of a planar network.
+ *
+ * @return true on success, false if memory allocation fails.
+ */
+static bool
+add_way(struct generator * g, int street, int line, int from, int to, bool vertical)
+{
+    struct street *s = &g->streets[street];
+    if (!reserve((void **)&g->ways, &g->way_capacity, g->nr_ways + 1, sizeof(struct way))) {
+        return false;
+    }
+    struct way *w = &g->ways[g->nr_ways];
+    w->street = street;
+    w->first = g->nr_ids;
+
+    for (int k = from; k <= to; k++) {
+        int a = vertical ? intersection(g, k, line) : intersection(g, line, k);
+        if (!append_id(g, a)) {
+            return false;
+        }
+        if (k == to || g->network == NETWORK_GRID) {
+            continue;
+        }
+        int b = vertical ? intersection(g, k + 1, line) : intersection(g, line, k + 1);
+        if (b == -1) {
+            return false;
+        }
+        // bends are nodes between the ends of a block, pushed off the
+        // straight line by up to a tenth of a block
+        int nr_bends = rng_below(&g->rng, 3);
+        for (int j = 1; j <= nr_bends; j++) {
+            double t = (double)j / (nr_bends + 1);
+            double offset = (2 * rng_uniform(&g->rng) - 1) / 10;
+            double lat = g->lat[a] + t * (g->lat[b] - g->lat[a]);
+            double lon = g->lon[a] + t * (g->lon[b] - g->lon[a]);
+            if (vertical) {
+                lon += offset * SPACING_LON;
+            } else {
+                lat += offset * SPACING_LAT;
+            }
+            if (!append_id(g, add_node(g, lat, lon))) {
+                return false;
+            }
+        }
+    }
+    w->count = g->nr_ids - w->first;
+
+    // one-way streets list their nodes in the direction of travel
+    if (s->reversed) {
+        for (int i = w->first, j = g->nr_ids - 1; i < j; i++, j--) {
+            int t = g->ids[i];
+            g->ids[i] = g->ids[j];
+            g->ids[j] = t;
+        }
+    }
+
+    const float *speeds = s->kind == STREET_ARTERIAL ? arterial_speeds :
+                          s->kind == STREET_COLLECTOR ? collector_speeds : local_speeds;
+    w->speed = speeds[rng_below(&g->rng, NR_SPEEDS)];
+
+    for (int i = w->first; i < g->nr_ids; i++) {
+        int node = g->ids[i];
+        g->node_ways[node][g->nr_node_ways[node]++] = g->nr_ways;
+    }
+    g->nr_ways++;
+    return true;
+}
+
+static void
+name_street(struct generator * g, int street, int index, bool vertical)
+{
+    struct street *s = &g->streets[street];
+    const char *base = base_names[rng_below(&g->rng, COUNT(base_names))];
+    const char *suffix = vertical ? column_suffixes[rng_below(&g->rng, COUNT(column_suffixes))]
+                                  : row_suffixes[rng_below(&g->rng, COUNT(row_suffixes))];
+    snprintf(s->name, NAME_SIZE, "%s %s", base, suffix);
+
+    s->kind = index % ARTERIAL_EVERY == 0 ? STREET_ARTERIAL :
+              index % COLLECTOR_EVERY == 0 ? STREET_COLLECTOR : STREET_LOCAL;
+    s->oneway = rng_uniform(&g->rng) < oneway_share[s->kind];
+    s->reversed = s->oneway && rng_below(&g->rng, 2) == 1;
+}
+
+/**
+ * Lay out the streets of one row or column. Each run of blocks that have a
+ * road is cut into ways of a few blocks each.
+ *
+ * @return true on success, false if memory allocation fails.
+ */
+static bool
+add_street(struct generator * g, int street, int line, int length, bool vertical)
+{
+    int k = 0;
+    while (k < length - 1) {
+        int row = vertical ? k : line, column = vertical ? line : k;
+        if (!has_block(g, row, column, vertical)) {
+            k++;
+            continue;
+        }
+        int end = k + 1;
+        while (end < length - 1 &&
+               has_block(g, vertical ? end : line, vertical ? line : end, vertical)) {
+            end++;
+        }
+
+        // cut the run at end into ways, without leaving a single block over
+        while (k < end) {
+            int blocks = MIN_WAY_BLOCKS + rng_below(&g->rng, MAX_WAY_BLOCKS - MIN_WAY_BLOCKS + 1);
+            int to = k + blocks < end - 1 ? k + blocks : end;
+            if (!add_way(g, street, line, k, to, vertical)) {
+                return false;
+            }
+            k = to;
+        }
+    }
+    return true;
+}
+
+/**
+ * Generate the network, about target nodes in all.
+ *
+ * @return true on success, false if memory allocation fails.
+ */
+static bool
+generate(struct generator * g, int target)
+{
+    // a planar network has a bend per block on average, and two blocks per
+    // lattice point
+    int points = g->network == NETWORK_PLANAR ? target / 3 : target;
+    g->rows = (int)ceil(sqrt(points > 4 ? points : 4));
+    g->columns = (points + g->rows - 1) / g->rows;
+    if (g->columns < 2) {
+        g->columns = 2;
+    }
+
+    size_t nr_points = (size_t)g->rows * g->columns;
+    g->intersections = malloc(nr_points * sizeof(int));
+    g->streets = calloc(g->rows + g->columns, sizeof(struct street));
+    if (!g->intersections || !g->streets) {
+        return false;
+    }
+    memset(g->intersections, -1, nr_points * sizeof(int));
+
+    for (int r = 0; r < g->rows; r++) {
+        name_street(g, r, r, false);
+        if (!add_street(g, r, r, g->columns, false)) {
+            return false;
+        }
+    }
+    for (int c = 0; c < g->columns; c++) {
+        int street = g->rows + c;
+        name_street(g, street, c, true);
+        if (!add_street(g, street, c, g->rows, true)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Write the map in the "Simple Street Map" format that load_map reads.
+ * OSM ids are made up from the ids, which is all they are used for.
+ *
+ * @return true on success, false if the file cannot be written.
+ */
+static bool
+write_map(const struct generator * g, const char * filename)
+{
+    FILE * f = fopen(filename, "w");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open %s\n", filename);
+        return false;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    fprintf(f, "Simple Street Map\n%d ways\n%d nodes\n", g->nr_ways, g->nr_nodes);
+    for (int i = 0; i < g->nr_ways; i++) {
+        const struct way *w = &g->ways[i];
+        const struct street *s = &g->streets[w->street];
+        fprintf(f, "way %d %d %s\n %.1f %s %d\n", i, 100000000 + i, s->name, w->speed,
+                s->oneway ? "oneway" : "normal", w->count);
+        for (int j = 0; j < w->count; j++) {
+            fprintf(f, " %d", g->ids[w->first + j]);
+        }
+        fputc('\n', f);
+    }
+    for (int i = 0; i < g->nr_nodes; i++) {
+        fprintf(f, "node %d %lld %.7f %.7f %d\n", i, 1000000000LL + i, g->lat[i], g->lon[i],
+                g->nr_node_ways[i]);
+        for (int j = 0; j < g->nr_node_ways[i]; j++) {
+            fprintf(f, " %d", g->node_ways[i][j]);
+        }
+        fputc('\n', f);
+    }
+
+    bool ok = !ferror(f);
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "error: could not write %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+static void
+generator_free(struct generator * g)
+{
+    free(g->intersections);
+    free(g->streets);
+    free(g->lat);
+    free(g->lon);
+    free(g->nr_node_ways);
+    free(g->node_ways);
+    free(g->ways);
+    free(g->ids);
+}
+
+static void
+usage(const char * prog)
+{
+    fprintf(stderr, "usage: %s [options] OUT\n"
+            "  --network NAME grid for a regular lattice of straight streets, or\n"
+            "                 planar for a jittered one with missing blocks and\n"
+            "                 bends (default planar)\n"
+            "  --nodes N      about how many nodes to generate (default %d)\n"
+            "  --seed N       seed of the random features (default %d)\n"
+            "Writes a Simple Street Map with repeated street names, one-way streets,\n"
+            "a mix of speed limits and intersections of up to four ways to OUT.\n",
+            prog, DEFAULT_NODES, DEFAULT_SEED);
+}
+
+int
+main(int argc, char * argv[])
+{
+    static const struct option long_options[] = {
+        { "network", required_argument, NULL, 'n' },
+        { "nodes", required_argument, NULL, 'N' },
+        { "seed", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 },
+    };
+    struct generator g;
+    int target = DEFAULT_NODES;
+    int opt;
+
+    memset(&g, 0, sizeof(g));
+    g.network = NETWORK_PLANAR;
+    g.seed = DEFAULT_SEED;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            if (strcmp(optarg, "grid") == 0) {
+                g.network = NETWORK_GRID;
+            } else if (strcmp(optarg, "planar") == 0) {
+                g.network = NETWORK_PLANAR;
+            } else {
+                fprintf(stderr, "error: unknown network %s.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'N':
+            target = atoi(optarg);
+            if (target <= 0 || target > 100000000) {
+                fprintf(stderr, "error: --nodes needs a number from 1 to 100000000.\n");
+                return 1;
+            }
+            break;
+        case 's':
+            g.seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    g.rng.state = g.seed;
+    bool ok = generate(&g, target);
+    if (!ok) {
+        fprintf(stderr, "Memory allocation failed.\n");
+    } else if ((ok = write_map(&g, argv[optind]))) {
+        printf("%s written. %d nodes, %d ways.\n", argv[optind], g.nr_nodes, g.nr_ways);
+    }
+    generator_free(&g);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#ifndef _RNG_H_
+#define _RNG_H_
+
+#include <stdint.h>
+
+/**
+ * A splitmix64 generator, so that the tools produce the same workloads and
+ * maps on every platform and C library for a given seed.
+ */
+struct rng {
+    uint64_t state;
+};
+
+static inline uint64_t
+rng_next(struct rng * r)
+{
+    uint64_t z = (r->state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @return A number from 0 up to n - 1.
+ */
+static inline int
+rng_below(struct rng * r, int n)
+{
+    return (int)(rng_next(r) % (uint64_t)n);
+}
+
+/**
+ * @return A number in [0, 1).
+ */
+static inline double
+rng_uniform(struct rng * r)
+{
+    return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif /* _RNG_H_ */